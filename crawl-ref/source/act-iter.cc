@@ -5,9 +5,20 @@
 #include "env.h"
 #include "losglobal.h"
 
+// The monsters that may be in LOS of c.
+static void _near_candidates(monster_bitset &cands, const coord_def& c,
+                             los_type los)
+{
+    if (los == LOS_NONE)
+        cands.fill();
+    else
+        env.mon_index.near(c, LOS_RADIUS, cands);
+}
+
 actor_near_iterator::actor_near_iterator(coord_def c, los_type los)
     : center(c), _los(los), viewer(nullptr), i(-1)
 {
+    _near_candidates(candidates, center, _los);
     if (!valid(&you))
         advance();
 }
@@ -15,6 +26,7 @@ actor_near_iterator::actor_near_iterator(coord_def c, los_type los)
 actor_near_iterator::actor_near_iterator(const actor* a, los_type los)
     : center(a->pos()), _los(los), viewer(a), i(-1)
 {
+    _near_candidates(candidates, center, _los);
     if (!valid(&you))
         advance();
 }
@@ -64,7 +76,7 @@ bool actor_near_iterator::valid(const actor* a) const
 void actor_near_iterator::advance()
 {
     do
-         if (++i >= MAX_MONSTERS)
+         if ((i = candidates.next(i)) >= MAX_MONSTERS)
              return;
     while (!valid(**this));
 }
@@ -74,6 +86,7 @@ void actor_near_iterator::advance()
 monster_near_iterator::monster_near_iterator(coord_def c, los_type los)
     : center(c), _los(los), viewer(nullptr), i(0)
 {
+    _near_candidates(candidates, center, _los);
     if (!valid(&env.mons[0]))
         advance();
     begin_point = i;
@@ -82,6 +95,7 @@ monster_near_iterator::monster_near_iterator(coord_def c, los_type los)
 monster_near_iterator::monster_near_iterator(const actor *a, los_type los)
     : center(a->pos()), _los(los), viewer(a), i(0)
 {
+    _near_candidates(candidates, center, _los);
     if (!valid(&env.mons[0]))
         advance();
     begin_point = i;
@@ -154,7 +168,7 @@ bool monster_near_iterator::valid(const monster* a) const
 void monster_near_iterator::advance()
 {
     do
-         if (++i >= MAX_MONSTERS)
+         if ((i = candidates.next(i)) >= MAX_MONSTERS)
              return;
     while (!valid(**this));
 }
@@ -162,10 +176,9 @@ void monster_near_iterator::advance()
 //////////////////////////////////////////////////////////////////////////
 
 monster_iterator::monster_iterator()
-    : i(0)
+    : i(-1)
 {
-    while (i < MAX_MONSTERS && !env.mons[i].alive())
-        i++;
+    ++(*this);
 }
 
 monster_iterator::operator bool() const
@@ -188,7 +201,7 @@ monster* monster_iterator::operator->() const
 
 monster_iterator& monster_iterator::operator++()
 {
-    while (++i < MAX_MONSTERS)
+    while ((i = env.mon_index.next(i)) < MAX_MONSTERS)
         if (env.mons[i].alive())
             break;
     return *this;
@@ -204,7 +217,7 @@ monster_iterator monster_iterator::operator++(int)
 void monster_iterator::advance()
 {
     do
-         if (++i >= MAX_MONSTERS)
+         if ((i = env.mon_index.next(i)) >= MAX_MONSTERS)
              return;
     while (!(*this)->alive());
 }
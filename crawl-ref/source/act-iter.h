@@ -6,6 +6,7 @@
 #pragma once
 
 #include "los-type.h"
+#include "mon-index.h"
 
 class actor_near_iterator
 {
@@ -23,6 +24,7 @@ protected:
     const coord_def center;
     los_type _los;
     const actor* viewer;
+    monster_bitset candidates;
     int i;
 
     bool valid(const actor* a) const;
@@ -49,6 +51,7 @@ protected:
     const coord_def center;
     los_type _los;
     const actor* viewer;
+    monster_bitset candidates;
     int i;
     int begin_point;
 
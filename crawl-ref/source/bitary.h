@@ -9,8 +9,20 @@
 #pragma once
 
 #include <bitset>
+#include <cstdint>
 #include <vector>
 
+#if defined(__AVX2__)
+# include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) \
+      || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define BITARY_SSE2
+# include <emmintrin.h>
+#endif
+#if defined(_MSC_VER) && defined(_M_X64)
+# include <intrin.h>
+#endif
+
 #include "debug.h"
 #include "defines.h"
 
@@ -44,6 +56,158 @@ protected:
 #define ULONG_MAX ((unsigned long)(-1))
 #endif
 
+// Index of the lowest set bit of a nonzero word.
+inline unsigned int lowest_bit_index(uint64_t w)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(w);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long i;
+    _BitScanForward64(&i, w);
+    return i;
+#else
+    unsigned int i = 0;
+    while (!(w & 1))
+    {
+        w >>= 1;
+        ++i;
+    }
+    return i;
+#endif
+}
+
+// A bit vector of fixed size stored as whole 64-bit words, aligned to a
+// cache line. Meant for hot inner loops (losight()): the bulk operations
+// work 256 bits at a time with AVX2, 128 with SSE2, and a word at a time
+// otherwise. Instances must not be heap-allocated with plain new before
+// C++17, which would not honour the alignment.
+template <unsigned int SIZE> class alignas(64) AlignedBitVector
+{
+    static_assert(SIZE > 0 && SIZE % 256 == 0,
+                  "AlignedBitVector size must be a multiple of 256");
+public:
+    static const unsigned int NWORDS = SIZE / 64;
+
+protected:
+    uint64_t data[NWORDS];
+
+public:
+    AlignedBitVector()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        for (unsigned int w = 0; w < NWORDS; ++w)
+            data[w] = 0;
+    }
+
+    inline bool get(unsigned int i) const
+    {
+#ifdef ASSERTS
+        if (i >= SIZE)
+            die("bit vector range error: %d / %u", (int)i, SIZE);
+#endif
+        return data[i / 64] >> (i % 64) & 1;
+    }
+
+    inline void set(unsigned int i, bool value = true)
+    {
+#ifdef ASSERTS
+        if (i >= SIZE)
+            die("bit vector range error: %d / %u", (int)i, SIZE);
+#endif
+        if (value)
+            data[i / 64] |= uint64_t(1) << (i % 64);
+        else
+            data[i / 64] &= ~(uint64_t(1) << (i % 64));
+    }
+
+    // *this |= x
+    inline AlignedBitVector<SIZE>& operator|=(const AlignedBitVector<SIZE>& x)
+    {
+#if defined(__AVX2__)
+        for (unsigned int w = 0; w < NWORDS; w += 4)
+        {
+            __m256i *d = reinterpret_cast<__m256i*>(data + w);
+            const __m256i *s = reinterpret_cast<const __m256i*>(x.data + w);
+            _mm256_store_si256(d, _mm256_or_si256(_mm256_load_si256(d),
+                                                  _mm256_load_si256(s)));
+        }
+#elif defined(BITARY_SSE2)
+        for (unsigned int w = 0; w < NWORDS; w += 2)
+        {
+            __m128i *d = reinterpret_cast<__m128i*>(data + w);
+            const __m128i *s = reinterpret_cast<const __m128i*>(x.data + w);
+            _mm_store_si128(d, _mm_or_si128(_mm_load_si128(d),
+                                            _mm_load_si128(s)));
+        }
+#else
+        for (unsigned int w = 0; w < NWORDS; ++w)
+            data[w] |= x.data[w];
+#endif
+        return *this;
+    }
+
+    // *this |= (x & y), without a temporary.
+    inline void or_and(const AlignedBitVector<SIZE>& x,
+                       const AlignedBitVector<SIZE>& y)
+    {
+#if defined(__AVX2__)
+        for (unsigned int w = 0; w < NWORDS; w += 4)
+        {
+            __m256i *d = reinterpret_cast<__m256i*>(data + w);
+            const __m256i *a = reinterpret_cast<const __m256i*>(x.data + w);
+            const __m256i *b = reinterpret_cast<const __m256i*>(y.data + w);
+            _mm256_store_si256(d, _mm256_or_si256(_mm256_load_si256(d),
+                        _mm256_and_si256(_mm256_load_si256(a),
+                                         _mm256_load_si256(b))));
+        }
+#elif defined(BITARY_SSE2)
+        for (unsigned int w = 0; w < NWORDS; w += 2)
+        {
+            __m128i *d = reinterpret_cast<__m128i*>(data + w);
+            const __m128i *a = reinterpret_cast<const __m128i*>(x.data + w);
+            const __m128i *b = reinterpret_cast<const __m128i*>(y.data + w);
+            _mm_store_si128(d, _mm_or_si128(_mm_load_si128(d),
+                        _mm_and_si128(_mm_load_si128(a),
+                                      _mm_load_si128(b))));
+        }
+#else
+        for (unsigned int w = 0; w < NWORDS; ++w)
+            data[w] |= x.data[w] & y.data[w];
+#endif
+    }
+
+    // Whether some bit is set in both *this and x.
+    bool intersects(const AlignedBitVector<SIZE>& x) const
+    {
+        uint64_t common = 0;
+        for (unsigned int w = 0; w < NWORDS; ++w)
+            common |= data[w] & x.data[w];
+        return common != 0;
+    }
+
+    // Call f(i) for every unset bit i < limit, in increasing order.
+    template<class F> inline void for_each_unset(unsigned int limit, F f) const
+    {
+        ASSERT(limit <= SIZE);
+        const unsigned int nwords = (limit + 63) / 64;
+        for (unsigned int w = 0; w < nwords; ++w)
+        {
+            uint64_t alive = ~data[w];
+            if (w == nwords - 1 && limit % 64)
+                alive &= (uint64_t(1) << (limit % 64)) - 1;
+            while (alive)
+            {
+                f(w * 64 + lowest_bit_index(alive));
+                alive &= alive - 1;
+            }
+        }
+    }
+};
+
 template <unsigned int SIZE> class FixedBitVector
 {
 protected:
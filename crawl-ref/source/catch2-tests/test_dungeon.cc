@@ -0,0 +1,173 @@
+#include "catch_amalgamated.hpp"
+
+#include "AppHdr.h"
+
+#include "beam.h"
+#include "branch.h"
+#include "coordit.h"
+#include "database.h"
+#include "dlua.h"
+#include "dungeon.h"
+#include "env.h"
+#include "item-name.h"
+#include "item-prop.h"
+#include "maps.h"
+#include "mon-cast.h"
+#include "mon-util.h"
+#include "mutation.h"
+#include "player.h"
+#include "random.h"
+#include "spl-util.h"
+#include "state.h"
+#include "tags.h"
+#include "terrain.h"
+#include "unwind.h"
+
+static void _clear_level()
+{
+    env.grid.init(DNGN_ROCK_WALL);
+    env.mgrid.init(NON_MONSTER);
+    env.igrid.init(NON_ITEM);
+    env.level_map_mask.init(0);
+    env.trap.clear();
+    env.markers.clear();
+}
+
+static void _carve(int x1, int y1, int x2, int y2)
+{
+    for (int x = x1; x <= x2; ++x)
+        for (int y = y1; y <= y2; ++y)
+            env.grid[x][y] = DNGN_FLOOR;
+}
+
+TEST_CASE("disconnected zones are counted and filled", "[single-file]")
+{
+    const branch_type old_branch = you.where_are_you;
+    const int old_depth = you.depth;
+    you.where_are_you = BRANCH_DUNGEON;
+    you.depth = 2;
+    _clear_level();
+
+    // Two rooms that only touch at a corner are one zone.
+    _carve(5, 5, 15, 10);
+    _carve(16, 11, 20, 14);
+    env.grid[6][6] = DNGN_STONE_STAIRS_UP_I;
+    // A stairless room, and a stairless vault.
+    _carve(40, 40, 45, 44);
+    _carve(60, 5, 61, 6);
+    for (rectangle_iterator ri(coord_def(60, 5), coord_def(61, 6)); ri; ++ri)
+        env.level_map_mask(*ri) |= MMT_VAULT;
+    // A zone snaking back over itself, which a single scan of the rows
+    // first sees as several pieces.
+    _carve(30, 20, 30, 30);
+    _carve(34, 20, 34, 30);
+    _carve(30, 30, 34, 30);
+    _carve(32, 20, 32, 28);
+    _carve(32, 28, 34, 28);
+
+    REQUIRE(dgn_count_disconnected_zones(false) == 4);
+    REQUIRE(dgn_count_disconnected_zones(true) == 3);
+
+    // Vaults are left alone.
+    REQUIRE(dgn_count_disconnected_zones(true, DNGN_ROCK_WALL) == 3);
+    REQUIRE(env.grid[40][40] == DNGN_ROCK_WALL);
+    REQUIRE(env.grid[30][25] == DNGN_ROCK_WALL);
+    REQUIRE(env.grid[60][5] == DNGN_FLOOR);
+    REQUIRE(env.grid[20][14] == DNGN_FLOOR);
+    REQUIRE(dgn_count_disconnected_zones(false) == 2);
+    REQUIRE(dgn_count_disconnected_zones(true) == 1);
+
+    _clear_level();
+    you.where_are_you = old_branch;
+    you.depth = old_depth;
+}
+
+static void _init_builder()
+{
+    static bool done = false;
+    if (done)
+        return;
+    done = true;
+
+    init_spell_descs();
+    init_zap_index();
+    init_mut_index();
+    init_properties();
+    init_monsters();
+    init_mon_name_cache();
+    init_mons_spells();
+    init_item_name_cache();
+    init_dungeon_lua();
+    databaseSystemInit();
+    init_feat_desc_cache();
+    init_spell_name_cache();
+    read_maps();
+    run_map_global_preludes();
+}
+
+struct built_level
+{
+    bool built;
+    vector<unsigned char> level;
+    vector<int> uniques;
+    mid_t last_mid;
+    uint32_t level_state;
+};
+
+static built_level _build_level(uint64_t seed, int vetoes)
+{
+    rng::seed(seed);
+    you.unique_creatures.reset();
+    you.unique_items.init(UNIQ_NOT_EXISTS);
+    you.generated_misc.clear();
+    you.last_mid = 0;
+    get_uniq_map_tags().clear();
+    get_uniq_map_names().clear();
+
+    built_level result;
+    result.built = dgn_build_level_after_vetoes(vetoes);
+    if (!result.built)
+        return result;
+
+    // What the save would hold.
+    writer th(&result.level);
+    tag_write(TAG_LEVEL, th);
+    tag_write(TAG_LEVEL_TILES, th);
+    for (int i = 0; i < NUM_MONSTERS; ++i)
+        if (you.unique_creatures[i])
+            result.uniques.push_back(i);
+    result.last_mid = you.last_mid;
+    result.level_state = env.level_state;
+    return result;
+}
+
+TEST_CASE("a level retried after vetoes matches one built once",
+          "[single-file]")
+{
+    _init_builder();
+    unwind_var<branch_type> branch(you.where_are_you, BRANCH_DUNGEON);
+    unwind_var<int> depth(you.depth);
+    unwind_bool on_level(you.on_current_level, false);
+
+    int built = 0;
+    for (int level = 2; level <= 8; level += 3)
+        for (uint64_t seed = 1; seed <= 4; ++seed)
+        {
+            you.depth = level;
+            const built_level fresh = _build_level(seed, 0);
+            const built_level retried = _build_level(seed, 2);
+
+            INFO("D:" << level << " seed " << seed);
+            REQUIRE(retried.built == fresh.built);
+            if (!fresh.built)
+                continue;
+            ++built;
+            REQUIRE(retried.level == fresh.level);
+            REQUIRE(retried.uniques == fresh.uniques);
+            REQUIRE(retried.last_mid == fresh.last_mid);
+            REQUIRE(retried.level_state == fresh.level_state);
+        }
+    REQUIRE(built > 0);
+
+    dgn_reset_level();
+}
@@ -2,9 +2,23 @@
 
 #include "AppHdr.h"
 
+#include <cstdio>
+
+#include "coordit.h"
+#include "env.h"
 #include "files.h"
+#include "ghost.h"
+#include "options.h"
+#include "package.h"
+#include "player.h"
 #include "random.h"
+#include "state.h"
+#include "syscalls.h"
+#include "tag-version.h"
 #include "tags.h"
+#include "tile-env.h"
+#include "tileview.h"
+#include "unwind.h"
 
 TEST_CASE( "Test save version reading/writing works", "[single-file]" ) {
 
@@ -100,3 +114,234 @@ TEST_CASE( "Test save version reading/writing works", "[single-file]" ) {
         }
     }
 }
+
+static void _touch(const string &file)
+{
+    FILE *f = fopen_u(file.c_str(), "wb");
+    REQUIRE(f);
+    fclose(f);
+}
+
+TEST_CASE("A level's bones files are found", "[single-file]")
+{
+    unwind_var<string> shared_dir(Options.shared_dir, "test-bones.tmp");
+    unwind_var<branch_type> where(you.where_are_you, BRANCH_DUNGEON);
+    unwind_var<int> depth(you.depth, 5);
+
+    const string top = catpath(Options.shared_dir,
+                               crawl_state.game_savedir_path());
+    const string dir = catpath(top, "bones/");
+    REQUIRE(list_bones().empty());
+
+    // Files of other levels, and backups, aren't this level's.
+    const vector<string> others = { "bones.D-5_0.backup", "bones.D-50_0",
+                                    "bones.D-6_1", "bones.store.D-5" };
+    for (const string &file : others)
+        _touch(dir + file);
+    REQUIRE(list_bones().empty());
+
+    SECTION("numbered files")
+    {
+        _touch(dir + "bones.D-5_0");
+        _touch(dir + "bones.D-5_26");
+        _touch(dir + "bones.D-5_x");
+        vector<string> bones = list_bones();
+        sort(bones.begin(), bones.end());
+        REQUIRE(bones == vector<string>{ dir + "bones.D-5_0",
+                                         dir + "bones.D-5_26" });
+        unlink_u((dir + "bones.D-5_0").c_str());
+        unlink_u((dir + "bones.D-5_26").c_str());
+        unlink_u((dir + "bones.D-5_x").c_str());
+    }
+
+    SECTION("not other names, even when there are no numbered files")
+    {
+        _touch(dir + "bones.D-5_27");
+        _touch(dir + "bones.D-5_x");
+        REQUIRE(list_bones().empty());
+        unlink_u((dir + "bones.D-5_27").c_str());
+        unlink_u((dir + "bones.D-5_x").c_str());
+    }
+
+    for (const string &file : others)
+        unlink_u((dir + file).c_str());
+    remove(dir.c_str());
+    if (top != Options.shared_dir)
+        remove(top.c_str());
+    remove(Options.shared_dir.c_str());
+}
+
+static ghost_demon _test_ghost(const string &name)
+{
+    ghost_demon ghost;
+    ghost.name = name;
+    ghost.species = SP_HUMAN;
+    ghost.job = JOB_FIGHTER;
+    ghost.xl = 5;
+    ghost.max_hp = 20;
+    return ghost;
+}
+
+static vector<string> _ghost_names(const vector<ghost_demon> &ghosts)
+{
+    vector<string> names;
+    for (const ghost_demon &ghost : ghosts)
+        names.push_back(ghost.name);
+    sort(names.begin(), names.end());
+    return names;
+}
+
+TEST_CASE("A level's permastore keeps its ghosts", "[single-file]")
+{
+    unwind_var<string> shared_dir(Options.shared_dir, "test-bones.tmp");
+    unwind_var<branch_type> where(you.where_are_you, BRANCH_DUNGEON);
+    // No permastore is distributed for D:2.
+    unwind_var<int> depth(you.depth, 2);
+
+    const string top = catpath(Options.shared_dir,
+                               crawl_state.game_savedir_path());
+    const string dir = catpath(top, "bones/");
+    const string store = dir + "bones.store.D-2";
+    REQUIRE(list_bones().empty());
+
+    SECTION("up to its size, with the rest in bones files")
+    {
+        vector<ghost_demon> ghosts;
+        for (char c = 'a'; c <= 'l'; c++)
+            ghosts.push_back(_test_ghost(string("Ghost") + c));
+        REQUIRE(load_permastore_ghost().empty());
+        save_ghosts(ghosts, true);
+
+        const vector<string> stored = _ghost_names(
+            vector<ghost_demon>(ghosts.begin(), ghosts.begin() + 10));
+        for (int i = 0; i < 10; i++)
+        {
+            const vector<ghost_demon> loaded = load_permastore_ghost();
+            REQUIRE(loaded.size() == 1);
+            REQUIRE(count(stored.begin(), stored.end(), loaded[0].name));
+        }
+
+        const vector<string> bones = list_bones();
+        REQUIRE(bones.size() == 1);
+        REQUIRE(_ghost_names(load_bones_file(bones[0]))
+                == vector<string>{ "Ghostk", "Ghostl" });
+        unlink_u(bones[0].c_str());
+    }
+
+    SECTION("imported once from a store of an older version")
+    {
+        FILE *f = fopen_u(store.c_str(), "wb");
+        REQUIRE(f);
+        {
+            writer outw(store, f);
+            write_ghost_version(outw);
+            tag_write_ghosts(outw, { _test_ghost("Olda"),
+                                     _test_ghost("Oldb") });
+        }
+        fclose(f);
+
+        const vector<ghost_demon> loaded = load_permastore_ghost();
+        REQUIRE(loaded.size() == 1);
+        REQUIRE((loaded[0].name == "Olda" || loaded[0].name == "Oldb"));
+        REQUIRE(!file_exists(store));
+    }
+
+    unlink_u((store + ".idx").c_str());
+    unlink_u((store + ".rec").c_str());
+    remove(dir.c_str());
+    if (top != Options.shared_dir)
+        remove(top.c_str());
+    remove(Options.shared_dir.c_str());
+}
+
+// A level with the flavour the builder would give it.
+static void _make_level(int depth)
+{
+    you.depth = depth;
+    env.grid.init(DNGN_ROCK_WALL);
+    for (rectangle_iterator ri(1); ri; ++ri)
+    {
+        if ((ri->x + ri->y * depth) % 5)
+            env.grid(*ri) = DNGN_FLOOR;
+    }
+    tile_env.names.clear();
+    tile_clear_flavour();
+    tile_init_default_flavour();
+    tile_init_flavour();
+}
+
+static vector<unsigned char> _tag_bytes(tag_type tag)
+{
+    vector<unsigned char> buf;
+    writer outf(&buf);
+    tag_write(tag, outf);
+    return buf;
+}
+
+TEST_CASE("Levels are read back with their own tiles", "[single-file]")
+{
+    unwind_var<branch_type> where(you.where_are_you, BRANCH_DUNGEON);
+    unwind_var<int> depth(you.depth);
+    unwind_var<int> cache_size(Options.level_cache_size, 0);
+    package save("test-levels.tmp", true, true);
+    unwind_var<package*> you_save(you.save, &save);
+    forget_cached_levels();
+
+    const string d2 = level_id(BRANCH_DUNGEON, 2).describe();
+    const string d3 = level_id(BRANCH_DUNGEON, 3).describe();
+    _make_level(2);
+    const vector<unsigned char> level2 = _tag_bytes(TAG_LEVEL);
+    const vector<unsigned char> tiles2 = _tag_bytes(TAG_LEVEL_TILES);
+    save_level(level_id(BRANCH_DUNGEON, 2));
+    _make_level(3);
+    const vector<unsigned char> tiles3 = _tag_bytes(TAG_LEVEL_TILES);
+    save_level(level_id(BRANCH_DUNGEON, 3));
+    REQUIRE(tiles3 != tiles2);
+
+    SECTION("from their tiles chunks")
+    {
+        you.depth = 2;
+        restore_level(d2);
+        REQUIRE(_tag_bytes(TAG_LEVEL) == level2);
+        REQUIRE(_tag_bytes(TAG_LEVEL_TILES) == tiles2);
+        you.depth = 3;
+        restore_level(d3);
+        REQUIRE(_tag_bytes(TAG_LEVEL_TILES) == tiles3);
+    }
+
+    SECTION("without a tiles chunk")
+    {
+        // Not the last level's flavour, but the level's own, made afresh.
+        save.delete_chunk(d2 + ".tiles");
+        you.depth = 2;
+        restore_level(d2);
+        REQUIRE(_tag_bytes(TAG_LEVEL) == level2);
+        REQUIRE(_tag_bytes(TAG_LEVEL_TILES) == tiles2);
+    }
+
+#if TAG_MAJOR_VERSION == 34
+    SECTION("from before levels had a tiles chunk")
+    {
+        // The tiles were at the end of the level tag, after its length.
+        const size_t len = sizeof(int32_t);
+        {
+            writer outf(&save, d2);
+            write_save_version(outf,
+                save_version(TAG_MAJOR_VERSION,
+                             TAG_MINOR_LEVEL_TILES_CHUNK - 1));
+            marshallInt(outf, level2.size() + tiles2.size() - 2 * len);
+            outf.write(level2.data() + len, level2.size() - len);
+            outf.write(tiles2.data() + len, tiles2.size() - len);
+        }
+        save.delete_chunk(d2 + ".tiles");
+        you.depth = 2;
+        restore_level(d2);
+        REQUIRE(_tag_bytes(TAG_LEVEL) == level2);
+        REQUIRE(_tag_bytes(TAG_LEVEL_TILES) == tiles2);
+    }
+#endif
+
+    forget_cached_levels();
+    save.abort();
+    save.unlink();
+}
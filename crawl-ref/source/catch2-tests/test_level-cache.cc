@@ -0,0 +1,120 @@
+#include "catch_amalgamated.hpp"
+
+#include "AppHdr.h"
+
+#include "coordit.h"
+#include "env.h"
+#include "files.h"
+#include "level-cache.h"
+#include "options.h"
+#include "package.h"
+#include "player.h"
+#include "tags.h"
+#include "tile-env.h"
+#include "tileview.h"
+#include "unwind.h"
+
+static vector<unsigned char> _level(size_t size, unsigned char fill)
+{
+    return vector<unsigned char>(size, fill);
+}
+
+TEST_CASE("level_cache keeps the most recently used levels", "[single-file]")
+{
+    level_cache cache;
+    REQUIRE(!cache.find("D:1"));
+
+    cache.insert("D:1", _level(100, 1), 300);
+    cache.insert("D:2", _level(100, 2), 300);
+    cache.insert("D:3", _level(100, 3), 300);
+    REQUIRE(cache.size() == 300);
+
+    // Using D:1 makes D:2 the oldest.
+    REQUIRE(cache.find("D:1"));
+    cache.insert("D:4", _level(100, 4), 300);
+    REQUIRE(!cache.find("D:2"));
+    REQUIRE(cache.find("D:1"));
+    REQUIRE(cache.find("D:3"));
+    REQUIRE(*cache.find("D:4") == _level(100, 4));
+    REQUIRE(cache.size() == 300);
+
+    // Saving a level again replaces it.
+    cache.insert("D:3", _level(50, 5), 300);
+    REQUIRE(*cache.find("D:3") == _level(50, 5));
+    REQUIRE(cache.size() == 250);
+
+    cache.erase("D:3");
+    REQUIRE(!cache.find("D:3"));
+    REQUIRE(cache.size() == 200);
+
+    // A level bigger than the whole cache isn't kept.
+    cache.insert("Zig:27", _level(400, 6), 300);
+    REQUIRE(!cache.find("Zig:27"));
+
+    cache.clear();
+    REQUIRE(!cache.find("D:1"));
+    REQUIRE(cache.size() == 0);
+}
+
+static void _make_level(int depth)
+{
+    you.depth = depth;
+    env.grid.init(DNGN_ROCK_WALL);
+    for (rectangle_iterator ri(1); ri; ++ri)
+    {
+        if ((ri->x * depth + ri->y) % 7)
+            env.grid(*ri) = DNGN_FLOOR;
+    }
+    tile_env.names.clear();
+    tile_clear_flavour();
+    tile_init_default_flavour();
+    tile_init_flavour();
+}
+
+static vector<unsigned char> _tag_bytes(tag_type tag)
+{
+    vector<unsigned char> buf;
+    writer outf(&buf);
+    tag_write(tag, outf);
+    return buf;
+}
+
+TEST_CASE("cached levels read back as levels from the save do",
+          "[single-file]")
+{
+    unwind_var<branch_type> where(you.where_are_you, BRANCH_DUNGEON);
+    unwind_var<int> depth(you.depth);
+    unwind_var<int> cache_size(Options.level_cache_size, 1024);
+    package save("test-level-cache.tmp", true, true);
+    unwind_var<package*> you_save(you.save, &save);
+    forget_cached_levels();
+
+    const level_id lid(BRANCH_DUNGEON, 2);
+    const string name = lid.describe();
+    _make_level(2);
+    const vector<unsigned char> level = _tag_bytes(TAG_LEVEL);
+    const vector<unsigned char> tiles = _tag_bytes(TAG_LEVEL_TILES);
+    save_level(lid);
+
+    // From the save.
+    forget_cached_levels();
+    _make_level(3);
+    you.depth = 2;
+    restore_level(name);
+    REQUIRE(_tag_bytes(TAG_LEVEL) == level);
+    REQUIRE(_tag_bytes(TAG_LEVEL_TILES) == tiles);
+
+    // From the cache alone.
+    save_level(lid);
+    save.delete_chunk(name);
+    save.delete_chunk(name + ".tiles");
+    _make_level(3);
+    you.depth = 2;
+    restore_level(name);
+    REQUIRE(_tag_bytes(TAG_LEVEL) == level);
+    REQUIRE(_tag_bytes(TAG_LEVEL_TILES) == tiles);
+
+    forget_cached_levels();
+    save.abort();
+    save.unlink();
+}
@@ -0,0 +1,396 @@
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "catch_amalgamated.hpp"
+
+#include "AppHdr.h"
+
+#include "bitary.h"
+#include "coord.h"
+#include "coordit.h"
+#include "los.h"
+#include "losparam.h"
+#include "stringutil.h"
+
+// Opacity read from a fixed-size test map, independent of env.
+class opacity_test_map : public opacity_func
+{
+public:
+    CLONE(opacity_test_map)
+
+    opacity_type operator()(const coord_def& p) const override
+    {
+        return cells[p.x][p.y];
+    }
+
+    opacity_type cells[GXM][GYM];
+};
+
+// Builds a test map by tiling a small ASCII pattern over the whole level:
+// '#' is opaque, '~' half-opaque (smoke), anything else is clear.
+static void _fill_map(opacity_test_map &opc, const vector<string> &pattern)
+{
+    for (int x = 0; x < GXM; ++x)
+        for (int y = 0; y < GYM; ++y)
+        {
+            const string &row = pattern[y % pattern.size()];
+            const char c = row[x % row.size()];
+            opc.cells[x][y] = c == '#' ? OPC_OPAQUE
+                            : c == '~' ? OPC_HALF
+                                       : OPC_CLEAR;
+        }
+}
+
+static void _fill_random(opacity_test_map &opc, int seed, int wall_pct,
+                         int smoke_pct)
+{
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<int> pct(0, 99);
+    for (int x = 0; x < GXM; ++x)
+        for (int y = 0; y < GYM; ++y)
+        {
+            const int r = pct(gen);
+            opc.cells[x][y] = r < wall_pct ? OPC_OPAQUE
+                            : r < wall_pct + smoke_pct ? OPC_HALF
+                                                       : OPC_CLEAR;
+        }
+}
+
+// Whole-level maps from the game's vaults, read from the source tree, where
+// the tests are run.
+static const vector<pair<string, string>> saved_maps = {
+    { "dat/des/variable/d_encompass.des", "kennysheep_town" },
+    { "dat/des/branches/orc.des", "pubby_orc_utopia" },
+    { "dat/des/branches/crypt.des", "evilmike_haunted_forest" },
+    { "dat/des/variable/the_grid.des", "minmay_the_grid_ultimate" },
+};
+
+// Builds a test map from a vault's MAP block: walls, trees and closed doors
+// are opaque, as is anything outside the vault; anything else is clear.
+static void _fill_saved_map(opacity_test_map &opc, const string &file,
+                            const string &name)
+{
+    ifstream des(file);
+    REQUIRE(des);
+    vector<string> rows;
+    bool named = false, in_map = false;
+    string line;
+    while (getline(des, line))
+    {
+        line = trimmed_string(line);
+        if (in_map && line == "ENDMAP")
+            break;
+        else if (in_map)
+            rows.push_back(line);
+        else if (starts_with(line, "NAME:"))
+            named = trimmed_string(line.substr(5)) == name;
+        else if (named && line == "MAP")
+            in_map = true;
+    }
+    INFO(file << ": " << name);
+    REQUIRE(!rows.empty());
+
+    for (int x = 0; x < GXM; ++x)
+        for (int y = 0; y < GYM; ++y)
+        {
+            const char c = y < (int)rows.size() && x < (int)rows[y].size()
+                           ? rows[y][x] : ' ';
+            opc.cells[x][y] = strchr(" xcvbXt+=", c) ? OPC_OPAQUE
+                                                     : OPC_CLEAR;
+        }
+}
+
+static const vector<vector<string>> test_maps = {
+    { "." },
+    { "......",
+      ".#..#.",
+      "......" },
+    { "#.######",
+      "#.....~#",
+      "###.####",
+      "#..~...#" },
+    { "..~~..",
+      ".~~~~.",
+      "..~~.." },
+};
+
+// Centres away from the map edge, so that every cell in range is in bounds.
+static vector<coord_def> _test_centres()
+{
+    vector<coord_def> centres;
+    for (int x = 10; x < GXM - 10; x += 7)
+        for (int y = 10; y < GYM - 10; y += 5)
+            centres.emplace_back(x, y);
+    return centres;
+}
+
+static const circle_def test_bounds(LOS_RADIUS, C_SQUARE);
+
+// Visibility by checking for an unblocked ray to each cell, as
+// cell_see_cell_nocache() does.
+static void _losight_by_rays(los_grid &sh, const coord_def &c,
+                             const opacity_func &opc)
+{
+    sh.init(false);
+    for (int x = -LOS_RADIUS; x <= LOS_RADIUS; ++x)
+        for (int y = -LOS_RADIUS; y <= LOS_RADIUS; ++y)
+        {
+            const coord_def p(x, y);
+            sh(p) = p.origin() || exists_ray(c, c + p, opc, LOS_RADIUS);
+        }
+}
+
+// losight() as it was before the ray sets were word-parallel: a heap
+// bit_vector of blocked rays per cell, a virtual opacity call for every
+// cell of each quadrant, and a test of every ray's end.
+class losight_baseline
+{
+public:
+    losight_baseline() : num_rays(los_cellray_count()),
+                         dead_rays(num_rays), smoke_rays(num_rays)
+    {
+        for (int x = 0; x <= LOS_MAX_RANGE; ++x)
+            for (int y = 0; y <= LOS_MAX_RANGE; ++y)
+            {
+                blockrays[x][y] = new bit_vector(num_rays);
+                for (unsigned int i = 0; i < num_rays; ++i)
+                    if (los_cell_blocks_ray(coord_def(x, y), i))
+                        blockrays[x][y]->set(i);
+            }
+        for (unsigned int i = 0; i < num_rays; ++i)
+            ends.push_back(los_cellray_end(i));
+    }
+
+    ~losight_baseline()
+    {
+        for (int x = 0; x <= LOS_MAX_RANGE; ++x)
+            for (int y = 0; y <= LOS_MAX_RANGE; ++y)
+                delete blockrays[x][y];
+    }
+
+    void operator()(los_grid &sh, const coord_def &c,
+                    const opacity_func &opc, const circle_def &bounds)
+    {
+        sh.init(false);
+        const int quadrant_x[4] = {  1, -1, -1,  1 };
+        const int quadrant_y[4] = {  1,  1, -1, -1 };
+        for (int q = 0; q < 4; ++q)
+            _quadrant(sh, c, opc, bounds, quadrant_x[q], quadrant_y[q]);
+        sh(coord_def(0, 0)) = true;
+    }
+
+private:
+    void _quadrant(los_grid &sh, const coord_def &c, const opacity_func &opc,
+                   const circle_def &bounds, int sx, int sy)
+    {
+        dead_rays.reset();
+        smoke_rays.reset();
+        for (rectangle_iterator qi(coord_def(0, 0),
+                                   coord_def(LOS_MAX_RANGE, LOS_MAX_RANGE));
+             qi; ++qi)
+        {
+            const coord_def p(sx * qi->x, sy * qi->y);
+            if (!map_bounds(p + c) || !bounds.contains(p))
+                continue;
+            switch (opc(p + c))
+            {
+            case OPC_OPAQUE:
+                dead_rays |= *blockrays[qi->x][qi->y];
+                break;
+            case OPC_HALF:
+                dead_rays |= (smoke_rays & *blockrays[qi->x][qi->y]);
+                smoke_rays |= *blockrays[qi->x][qi->y];
+                break;
+            default:
+                break;
+            }
+        }
+
+        for (unsigned int i = 0; i < num_rays; ++i)
+        {
+            if (dead_rays.get(i))
+                continue;
+            const coord_def p(sx * ends[i].x, sy * ends[i].y);
+            if (map_bounds(p + c) && bounds.contains(p))
+                sh(p) = true;
+        }
+    }
+
+    const unsigned int num_rays;
+    bit_vector *blockrays[LOS_MAX_RANGE + 1][LOS_MAX_RANGE + 1];
+    vector<coord_def> ends;
+    bit_vector dead_rays;
+    bit_vector smoke_rays;
+};
+
+static void _check_against_rays(const opacity_test_map &opc)
+{
+    for (const coord_def &c : _test_centres())
+    {
+        los_grid fast, slow;
+        losight(fast, c, opc, test_bounds);
+        _losight_by_rays(slow, c, opc);
+        for (int x = -LOS_RADIUS; x <= LOS_RADIUS; ++x)
+            for (int y = -LOS_RADIUS; y <= LOS_RADIUS; ++y)
+            {
+                const coord_def p(x, y);
+                CAPTURE(c.x, c.y, x, y);
+                REQUIRE(fast(p) == slow(p));
+            }
+    }
+}
+
+TEST_CASE("losight agrees with find_ray", "[single-file]")
+{
+    opacity_test_map *opc = new opacity_test_map;
+
+    SECTION("On patterned maps")
+    {
+        for (const auto &pattern : test_maps)
+        {
+            _fill_map(*opc, pattern);
+            _check_against_rays(*opc);
+        }
+    }
+
+    SECTION("On saved maps")
+    {
+        for (const auto &map : saved_maps)
+        {
+            _fill_saved_map(*opc, map.first, map.second);
+            _check_against_rays(*opc);
+        }
+    }
+
+    SECTION("On random maps")
+    {
+        const int seed = GENERATE(1, 2, 3);
+        const int walls = GENERATE(0, 10, 30);
+        const int smoke = GENERATE(0, 15);
+        _fill_random(*opc, seed, walls, smoke);
+        _check_against_rays(*opc);
+    }
+
+    delete opc;
+}
+
+TEST_CASE("los_blocked_targets covers every cell a blocker can hide",
+          "[single-file]")
+{
+    opacity_test_map *opc = new opacity_test_map;
+    const coord_def c(40, 35);
+
+    const int seed = GENERATE(1, 2, 3, 4);
+    const int walls = GENERATE(0, 15);
+    const int smoke = GENERATE(0, 15);
+    _fill_random(*opc, seed, walls, smoke);
+
+    for (int x = -LOS_RADIUS; x <= LOS_RADIUS; ++x)
+        for (int y = -LOS_RADIUS; y <= LOS_RADIUS; ++y)
+        {
+            const coord_def p(x, y);
+            if (p.origin())
+                continue;
+
+            los_grid before, after;
+            const opacity_type old_opc = opc->cells[c.x + x][c.y + y];
+            opc->cells[c.x + x][c.y + y] = OPC_CLEAR;
+            losight(before, c, *opc, test_bounds);
+            opc->cells[c.x + x][c.y + y] = OPC_OPAQUE;
+            losight(after, c, *opc, test_bounds);
+            opc->cells[c.x + x][c.y + y] = old_opc;
+
+            const int sx = x < 0 ? -1 : 1;
+            const int sy = y < 0 ? -1 : 1;
+            const vector<coord_def> &targets
+                = los_blocked_targets(coord_def(abs(x), abs(y)));
+            for (int tx = -LOS_RADIUS; tx <= LOS_RADIUS; ++tx)
+                for (int ty = -LOS_RADIUS; ty <= LOS_RADIUS; ++ty)
+                {
+                    const coord_def t(tx, ty);
+                    if (before(t) == after(t))
+                        continue;
+                    // Only cells in p's quadrant(s) can change, and
+                    // those must be listed.
+                    CAPTURE(x, y, tx, ty);
+                    const coord_def abs_t(abs(tx), abs(ty));
+                    REQUIRE((tx * sx >= 0 || x == 0));
+                    REQUIRE((ty * sy >= 0 || y == 0));
+                    REQUIRE(find(targets.begin(), targets.end(), abs_t)
+                            != targets.end());
+                }
+        }
+
+    delete opc;
+}
+
+TEST_CASE("losight matches the baseline ray scan", "[single-file]")
+{
+    opacity_test_map *opc = new opacity_test_map;
+    _fill_random(*opc, GENERATE(1, 2), 15, 10);
+    losight_baseline baseline;
+
+    vector<coord_def> centres = _test_centres();
+    centres.emplace_back(0, 0);
+    centres.emplace_back(GXM - 1, GYM - 1);
+    for (const coord_def &c : centres)
+    {
+        los_grid fast, slow;
+        losight(fast, c, *opc, test_bounds);
+        baseline(slow, c, *opc, test_bounds);
+        for (int x = -LOS_RADIUS; x <= LOS_RADIUS; ++x)
+            for (int y = -LOS_RADIUS; y <= LOS_RADIUS; ++y)
+            {
+                const coord_def p(x, y);
+                CAPTURE(c.x, c.y, x, y);
+                REQUIRE(fast(p) == slow(p));
+            }
+    }
+
+    delete opc;
+}
+
+// Not run by default; use `catch2-tests-executable "[los-benchmark]"`.
+// Times each way of finding LOS from the open cells among the test centres
+// of every saved map.
+TEST_CASE("losight benchmark", "[.][los-benchmark]")
+{
+    vector<opacity_test_map> maps(saved_maps.size());
+    vector<vector<coord_def>> centres(saved_maps.size());
+    for (unsigned int i = 0; i < saved_maps.size(); ++i)
+    {
+        _fill_saved_map(maps[i], saved_maps[i].first, saved_maps[i].second);
+        for (const coord_def &c : _test_centres())
+            if (maps[i].cells[c.x][c.y] == OPC_CLEAR)
+                centres[i].push_back(c);
+    }
+    los_grid sh;
+
+    losight_baseline baseline;
+    BENCHMARK("baseline losight (bit_vector ray scan)")
+    {
+        for (unsigned int i = 0; i < maps.size(); ++i)
+            for (const coord_def &c : centres[i])
+                baseline(sh, c, maps[i], test_bounds);
+        return sh(coord_def(1, 1));
+    };
+
+    BENCHMARK("losight")
+    {
+        for (unsigned int i = 0; i < maps.size(); ++i)
+            for (const coord_def &c : centres[i])
+                losight(sh, c, maps[i], test_bounds);
+        return sh(coord_def(1, 1));
+    };
+
+    BENCHMARK("exists_ray per cell")
+    {
+        for (unsigned int i = 0; i < maps.size(); ++i)
+            for (const coord_def &c : centres[i])
+                _losight_by_rays(sh, c, maps[i]);
+        return sh(coord_def(1, 1));
+    };
+}
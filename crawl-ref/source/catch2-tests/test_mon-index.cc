@@ -0,0 +1,75 @@
+#include "catch_amalgamated.hpp"
+
+#include "AppHdr.h"
+
+#include "env.h"
+#include "mon-index.h"
+
+TEST_CASE("monster_bitset iterates in index order", "[single-file]")
+{
+    monster_bitset set;
+    REQUIRE(set.next(-1) == MAX_MONSTERS);
+
+    set.insert(MAX_MONSTERS - 1);
+    set.insert(130);
+    set.insert(0);
+    set.insert(63);
+    set.insert(64);
+
+    REQUIRE(set.next(-1) == 0);
+    REQUIRE(set.next(0) == 63);
+    REQUIRE(set.next(63) == 64);
+    REQUIRE(set.next(64) == 130);
+    REQUIRE(set.next(130) == MAX_MONSTERS - 1);
+    REQUIRE(set.next(MAX_MONSTERS - 1) == MAX_MONSTERS);
+
+    set.erase(63);
+    REQUIRE(!set.contains(63));
+    REQUIRE(set.next(0) == 64);
+
+    monster_bitset all;
+    all.fill();
+    REQUIRE(all.next(MAX_MONSTERS - 2) == MAX_MONSTERS - 1);
+    REQUIRE(all.next(MAX_MONSTERS - 1) == MAX_MONSTERS);
+}
+
+TEST_CASE("monster_index files monsters by position", "[single-file]")
+{
+    monster_index index;
+    monster &mons = env.mons[5];
+    const coord_def old_pos = mons.position;
+    monster_bitset near;
+
+    mons.position = coord_def(20, 20);
+    index.add(mons);
+    REQUIRE(index.next(-1) == 5);
+    REQUIRE(index.indexed(mons));
+
+    index.near(coord_def(27, 13), LOS_RADIUS, near);
+    REQUIRE(near.contains(5));
+    index.near(coord_def(60, 60), LOS_RADIUS, near);
+    REQUIRE(!near.contains(5));
+
+    mons.position = coord_def(60, 55);
+    REQUIRE(!index.indexed(mons));
+    index.moved(mons);
+    REQUIRE(index.indexed(mons));
+    index.near(coord_def(60, 60), LOS_RADIUS, near);
+    REQUIRE(near.contains(5));
+    index.near(coord_def(20, 20), LOS_RADIUS, near);
+    REQUIRE(!near.contains(5));
+
+    // Monsters outside env.mons aren't indexed.
+    monster copy;
+    copy.position = coord_def(20, 20);
+    index.add(copy);
+    index.near(coord_def(20, 20), LOS_RADIUS, near);
+    REQUIRE(near.next(-1) == MAX_MONSTERS);
+
+    index.remove(mons);
+    REQUIRE(index.next(-1) == MAX_MONSTERS);
+    index.near(coord_def(60, 60), LOS_RADIUS, near);
+    REQUIRE(!near.contains(5));
+
+    mons.position = old_pos;
+}
@@ -0,0 +1,300 @@
+#include <queue>
+#include <random>
+
+#include "catch_amalgamated.hpp"
+
+#include "AppHdr.h"
+
+#include "coordit.h"
+#include "env.h"
+#include "mon-pathfind.h"
+#include "mon-util.h"
+#include "monster.h"
+#include "terrain.h"
+
+// Fill the level with a maze carved out of the given wall feature, with
+// a few extra openings so that there are many paths of similar length.
+static void _build_maze(dungeon_feature_type wall, int seed)
+{
+    std::mt19937 gen(seed);
+    env.grid.init(DNGN_PERMAROCK_WALL);
+    env.mgrid.init(NON_MONSTER);
+    for (int x = 2; x < GXM - 2; ++x)
+        for (int y = 2; y < GYM - 2; ++y)
+            env.grid[x][y] = wall;
+
+    // Depth-first carving between cells at odd coordinates.
+    vector<coord_def> stack;
+    stack.emplace_back(3, 3);
+    env.grid(stack.back()) = DNGN_FLOOR;
+    while (!stack.empty())
+    {
+        const coord_def c = stack.back();
+        vector<coord_def> next;
+        for (const coord_def d : { coord_def(2, 0), coord_def(-2, 0),
+                                   coord_def(0, 2), coord_def(0, -2) })
+        {
+            const coord_def n = c + d;
+            if (n.x > 2 && n.y > 2 && n.x < GXM - 3 && n.y < GYM - 3
+                && env.grid(n) == wall)
+            {
+                next.push_back(n);
+            }
+        }
+        if (next.empty())
+        {
+            stack.pop_back();
+            continue;
+        }
+        const coord_def n = next[gen() % next.size()];
+        env.grid((c + n) / 2) = DNGN_FLOOR;
+        env.grid(n) = DNGN_FLOOR;
+        stack.push_back(n);
+    }
+
+    for (int i = 0; i < 150; ++i)
+    {
+        const coord_def c(3 + gen() % (GXM - 6), 3 + gen() % (GYM - 6));
+        env.grid(c) = DNGN_FLOOR;
+    }
+}
+
+// Fewest steps from src to every cell, by breadth-first search.
+static void _bfs(const coord_def &src, FixedArray<int, GXM, GYM> &steps)
+{
+    steps.init(-1);
+    steps(src) = 0;
+    std::queue<coord_def> todo;
+    todo.push(src);
+    while (!todo.empty())
+    {
+        const coord_def c = todo.front();
+        todo.pop();
+        for (adjacent_iterator ai(c); ai; ++ai)
+        {
+            if (!in_bounds(*ai) || steps(*ai) >= 0
+                || env.grid(*ai) != DNGN_FLOOR)
+            {
+                continue;
+            }
+            steps(*ai) = steps(c) + 1;
+            todo.push(*ai);
+        }
+    }
+}
+
+static vector<coord_def> _floor_cells()
+{
+    vector<coord_def> cells;
+    for (rectangle_iterator ri(1); ri; ++ri)
+        if (env.grid(*ri) == DNGN_FLOOR)
+            cells.push_back(*ri);
+    return cells;
+}
+
+TEST_CASE("monster_pathfind finds shortest paths", "[single-file]")
+{
+    _build_maze(DNGN_ROCK_WALL, GENERATE(1, 2));
+    const vector<coord_def> cells = _floor_cells();
+    const coord_def src = cells[0];
+    FixedArray<int, GXM, GYM> steps;
+    _bfs(src, steps);
+
+    // One pathfinder reused for many searches, and another alive at the
+    // same time, must not see each other's results.
+    monster_pathfind mp;
+    for (unsigned int i = 1; i < cells.size(); i += 37)
+    {
+        const coord_def dest = cells[i];
+        CAPTURE(dest.x, dest.y);
+        REQUIRE(mp.init_pathfind(src, dest));
+        REQUIRE((int)mp.backtrack().size() - 1 == steps(dest));
+
+        monster_pathfind other;
+        REQUIRE(other.init_pathfind(dest, src));
+        REQUIRE((int)other.backtrack().size() - 1 == steps(dest));
+    }
+
+    // An unreachable target.
+    const coord_def walled = cells.back();
+    for (adjacent_iterator ai(walled); ai; ++ai)
+        env.grid(*ai) = DNGN_ROCK_WALL;
+    REQUIRE(!mp.init_pathfind(src, walled));
+
+    env.grid.init(DNGN_UNSEEN);
+}
+
+// The cost for a hostile monster to walk the given path, as
+// monster_pathfind counts it on a level without traps. Fails if the path
+// takes a step that isn't to an adjacent cell.
+static int _path_cost(const monster &mons, const vector<coord_def> &path)
+{
+    int cost = 0;
+    for (unsigned int i = 1; i < path.size(); ++i)
+    {
+        REQUIRE(grid_distance(path[i - 1], path[i]) == 1);
+        if (feat_is_closed_door(env.grid(path[i]))
+            || mons.floundering_at(path[i]))
+        {
+            cost += 2;
+        }
+        else
+            cost += 1;
+    }
+    return cost;
+}
+
+TEST_CASE("shared travel paths agree with monster_pathfind", "[single-file]")
+{
+    init_monsters();
+    _build_maze(DNGN_ROCK_WALL, 3);
+    vector<coord_def> cells = _floor_cells();
+
+    // Water to flounder through or go around, and doors to open.
+    std::mt19937 gen(3);
+    for (unsigned int i = 1; i < cells.size(); i += 7)
+    {
+        const dungeon_feature_type feats[] =
+            { DNGN_SHALLOW_WATER, DNGN_DEEP_WATER, DNGN_CLOSED_DOOR };
+        env.grid(cells[i]) = feats[gen() % 3];
+    }
+    clear_travel_fields();
+
+    monster &mons = env.mons[0];
+    mons.reset();
+    mons.type = MONS_GOBLIN;
+    mons.attitude = ATT_HOSTILE;
+    mons.position = cells[0];
+    const int range = 16;
+
+    int found = 0;
+    for (rectangle_iterator ri(1); ri; ++ri)
+    {
+        const coord_def dest = *ri;
+        if (dest == mons.pos() || env.grid(dest) != DNGN_FLOOR
+            || grid_distance(dest, mons.pos()) > range)
+        {
+            continue;
+        }
+        CAPTURE(dest.x, dest.y);
+
+        monster_pathfind mp;
+        mp.set_range(range);
+        const bool astar = mp.init_pathfind(&mons, dest);
+
+        vector<coord_def> waypoints;
+        const maybe_bool shared = shared_travel_path(mons, dest, range,
+                                                     waypoints);
+        REQUIRE(shared.is_bool());
+        REQUIRE(bool(shared) == astar);
+        if (astar)
+        {
+            REQUIRE(!waypoints.empty());
+            REQUIRE(waypoints.back() == dest);
+
+            // The paths may differ, but not in what they cost.
+            vector<coord_def> steps;
+            REQUIRE(shared_travel_steps(mons, dest, range, steps) == true);
+            REQUIRE(steps.front() == mons.pos());
+            REQUIRE(steps.back() == dest);
+            REQUIRE(_path_cost(mons, steps)
+                    == _path_cost(mons, mp.backtrack()));
+            ++found;
+        }
+    }
+    REQUIRE(found > 0);
+
+    // Allies search on their own.
+    mons.attitude = ATT_FRIENDLY;
+    vector<coord_def> waypoints;
+    REQUIRE(shared_travel_path(mons, cells[1], range, waypoints)
+            == maybe_bool::maybe);
+
+    mons.reset();
+    clear_travel_fields();
+    env.grid.init(DNGN_UNSEEN);
+}
+
+// Not run by default; use `catch2-tests-executable "[pathfind-benchmark]"`.
+TEST_CASE("monster_pathfind benchmark", "[.][pathfind-benchmark]")
+{
+    // Rock mazes, and tree mazes standing in for plant-walled levels.
+    const dungeon_feature_type wall = GENERATE(DNGN_ROCK_WALL, DNGN_TREE);
+    _build_maze(wall, 1);
+    const vector<coord_def> cells = _floor_cells();
+
+    BENCHMARK(string("pathfind across a maze of ")
+              + (wall == DNGN_TREE ? "trees" : "rock"))
+    {
+        int total = 0;
+        for (unsigned int i = 0; i + 1 < cells.size(); i += 97)
+        {
+            monster_pathfind mp;
+            if (mp.init_pathfind(cells[i], cells[cells.size() - 1 - i]))
+                total += mp.backtrack().size();
+        }
+        return total;
+    };
+
+    BENCHMARK(string("short range pathfinds in a maze of ")
+              + (wall == DNGN_TREE ? "trees" : "rock"))
+    {
+        int total = 0;
+        for (unsigned int i = 0; i + 1 < cells.size(); i += 13)
+        {
+            monster_pathfind mp;
+            mp.set_range(LOS_DEFAULT_RANGE);
+            if (mp.init_pathfind(cells[i], cells[(i * 7) % cells.size()]))
+                total += mp.backtrack().size();
+        }
+        return total;
+    };
+
+    // A crowd of goblins hunting one foe, each searching on its own and
+    // then sharing distances.
+    init_monsters();
+    monster &mons = env.mons[0];
+    mons.reset();
+    mons.type = MONS_GOBLIN;
+    mons.attitude = ATT_HOSTILE;
+    const coord_def foe = cells[cells.size() / 2];
+    const int range = LOS_DEFAULT_RANGE * 2;
+    vector<coord_def> hunters;
+    for (const coord_def &c : cells)
+        if (c != foe && grid_distance(c, foe) <= range && hunters.size() < 30)
+            hunters.push_back(c);
+
+    BENCHMARK(string("30 goblins searching in a maze of ")
+              + (wall == DNGN_TREE ? "trees" : "rock"))
+    {
+        int total = 0;
+        for (const coord_def &c : hunters)
+        {
+            mons.position = c;
+            monster_pathfind mp;
+            mp.set_range(range);
+            if (mp.init_pathfind(&mons, foe))
+                total += mp.calc_waypoints().size();
+        }
+        return total;
+    };
+
+    BENCHMARK(string("30 goblins sharing distances in a maze of ")
+              + (wall == DNGN_TREE ? "trees" : "rock"))
+    {
+        clear_travel_fields();
+        int total = 0;
+        for (const coord_def &c : hunters)
+        {
+            mons.position = c;
+            vector<coord_def> waypoints;
+            if (shared_travel_path(mons, foe, range, waypoints))
+                total += waypoints.size();
+        }
+        return total;
+    };
+
+    mons.reset();
+    clear_travel_fields();
+    env.grid.init(DNGN_UNSEEN);
+}
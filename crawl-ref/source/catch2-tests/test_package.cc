@@ -0,0 +1,378 @@
+#include "catch_amalgamated.hpp"
+
+#include "AppHdr.h"
+
+#include "errors.h"
+#include "files.h"
+#include "package.h"
+#include "syscalls.h"
+
+static const char *TEST_SAVE = "test-package.tmp";
+
+static void _write_chunk(package &save, const string &name,
+                         const string &data, chunk_codec codec = CODEC_ZLIB)
+{
+    chunk_writer *ch = save.writer(name, codec);
+    ch->write(data.data(), data.size());
+    delete ch;
+}
+
+static string _read_chunk(package &save, const string &name)
+{
+    chunk_reader *ch = save.reader(name);
+    if (!ch)
+        return "";
+    vector<char> data;
+    ch->read_all(data);
+    delete ch;
+    return string(data.begin(), data.end());
+}
+
+TEST_CASE("asynchronous packages read back what was written", "[single-file]")
+{
+    const string big(100000, 'x');
+    {
+        package save(TEST_SAVE, true, true);
+        save.set_async();
+        for (int i = 0; i < 10; ++i)
+        {
+            const string n = to_string(i);
+            _write_chunk(save, "small", n);
+            _write_chunk(save, "big", big + n);
+            _write_chunk(save, "lev" + n, n);
+            if (i)
+                save.delete_chunk("lev" + to_string(i - 1));
+
+            // Chunks waiting for the commit, and those being written.
+            REQUIRE(_read_chunk(save, "small") == n);
+            save.commit();
+            REQUIRE(_read_chunk(save, "small") == n);
+            REQUIRE(_read_chunk(save, "big") == big + n);
+            REQUIRE(save.has_chunk("lev" + n));
+            REQUIRE(!save.has_chunk("lev" + to_string(i - 1)));
+            REQUIRE(save.list_chunks().size() == 3);
+        }
+        _write_chunk(save, "last", "uncommitted");
+    }
+
+    package save(TEST_SAVE, false);
+    REQUIRE(_read_chunk(save, "small") == "9");
+    REQUIRE(_read_chunk(save, "big") == big + "9");
+    REQUIRE(_read_chunk(save, "lev9") == "9");
+    // Closing the package commits it.
+    REQUIRE(_read_chunk(save, "last") == "uncommitted");
+    REQUIRE(save.list_chunks().size() == 4);
+
+    unlink_u(TEST_SAVE);
+}
+
+TEST_CASE("flushed chunks wait for the commit", "[single-file]")
+{
+    const string big(100000, 'x');
+    {
+        package save(TEST_SAVE, true, true);
+        save.set_async();
+        _write_chunk(save, "kept", "kept");
+        save.commit();
+        for (int i = 0; i < 5; ++i)
+        {
+            _write_chunk(save, "lev" + to_string(i), big + to_string(i));
+            save.flush();
+            REQUIRE(_read_chunk(save, "lev" + to_string(i))
+                    == big + to_string(i));
+        }
+        save.delete_chunk("kept");
+        save.flush();
+        REQUIRE(!save.has_chunk("kept"));
+        save.abort();
+    }
+    {
+        package save(TEST_SAVE, true);
+        REQUIRE(save.list_chunks() == vector<string>{ "kept" });
+        save.set_async();
+        _write_chunk(save, "lev", big);
+        save.flush();
+        save.commit();
+    }
+
+    package save(TEST_SAVE, false);
+    REQUIRE(_read_chunk(save, "lev") == big);
+    REQUIRE(_read_chunk(save, "kept") == "kept");
+
+    unlink_u(TEST_SAVE);
+}
+
+TEST_CASE("chunks keep their codecs", "[single-file]")
+{
+    const string data = string(5000, 'a') + "some text" + string(5000, 'b');
+    {
+        package save(TEST_SAVE, true, true);
+        _write_chunk(save, "plain", data);
+        save.commit();
+    }
+    {
+        // Saves with only zlib chunks have no codec tags to read.
+        package save(TEST_SAVE, true);
+        REQUIRE(save.get_chunk_codec("plain") == CODEC_ZLIB);
+        _write_chunk(save, "fast", data, CODEC_ZLIB_FAST);
+        _write_chunk(save, "stored", data, CODEC_STORED);
+        _write_chunk(save, "empty", "", CODEC_STORED);
+    }
+
+    package save(TEST_SAVE, false);
+    REQUIRE(save.get_chunk_codec("plain") == CODEC_ZLIB);
+    // Fast deflate is plain zlib to a reader, and isn't tagged.
+    REQUIRE(save.get_chunk_codec("fast") == CODEC_ZLIB);
+    REQUIRE(save.get_chunk_codec("stored") == CODEC_STORED);
+    for (const char *name : { "plain", "fast", "stored" })
+        REQUIRE(_read_chunk(save, name) == data);
+    REQUIRE(_read_chunk(save, "empty").empty());
+    REQUIRE(save.get_chunk_compressed_length("stored") == data.size());
+    REQUIRE(save.get_chunk_compressed_length("plain") < data.size());
+
+    unlink_u(TEST_SAVE);
+}
+
+static int _package_version(const char *file)
+{
+    FILE *f = fopen_u(file, "rb");
+    REQUIRE(f);
+    unsigned char head[5];
+    REQUIRE(fread(head, 1, sizeof(head), f) == sizeof(head));
+    fclose(f);
+    return head[4];
+}
+
+TEST_CASE("saves stay version 1 unless they have stored chunks",
+          "[single-file]")
+{
+    const string data(5000, 'a');
+    {
+        package save(TEST_SAVE, true, true);
+        _write_chunk(save, "plain", data);
+        _write_chunk(save, "fast", data, CODEC_ZLIB_FAST);
+        save.commit();
+        REQUIRE(_package_version(TEST_SAVE) == 1);
+
+        _write_chunk(save, "stored", data, CODEC_STORED);
+        save.commit();
+        REQUIRE(_package_version(TEST_SAVE) == 2);
+
+        save.delete_chunk("stored");
+        save.commit();
+        REQUIRE(_package_version(TEST_SAVE) == 1);
+    }
+
+    package save(TEST_SAVE, false);
+    REQUIRE(_read_chunk(save, "plain") == data);
+    REQUIRE(_read_chunk(save, "fast") == data);
+
+    unlink_u(TEST_SAVE);
+}
+
+TEST_CASE("read-only packages read chunks from the mapped file",
+          "[single-file]")
+{
+    // Incompressible, so that the chunks take several blocks each.
+    string noise(200000, 0);
+    uint32_t x = 1;
+    for (char &c : noise)
+    {
+        x = x * 1103515245 + 12345;
+        c = x >> 24;
+    }
+    {
+        package save(TEST_SAVE, true, true);
+        chunk_writer *zlib = save.writer("zlib");
+        chunk_writer *stored = save.writer("stored", CODEC_STORED);
+        for (size_t at = 0; at < noise.size(); at += 50000)
+        {
+            zlib->write(&noise[at], 50000);
+            stored->write(&noise[at], 50000);
+        }
+        delete zlib;
+        delete stored;
+    }
+
+    plen_t size;
+    {
+        package save(TEST_SAVE, false);
+        size = save.get_size();
+        REQUIRE(save.get_chunk_fragmentation("zlib") > 1);
+        REQUIRE(save.get_chunk_fragmentation("stored") > 1);
+        REQUIRE(_read_chunk(save, "zlib") == noise);
+        REQUIRE(_read_chunk(save, "stored") == noise);
+
+        // Two readers of the same chunk at once.
+        chunk_reader *a = save.reader("stored");
+        chunk_reader *b = save.reader("stored");
+        char ca[1000], cb[1000];
+        REQUIRE(a->read(ca, sizeof(ca)) == sizeof(ca));
+        REQUIRE(b->read(cb, sizeof(cb)) == sizeof(cb));
+        REQUIRE(a->read(ca, sizeof(ca)) == sizeof(ca));
+        REQUIRE(string(ca, sizeof(ca)) == noise.substr(1000, sizeof(ca)));
+        REQUIRE(string(cb, sizeof(cb)) == noise.substr(0, sizeof(cb)));
+        delete a;
+        delete b;
+    }
+
+    // The directory is written last, so this garbles it.
+    FILE *f = fopen_u(TEST_SAVE, "r+b");
+    REQUIRE(f);
+    fseek(f, size - 10, SEEK_SET);
+    fwrite(string(10, 0).data(), 1, 10, f);
+    fclose(f);
+    REQUIRE_THROWS_AS(package(TEST_SAVE, false), corrupted_save);
+
+    unlink_u(TEST_SAVE);
+}
+
+TEST_CASE("compacting a package keeps its chunks", "[single-file]")
+{
+    const string big(20000, 'x');
+    {
+        package save(TEST_SAVE, true, true);
+        // Rewriting chunks of changing sizes leaves holes and fragments.
+        for (int i = 0; i < 20; ++i)
+        {
+            const string n = to_string(i);
+            _write_chunk(save, "lev" + to_string(i % 4), big + n,
+                         i % 2 ? CODEC_STORED : CODEC_ZLIB_FAST);
+            _write_chunk(save, "chr", string(i * 1000, 'c'));
+            save.commit();
+        }
+        REQUIRE(save.get_slack() > 0);
+
+        REQUIRE(save.compact());
+        REQUIRE(save.get_slack() == 0);
+        REQUIRE(save.get_chunk_fragmentation("chr") == 1);
+        REQUIRE(_read_chunk(save, "chr") == string(19000, 'c'));
+
+        // The package goes on working with the new file.
+        _write_chunk(save, "new", "after");
+        save.delete_chunk("lev0");
+    }
+
+    package save(TEST_SAVE, false);
+    REQUIRE(!file_exists(string(TEST_SAVE) + ".tmp"));
+    REQUIRE(save.list_chunks().size() == 5);
+    REQUIRE(!save.has_chunk("lev0"));
+    REQUIRE(_read_chunk(save, "new") == "after");
+    for (int i = 17; i < 20; ++i)
+    {
+        const string name = "lev" + to_string(i % 4);
+        REQUIRE(_read_chunk(save, name) == big + to_string(i));
+        REQUIRE(save.get_chunk_codec(name)
+                == (i % 2 ? CODEC_STORED : CODEC_ZLIB));
+    }
+
+    unlink_u(TEST_SAVE);
+}
+
+TEST_CASE("packages compact themselves past the slack threshold",
+          "[single-file]")
+{
+    const bool async = GENERATE(false, true);
+    package save(TEST_SAVE, true, true);
+    if (async)
+        save.set_async();
+    save.set_compact_slack(25);
+    _write_chunk(save, "small", "s");
+    for (int i = 0; i < 20; ++i)
+    {
+        _write_chunk(save, "big", string(1000 + i * 500, 'b'), CODEC_STORED);
+        save.commit();
+        // Asynchronous packages compact at the next commit, once the
+        // chunks have been written.
+        if (async)
+            save.commit();
+        const plen_t slack = save.get_slack();
+        REQUIRE(slack * 4 <= save.get_size());
+    }
+    REQUIRE(_read_chunk(save, "big") == string(10500, 'b'));
+    REQUIRE(_read_chunk(save, "small") == "s");
+    save.abort();
+    save.unlink();
+}
+
+// The benchmarks' corpus is every save in the directory named by
+// $SAVE_CORPUS, or in saves/ if it is unset.
+static string _corpus_dir()
+{
+    return getenv("SAVE_CORPUS") ? getenv("SAVE_CORPUS") : "saves";
+}
+
+// Not run by default; use `catch2-tests-executable "[package-benchmark]"`.
+TEST_CASE("package codec benchmark", "[.][package-benchmark]")
+{
+    const string dir = _corpus_dir();
+    vector<pair<string, string>> corpus;
+    for (const string &file : get_dir_files_ext(dir, SAVE_SUFFIX))
+    {
+        package save((dir + "/" + file).c_str(), false);
+        // Keep the chunks of different saves apart.
+        const string prefix = to_string(corpus.size()) + "/";
+        for (const string &name : save.list_chunks())
+            corpus.emplace_back(prefix + name, _read_chunk(save, name));
+    }
+    if (corpus.empty())
+    {
+        WARN("no saves to benchmark with");
+        return;
+    }
+
+    const chunk_codec codec = GENERATE(CODEC_ZLIB, CODEC_ZLIB_FAST,
+                                       CODEC_STORED);
+    const string name = chunk_codec_name(codec);
+
+    BENCHMARK("writing the corpus with " + name)
+    {
+        package save(TEST_SAVE, true, true);
+        for (const auto &chunk : corpus)
+            _write_chunk(save, chunk.first, chunk.second, codec);
+        save.commit();
+        return save.get_size();
+    };
+
+    {
+        package save(TEST_SAVE, true, true);
+        for (const auto &chunk : corpus)
+            _write_chunk(save, chunk.first, chunk.second, codec);
+    }
+    package save(TEST_SAVE, false);
+    WARN(name << ": " << corpus.size() << " chunks in " << save.get_size()
+         << " bytes");
+
+    BENCHMARK("reading the corpus with " + name)
+    {
+        size_t total = 0;
+        for (const auto &chunk : corpus)
+            total += _read_chunk(save, chunk.first).size();
+        return total;
+    };
+
+    unlink_u(TEST_SAVE);
+}
+
+// What the save browser does for each save.
+TEST_CASE("save browser benchmark", "[.][package-benchmark]")
+{
+    const string dir = _corpus_dir();
+    const vector<string> files = get_dir_files_ext(dir, SAVE_SUFFIX);
+    if (files.empty())
+    {
+        WARN("no saves to benchmark with");
+        return;
+    }
+
+    BENCHMARK("reading the character info of every save")
+    {
+        size_t total = 0;
+        for (const string &file : files)
+        {
+            package save((dir + "/" + file).c_str(), false);
+            total += _read_chunk(save, "chr").size();
+        }
+        return total;
+    };
+}
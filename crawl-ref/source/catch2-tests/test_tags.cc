@@ -5,7 +5,9 @@
 #include "AppHdr.h"
 
 #include "map-cell.h"
+#include "mapped-file.h"
 #include "random.h"
+#include "syscalls.h"
 #include "tags.h"
 
 TEST_CASE( "Vehumet gifts can be decoded", "[single-file]" ) {
@@ -245,3 +247,92 @@ TEST_CASE( "Basic marshalling/unmarshalling works correctly.", "[single-file]" )
         }
     }
 }
+
+TEST_CASE( "Chunk writers and readers are buffered transparently", "[single-file]" ) {
+
+    const char *save_name = "test-tags.tmp";
+    vector<unsigned char> blob(writer::CHUNK_BUFFER_SIZE + 100);
+    for (size_t i = 0; i < blob.size(); i++)
+        blob[i] = i * 7;
+
+    auto marshall_all = [&](writer &w) {
+        for (int i = 0; i < 10000; i++)
+        {
+            marshallByte(w, i);
+            marshallShort(w, i * 3 - 15000);
+            marshallInt(w, i * 100003);
+        }
+        w.write(blob.data(), blob.size());
+        marshallInt(w, -1);
+    };
+
+    vector<unsigned char> expected;
+    {
+        writer w(&expected);
+        marshall_all(w);
+    }
+
+    {
+        package save(save_name, true, true);
+        {
+            writer w(&save, "tags");
+            marshall_all(w);
+        }
+
+        SECTION ("the chunk holds the same bytes as an in-memory save") {
+            chunk_reader *ch = save.reader("tags");
+            vector<char> data;
+            ch->read_all(data);
+            delete ch;
+            REQUIRE(vector<unsigned char>(data.begin(), data.end()) == expected);
+        }
+
+        SECTION ("values can be read back") {
+            reader r(&save, "tags");
+            r.set_safe_read(true);
+            for (int i = 0; i < 10000; i++)
+            {
+                REQUIRE(unmarshallByte(r) == (int8_t)i);
+                REQUIRE(unmarshallShort(r) == (int16_t)(i * 3 - 15000));
+                REQUIRE(unmarshallInt(r) == i * 100003);
+            }
+            vector<unsigned char> read_blob(blob.size());
+            r.read(read_blob.data(), read_blob.size());
+            REQUIRE(read_blob == blob);
+            REQUIRE(unmarshallInt(r) == -1);
+            r.fail_if_not_eof("tags");
+            REQUIRE_THROWS_AS(unmarshallByte(r), short_read_exception);
+        }
+    }
+    unlink_u(save_name);
+}
+
+TEST_CASE( "Readers can read from a mapped file", "[single-file]" ) {
+
+    const char *file_name = "test-tags-mapped.tmp";
+    {
+        FILE *fp = fopen_u(file_name, "wb");
+        REQUIRE(fp);
+        writer w(file_name, fp);
+        for (int i = 0; i < 1000; i++)
+            marshallInt(w, i);
+        marshallString(w, "last");
+        fclose(fp);
+    }
+
+    mapped_file file;
+    REQUIRE(file.open(file_name));
+    reader r(file.data(), file.size());
+    r.set_safe_read(true);
+    REQUIRE(unmarshallInt(r) == 0);
+
+    // Skipping ahead, as map_def::load() does to find a map.
+    r.advance(998 * 4);
+    REQUIRE(unmarshallInt(r) == 999);
+    REQUIRE(unmarshallString(r) == "last");
+    REQUIRE(r.valid() == false);
+    REQUIRE_THROWS_AS(r.advance(1), short_read_exception);
+
+    file.close();
+    unlink_u(file_name);
+}
@@ -0,0 +1,432 @@
+#include <random>
+
+#include "catch_amalgamated.hpp"
+
+#include "AppHdr.h"
+
+#include "branch.h"
+#include "coordit.h"
+#include "env.h"
+#include "exclude.h"
+#include "map-knowledge.h"
+#include "state.h"
+#include "terrain.h"
+#include "player.h"
+#include "travel.h"
+#include "unwind.h"
+
+static void _set_terrain(const coord_def &c, dungeon_feature_type feat)
+{
+    env.grid(c) = feat;
+    env.map_knowledge(c).set_feature(feat);
+    env.map_knowledge(c).flags |= MAP_SEEN_FLAG;
+}
+
+static dungeon_feature_type _random_terrain(std::mt19937 &gen)
+{
+    const int roll = gen() % 20;
+    return roll < 13 ? DNGN_FLOOR :
+           roll < 17 ? DNGN_ROCK_WALL :
+           roll < 19 ? DNGN_SHALLOW_WATER
+                     : DNGN_CLOSED_DOOR;
+}
+
+static void _set_view(const coord_def &centre, int radius)
+{
+    clear_terrain_visibility();
+    for (radius_iterator ri(centre, radius, C_SQUARE); ri; ++ri)
+    {
+        env.map_knowledge(*ri).flags |= MAP_VISIBLE_FLAG;
+        env.visible.insert(*ri);
+    }
+}
+
+TEST_CASE("travel distances are repaired to match a full flood",
+          "[single-file]")
+{
+    unwind_bool need_save(crawl_state.need_save, true);
+    std::mt19937 gen(8);
+
+    env.map_knowledge.init(map_cell());
+    env.grid.init(DNGN_PERMAROCK_WALL);
+    for (rectangle_iterator ri(1); ri; ++ri)
+        _set_terrain(*ri, _random_terrain(gen));
+    const coord_def dest(GXM / 2, GYM / 2);
+    _set_terrain(dest, DNGN_FLOOR);
+
+    travel_dist_cache cache(false);
+    for (int round = 0; round < 40; ++round)
+    {
+        CAPTURE(round);
+
+        // Change the map in view, as seen while travelling, and now and
+        // then out of view as well.
+        const coord_def centre(3 + gen() % (GXM - 6), 3 + gen() % (GYM - 6));
+        _set_view(centre, LOS_DEFAULT_RANGE);
+        for (int i = 0; i < 12; ++i)
+        {
+            const coord_def c(centre.x + (int)(gen() % 15) - 7,
+                              centre.y + (int)(gen() % 15) - 7);
+            if (in_bounds(c) && c != dest)
+                _set_terrain(c, _random_terrain(gen));
+        }
+        if (round % 8 == 7)
+        {
+            for (int i = 0; i < 12; ++i)
+            {
+                const coord_def c(1 + gen() % (GXM - 2),
+                                  1 + gen() % (GYM - 2));
+                if (c != dest)
+                    _set_terrain(c, _random_terrain(gen));
+            }
+            cache.recheck_all();
+        }
+
+        fill_travel_point_distance(dest);
+        vector<pair<int, coord_def>> targets;
+        for (rectangle_iterator ri(1); ri; ++ri)
+        {
+            if (*ri != dest && is_travelsafe_square(*ri)
+                && (ri->x + ri->y * GXM) % 11 == round % 11)
+            {
+                const int d = travel_point_distance[ri->x][ri->y];
+                targets.emplace_back(d > 0 ? d : INFINITE_DISTANCE, *ri);
+            }
+        }
+
+        // Furthest first, so that the first answers of each round come
+        // from the repaired distances rather than from starting afresh.
+        sort(targets.rbegin(), targets.rend());
+        for (const auto &target : targets)
+        {
+            CAPTURE(target.second.x, target.second.y);
+            coord_def move;
+            REQUIRE(cache.distance(dest, target.second, move)
+                    == target.first);
+        }
+    }
+
+    clear_terrain_visibility();
+    env.map_knowledge.init(map_cell());
+    env.grid.init(DNGN_UNSEEN);
+}
+
+TEST_CASE("stair distances match a flood from each stair", "[single-file]")
+{
+    unwind_bool need_save(crawl_state.need_save, true);
+    unwind_var<branch_type> where(you.where_are_you, BRANCH_DUNGEON);
+    unwind_var<int> depth(you.depth, 3);
+    std::mt19937 gen(9);
+
+    env.map_knowledge.init(map_cell());
+    env.grid.init(DNGN_PERMAROCK_WALL);
+    for (rectangle_iterator ri(1); ri; ++ri)
+        _set_terrain(*ri, _random_terrain(gen));
+
+    const dungeon_feature_type stair_feats[] =
+    {
+        DNGN_STONE_STAIRS_DOWN_I, DNGN_STONE_STAIRS_DOWN_II,
+        DNGN_STONE_STAIRS_DOWN_III, DNGN_STONE_STAIRS_UP_I,
+        DNGN_STONE_STAIRS_UP_II, DNGN_STONE_STAIRS_UP_III,
+        DNGN_ESCAPE_HATCH_DOWN, DNGN_ESCAPE_HATCH_UP,
+    };
+    for (dungeon_feature_type feat : stair_feats)
+    {
+        const coord_def c(2 + gen() % (GXM - 4), 2 + gen() % (GYM - 4));
+        _set_terrain(c, feat);
+    }
+    // One stair that nothing reaches.
+    const coord_def walled(GXM - 4, GYM - 4);
+    for (adjacent_iterator ai(walled); ai; ++ai)
+        _set_terrain(*ai, DNGN_ROCK_WALL);
+    _set_terrain(walled, DNGN_STONE_STAIRS_UP_I);
+
+    LevelInfo &li = travel_cache.get_level_info(level_id::current());
+    li.update();
+    const vector<stair_info> &stairs = li.get_stairs();
+    REQUIRE(stairs.size() >= 2);
+
+    // What update() used to do: flood from each stair and read off the
+    // distances to the others, with -1 for those not reached.
+    int reached = 0;
+    for (unsigned int i = 0; i < stairs.size(); ++i)
+    {
+        fill_travel_point_distance(stairs[i].position);
+        for (unsigned int j = i + 1; j < stairs.size(); ++j)
+        {
+            CAPTURE(i, j);
+            const coord_def p = stairs[j].position;
+            const int dist = travel_point_distance[p.x][p.y];
+            REQUIRE(li.distance_between(i, j) == (dist > 0 ? dist : -1));
+            REQUIRE(li.distance_between(j, i) == li.distance_between(i, j));
+            if (dist > 0)
+                ++reached;
+        }
+    }
+    REQUIRE(reached > 0);
+
+    travel_cache.erase_level_info(level_id::current());
+    env.map_knowledge.init(map_cell());
+    env.grid.init(DNGN_UNSEEN);
+}
+
+// The interlevel route search as it was before it went in order of
+// distance: depth first, going back over levels whenever it finds a shorter
+// way to one of their stairs. Only routes to a level, not to a place on it,
+// are compared, so the target position handling is left out. If only_first
+// is given, the route must start with that stair.
+static int _old_transtravel_stair(const level_id &cur,
+                                  const level_pos &target,
+                                  int distance, const coord_def &stair,
+                                  level_id &closest_level,
+                                  int &best_level_distance,
+                                  coord_def &best_stair,
+                                  const coord_def *only_first = nullptr)
+{
+    int local_distance = -1;
+    level_id player_level = level_id::current();
+
+    LevelInfo &li = travel_cache.get_level_info(cur);
+
+    if (cur == target.id)
+    {
+        if (is_excluded(stair, li.get_excludes()) && !is_stair_exclusion(stair))
+            return -1;
+        return distance;
+    }
+
+    vector<stair_info> &stairs = li.get_stairs();
+    stair_info *this_stair = li.get_stair(stair);
+
+    if (!this_stair && cur != player_level)
+        return local_distance;
+
+    const bool first_leg = cur == player_level && you.pos() == stair;
+    for (stair_info &si : stairs)
+    {
+        if (first_leg && only_first && si.position != *only_first)
+            continue;
+
+        if (stairs_destination_is_excluded(si))
+            continue;
+
+        if (!si.can_travel() || is_excluded(si.position, li.get_excludes()))
+            continue;
+
+        int deltadist = li.distance_between(this_stair, &si);
+
+        if (!this_stair)
+        {
+            deltadist = travel_point_distance[si.position.x][si.position.y];
+            if (!deltadist && you.pos() != si.position)
+                deltadist = -1;
+        }
+        if (deltadist < 0)
+            continue;
+
+        int dist2stair = distance + deltadist;
+        if (si.distance == -1 || si.distance > dist2stair)
+        {
+            si.distance = dist2stair;
+            dist2stair += 500;
+
+            if (local_distance != -1 && dist2stair >= local_distance)
+                continue;
+
+            const level_pos &dest = si.destination;
+
+            if (feat_is_escape_hatch(si.grid)
+                && target.pos.x == -1
+                && dest.id == target.id)
+            {
+                continue;
+            }
+
+            if (target.pos.x == -1
+                && dest.id == target.id)
+            {
+                if (local_distance == -1 || local_distance > dist2stair)
+                {
+                    local_distance = dist2stair;
+                    if (first_leg)
+                        best_stair = si.position;
+                }
+                continue;
+            }
+
+            if (dest.id.depth > -1)
+            {
+                int dist = level_distance(dest.id, target.id);
+                if (dist != -1 && (dist < best_level_distance
+                                   || best_level_distance == -1))
+                {
+                    best_level_distance = dist;
+                    closest_level       = dest.id;
+                }
+            }
+
+            if (!dest.is_valid())
+                continue;
+
+            if (is_hell_branch(dest.id.branch)
+                            && !(is_hell_branch(target.id.branch)
+                                 || is_hell_branch(cur.branch)))
+            {
+                continue;
+            }
+
+            LevelInfo &lo = travel_cache.get_level_info(dest.id);
+            if (stair_info *so = lo.get_stair(dest.pos))
+            {
+                if (so->distance == -1 || so->distance > dist2stair)
+                    so->distance = dist2stair;
+                else
+                    continue;
+            }
+
+            const int newdist =
+                _old_transtravel_stair(dest.id, target, dist2stair, dest.pos,
+                                       closest_level, best_level_distance,
+                                       best_stair);
+            if (newdist != -1
+                && (local_distance == -1 || local_distance > newdist))
+            {
+                local_distance = newdist;
+                if (first_leg)
+                    best_stair = si.position;
+            }
+        }
+    }
+    return local_distance;
+}
+
+TEST_CASE("interlevel travel finds routes as short as the old search",
+          "[single-file]")
+{
+    unwind_bool need_save(crawl_state.need_save, true);
+    unwind_var<branch_type> where(you.where_are_you, BRANCH_DUNGEON);
+    unwind_var<int> depth(you.depth);
+    const coord_def old_pos = you.pos();
+    std::mt19937 gen(10);
+
+    const int levels = 4;
+    const dungeon_feature_type downs[] =
+    {
+        DNGN_STONE_STAIRS_DOWN_I, DNGN_STONE_STAIRS_DOWN_II,
+        DNGN_STONE_STAIRS_DOWN_III, DNGN_ESCAPE_HATCH_DOWN,
+    };
+    const dungeon_feature_type ups[] =
+    {
+        DNGN_STONE_STAIRS_UP_I, DNGN_STONE_STAIRS_UP_II,
+        DNGN_STONE_STAIRS_UP_III, DNGN_ESCAPE_HATCH_UP,
+    };
+    const int links = ARRAYSZ(downs);
+
+    // Where each level's way down and way up of each kind is.
+    coord_def down[levels + 1][links], up[levels + 1][links];
+    for (int d = 1; d <= levels; ++d)
+        for (int k = 0; k < links; ++k)
+        {
+            down[d][k] = coord_def(2 + gen() % (GXM - 4), 2 + gen() % (GYM - 4));
+            up[d][k] = coord_def(2 + gen() % (GXM - 4), 2 + gen() % (GYM - 4));
+        }
+
+    // Lay out the player's level last, so that it is the one in env.
+    const int player_depth = 2;
+    for (int d : { 1, 3, 4, player_depth })
+    {
+        you.depth = d;
+        env.map_knowledge.init(map_cell());
+        env.grid.init(DNGN_PERMAROCK_WALL);
+        for (rectangle_iterator ri(1); ri; ++ri)
+            _set_terrain(*ri, _random_terrain(gen));
+        for (int k = 0; k < links; ++k)
+        {
+            if (d < levels)
+                _set_terrain(down[d][k], downs[k]);
+            if (d > 1)
+                _set_terrain(up[d][k], ups[k]);
+        }
+        travel_cache.get_level_info(level_id::current()).update();
+    }
+
+    for (int d = 1; d < levels; ++d)
+    {
+        const level_id above_id(BRANCH_DUNGEON, d);
+        const level_id below_id(BRANCH_DUNGEON, d + 1);
+        LevelInfo &above = travel_cache.get_level_info(above_id);
+        LevelInfo &below = travel_cache.get_level_info(below_id);
+        for (int k = 0; k < links; ++k)
+        {
+            stair_info *si = above.get_stair(down[d][k]);
+            stair_info *so = below.get_stair(up[d + 1][k]);
+            // Two stairs may have landed on the same square.
+            if (!si || !so || si->grid != downs[k] || so->grid != ups[k])
+                continue;
+            si->destination = level_pos(below_id, so->position);
+            so->destination = level_pos(above_id, si->position);
+        }
+    }
+
+    const level_id current = level_id::current();
+    int routes = 0;
+    for (int start = 0; start < 20; ++start)
+    {
+        coord_def pos(1 + gen() % (GXM - 2), 1 + gen() % (GYM - 2));
+        if (!is_travelsafe_square(pos))
+            continue;
+        you.set_position(pos);
+        fill_travel_point_distance(pos);
+
+        for (int t = 1; t <= levels; ++t)
+        {
+            if (t == player_depth)
+                continue;
+            CAPTURE(start, t);
+            const level_pos target(level_id(BRANCH_DUNGEON, t));
+
+            level_id closest_level;
+            int best_level_distance = -1;
+            coord_def best_stair(-1, -1);
+            travel_cache.clear_distances();
+            const int dist =
+                find_transtravel_stair(current, target, pos, closest_level,
+                                       best_level_distance, best_stair);
+
+            level_id old_closest_level;
+            int old_best_level_distance = -1;
+            coord_def old_best_stair(-1, -1);
+            travel_cache.clear_distances();
+            const int old_dist =
+                _old_transtravel_stair(current, target, 0, pos,
+                                       old_closest_level,
+                                       old_best_level_distance,
+                                       old_best_stair);
+
+            REQUIRE(dist == old_dist);
+            REQUIRE((best_stair.x == -1) == (old_best_stair.x == -1));
+            if (dist == -1)
+                continue;
+            ++routes;
+
+            // Where several stairs are equally good the two may pick
+            // different ones, but the one picked must start a route as
+            // short as the best.
+            coord_def first_stair(-1, -1);
+            travel_cache.clear_distances();
+            REQUIRE(_old_transtravel_stair(current, target, 0, pos,
+                                           old_closest_level,
+                                           old_best_level_distance,
+                                           first_stair, &best_stair)
+                    == dist);
+            REQUIRE(first_stair == best_stair);
+        }
+    }
+    REQUIRE(routes > 0);
+
+    you.set_position(old_pos);
+    for (int d = 1; d <= levels; ++d)
+        travel_cache.erase_level_info(level_id(BRANCH_DUNGEON, d));
+    env.map_knowledge.init(map_cell());
+    env.grid.init(DNGN_UNSEEN);
+}
@@ -7,6 +7,11 @@
 
 #include "dbg-maps.h"
 
+#ifdef UNIX
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 #include "branch.h"
 #include "chardump.h"
 #include "crash.h"
@@ -20,6 +25,7 @@
 #include "ng-init.h"
 #include "ng-setup.h"
 #include "player.h"
+#include "random.h"
 #include "shopping.h"
 #include "state.h"
 #include "stringutil.h"
@@ -220,6 +226,185 @@ static bool _build_dungeon()
     return true;
 }
 
+// Build iterations first, first + step, first + 2 * step...
+// Each iteration is seeded on its own, so that the same seed gives the
+// same results however the iterations are shared out among -jobs.
+static bool _build_iterations(int first, int step)
+{
+    for (int i = first; i < SysEnv.map_gen_iters; i += step)
+    {
+        clear_messages();
+        mprf("On %d of %d; %d g, %d fail, %u err%s, %u uniq, "
+             "%d try, %d (%.2f%%) vetoes",
+             i, SysEnv.map_gen_iters, levels_tried, levels_failed,
+             (unsigned int)errors.size(),
+             last_error.empty() ? "" : (" (" + last_error + ")").c_str(),
+             (unsigned int)use_count.size(), build_attempts, level_vetoes,
+             build_attempts ? level_vetoes * 100.0 / build_attempts : 0.0);
+        printf("%d..", i + 1);
+        fflush(stdout);
+
+        rng::seed(crawl_state.seed + i);
+        dgn_reset_player_data();
+        initial_dungeon_setup();
+
+        if (!_build_dungeon())
+            return false;
+        if (crawl_state.obj_stat_gen)
+            objstat_iteration_stats();
+    }
+    return true;
+}
+
+void marshall_stat(writer &th, int value)
+{
+    marshallInt(th, value);
+}
+
+void marshall_stat(writer &th, const string &value)
+{
+    marshallString(th, value);
+}
+
+void marshall_stat(writer &th, const level_id &value)
+{
+    marshall_level_id(th, value);
+}
+
+void merge_stat(reader &th, int &value)
+{
+    value += unmarshallInt(th);
+}
+
+void merge_stat(reader &th, string &value)
+{
+    value = unmarshallString(th);
+}
+
+void merge_stat(reader &th, level_id &value)
+{
+    value = unmarshall_level_id(th);
+}
+
+void merge_stat(reader &th, map<string, int> &fields)
+{
+    for (int n = unmarshallInt(th); n > 0; --n)
+    {
+        const string field = unmarshallString(th);
+        const int value = unmarshallInt(th);
+        int &into = fields[field];
+        if (field == "NumMin")
+            into = min(into, value);
+        else if (field == "NumMax")
+            into = max(into, value);
+        else
+            into += value;
+    }
+}
+
+static void _write_tables(writer &th)
+{
+    marshall_stat(th, try_count);
+    marshall_stat(th, use_count);
+    marshall_stat(th, success_count);
+    marshall_stat(th, level_mapcounts);
+    marshall_stat(th, map_builds);
+    marshall_stat(th, level_mapsused);
+    marshall_stat(th, map_levelsused);
+    marshall_stat(th, errors);
+    marshall_stat(th, veto_messages);
+    marshall_stat(th, levels_tried);
+    marshall_stat(th, levels_failed);
+    marshall_stat(th, build_attempts);
+    marshall_stat(th, level_vetoes);
+    if (crawl_state.obj_stat_gen)
+        objstat_write_tables(th);
+}
+
+static void _merge_tables(reader &th)
+{
+    merge_stat(th, try_count);
+    merge_stat(th, use_count);
+    merge_stat(th, success_count);
+    merge_stat(th, level_mapcounts);
+    merge_stat(th, map_builds);
+    merge_stat(th, level_mapsused);
+    merge_stat(th, map_levelsused);
+    merge_stat(th, errors);
+    merge_stat(th, veto_messages);
+    merge_stat(th, levels_tried);
+    merge_stat(th, levels_failed);
+    merge_stat(th, build_attempts);
+    merge_stat(th, level_vetoes);
+    if (crawl_state.obj_stat_gen)
+        objstat_merge_tables(th);
+}
+
+#ifdef UNIX
+// Share the iterations out among forked workers, each with tables of its
+// own, and add their tables into ours as they finish.
+static bool _build_levels_in_workers(int jobs)
+{
+    fflush(stdout);
+    fflush(stderr);
+
+    vector<pid_t> workers;
+    vector<FILE *> results;
+    for (int w = 0; w < jobs; ++w)
+    {
+        int fds[2];
+        if (pipe(fds))
+            end(1, true, "Can't make a pipe for a mapstat worker");
+
+        const pid_t pid = fork();
+        if (pid == -1)
+            end(1, true, "Can't start a mapstat worker");
+
+        if (!pid)
+        {
+            close(fds[0]);
+            for (FILE *f : results)
+                fclose(f);
+
+            const bool ok = _build_iterations(w, jobs);
+            FILE *out = fdopen(fds[1], "wb");
+            {
+                writer th("mapstat worker", out);
+                marshallBoolean(th, ok);
+                _write_tables(th);
+            }
+            fclose(out);
+            // Leave cleaning up to the parent.
+            _exit(0);
+        }
+
+        close(fds[1]);
+        workers.push_back(pid);
+        results.push_back(fdopen(fds[0], "rb"));
+    }
+
+    bool ok = true;
+    for (int w = 0; w < jobs; ++w)
+    {
+        try
+        {
+            reader th(results[w]);
+            th.set_safe_read(true);
+            ok = unmarshallBoolean(th) && ok;
+            _merge_tables(th);
+        }
+        catch (short_read_exception &E)
+        {
+            fprintf(stderr, "Mapstat worker %d died.\n", w + 1);
+            ok = false;
+        }
+        fclose(results[w]);
+        waitpid(workers[w], nullptr, 0);
+    }
+    return ok;
+}
+#endif
+
 /**
  * Build dungeon levels for mapstat or objstat.
  *
@@ -239,27 +424,19 @@ bool mapstat_build_levels()
         _dungeon_places();
     printf("Iteration: ");
     fflush(stdout);
-    for (int i = 0; i < SysEnv.map_gen_iters; ++i)
-    {
-        clear_messages();
-        mprf("On %d of %d; %d g, %d fail, %u err%s, %u uniq, "
-             "%d try, %d (%.2f%%) vetoes",
-             i, SysEnv.map_gen_iters, levels_tried, levels_failed,
-             (unsigned int)errors.size(),
-             last_error.empty() ? "" : (" (" + last_error + ")").c_str(),
-             (unsigned int)use_count.size(), build_attempts, level_vetoes,
-             build_attempts ? level_vetoes * 100.0 / build_attempts : 0.0);
-        printf("%d..", i + 1);
-        fflush(stdout);
-
-        dgn_reset_player_data();
-        initial_dungeon_setup();
 
-        if (!_build_dungeon())
+#ifdef UNIX
+    const int jobs = min(SysEnv.map_gen_jobs, SysEnv.map_gen_iters);
+    if (jobs > 1)
+    {
+        if (!_build_levels_in_workers(jobs))
             return false;
-        if (crawl_state.obj_stat_gen)
-            objstat_iteration_stats();
     }
+    else
+#endif
+    if (!_build_iterations(0, 1))
+        return false;
+
     printf("Finished.\n");
     fflush(stdout);
     return true;
@@ -506,6 +683,8 @@ void mapstat_generate_stats()
     if (!crawl_state.force_map.empty() && !mapstat_find_forced_map())
         return;
 
+    // Use the -seed given, or pick one, and seed each iteration from it.
+    rng::reset();
     initialise_item_descriptions();
     initialise_branch_depths();
 
@@ -518,8 +697,8 @@ void mapstat_generate_stats()
     clear_messages();
     mpr("Generating dungeon map stats");
     printf("Generating map stats for %d iteration(s) of %d level(s) over "
-           "%d branch(es).\n", SysEnv.map_gen_iters,
-           (int) generated_levels.size(), branch_count);
+           "%d branch(es) with seed %" PRIu64 ".\n", SysEnv.map_gen_iters,
+           (int) generated_levels.size(), branch_count, crawl_state.seed);
     fflush(stdout);
 
     mapstat_build_levels();
@@ -7,6 +7,12 @@
 
 #ifdef DEBUG_STATISTICS
 
+#include <map>
+#include <set>
+#include <type_traits>
+
+#include "tags.h"
+
 class map_def;
 void mapstat_report_map_try(const map_def &map);
 void mapstat_report_map_use(const map_def &map);
@@ -17,4 +23,99 @@ void mapstat_report_map_veto(const string &message);
 void mapstat_generate_stats();
 bool mapstat_build_levels();
 bool mapstat_find_forced_map();
+
+// Statistics tables are sent from -jobs workers to the parent as nested
+// maps and sets of these. merge_stat() reads a table and adds it into
+// one the parent already has.
+void marshall_stat(writer &th, int value);
+void marshall_stat(writer &th, const string &value);
+void marshall_stat(writer &th, const level_id &value);
+void merge_stat(reader &th, int &value);
+void merge_stat(reader &th, string &value);
+void merge_stat(reader &th, level_id &value);
+// Fields named NumMin and NumMax keep the least and greatest values
+// rather than adding up.
+void merge_stat(reader &th, map<string, int> &fields);
+
+template<typename T>
+typename enable_if<is_enum<T>::value>::type
+marshall_stat(writer &th, T value)
+{
+    marshallInt(th, static_cast<int>(value));
+}
+
+template<typename T>
+typename enable_if<is_enum<T>::value>::type
+merge_stat(reader &th, T &value)
+{
+    value = static_cast<T>(unmarshallInt(th));
+}
+
+template<typename A, typename B>
+void marshall_stat(writer &th, const pair<A, B> &value);
+template<typename T>
+void marshall_stat(writer &th, const set<T> &value);
+template<typename K, typename V>
+void marshall_stat(writer &th, const map<K, V> &value);
+template<typename A, typename B>
+void merge_stat(reader &th, pair<A, B> &value);
+template<typename T>
+void merge_stat(reader &th, set<T> &value);
+template<typename K, typename V>
+void merge_stat(reader &th, map<K, V> &value);
+
+template<typename A, typename B>
+void marshall_stat(writer &th, const pair<A, B> &value)
+{
+    marshall_stat(th, value.first);
+    marshall_stat(th, value.second);
+}
+
+template<typename T>
+void marshall_stat(writer &th, const set<T> &value)
+{
+    marshallInt(th, value.size());
+    for (const T &elt : value)
+        marshall_stat(th, elt);
+}
+
+template<typename K, typename V>
+void marshall_stat(writer &th, const map<K, V> &value)
+{
+    marshallInt(th, value.size());
+    for (const auto &entry : value)
+    {
+        marshall_stat(th, entry.first);
+        marshall_stat(th, entry.second);
+    }
+}
+
+template<typename A, typename B>
+void merge_stat(reader &th, pair<A, B> &value)
+{
+    merge_stat(th, value.first);
+    merge_stat(th, value.second);
+}
+
+template<typename T>
+void merge_stat(reader &th, set<T> &value)
+{
+    for (int n = unmarshallInt(th); n > 0; --n)
+    {
+        T elt = T();
+        merge_stat(th, elt);
+        value.insert(elt);
+    }
+}
+
+template<typename K, typename V>
+void merge_stat(reader &th, map<K, V> &value)
+{
+    for (int n = unmarshallInt(th); n > 0; --n)
+    {
+        K key = K();
+        merge_stat(th, key);
+        merge_stat(th, value[key]);
+    }
+}
 #endif
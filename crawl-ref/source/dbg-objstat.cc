@@ -33,6 +33,7 @@
 #include "mon-pick.h"
 #include "mon-util.h"
 #include "ng-init.h"
+#include "random.h"
 #include "shopping.h"
 #include "spl-book.h"
 #include "state.h"
@@ -1023,6 +1024,25 @@ void objstat_iteration_stats()
     }
 }
 
+// The tables of a -jobs worker, for the parent to add to its own.
+void objstat_write_tables(writer &th)
+{
+    marshall_stat(th, item_recs);
+    marshall_stat(th, brand_recs);
+    marshall_stat(th, monster_recs);
+    marshall_stat(th, feature_recs);
+    marshall_stat(th, spell_recs);
+}
+
+void objstat_merge_tables(reader &th)
+{
+    merge_stat(th, item_recs);
+    merge_stat(th, brand_recs);
+    merge_stat(th, monster_recs);
+    merge_stat(th, feature_recs);
+    merge_stat(th, spell_recs);
+}
+
 static FILE * _open_stat_file(string stat_file)
 {
     FILE *stat_fh = nullptr;
@@ -1058,8 +1078,9 @@ static void _write_stat_info()
             "Number of branches: %d\n"
             "%s"
             "Number of levels: %d\n"
+            "Seed: %" PRIu64 "\n"
             "Version: %s\n", SysEnv.map_gen_iters, num_branches,
-            all_desc.c_str(), num_levels, Version::Long);
+            all_desc.c_str(), num_levels, crawl_state.seed, Version::Long);
 
     fclose(stat_outf);
     printf("Wrote Objstat Info to %s.\n", out_file.c_str());
@@ -1344,6 +1365,8 @@ void objstat_generate_stats()
     if (!crawl_state.force_map.empty() && !mapstat_find_forced_map())
         return;
 
+    // Use the -seed given, or pick one, and seed each iteration from it.
+    rng::reset();
     initialise_item_descriptions();
     initialise_branch_depths();
 
@@ -1393,8 +1416,8 @@ void objstat_generate_stats()
         stat_levels.insert(all_lev);
 
     printf("Generating object statistics for %d iteration(s) of %d "
-           "level(s) over %d branch(es).\n", SysEnv.map_gen_iters,
-           num_levels, num_branches);
+           "level(s) over %d branch(es) with seed %" PRIu64 ".\n",
+           SysEnv.map_gen_iters, num_levels, num_branches, crawl_state.seed);
 
     _init_spells();
     _init_features();
@@ -11,4 +11,9 @@ void objstat_generate_stats();
 void objstat_record_monster(const monster *mons);
 void objstat_record_feature(dungeon_feature_type feat_type, bool vault);
 void objstat_iteration_stats();
+
+class reader;
+class writer;
+void objstat_write_tables(writer &th);
+void objstat_merge_tables(reader &th);
 #endif
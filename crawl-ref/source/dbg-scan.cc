@@ -343,7 +343,14 @@ void debug_mons_scan()
                  m->full_name(DESC_PLAIN).c_str(),
                  pos.x, pos.y, i);
         }
-        else if (env.mgrid(pos) != i)
+        else if (!env.mon_index.indexed(*m))
+        {
+            mprf(MSGCH_ERROR, "Unindexed monster: %s at (%d, %d), midx = %d",
+                 m->full_name(DESC_PLAIN).c_str(),
+                 pos.x, pos.y, i);
+        }
+
+        if (in_bounds(pos) && env.mgrid(pos) != i)
         {
             floating_mons.push_back(i);
             is_floating[i] = true;
@@ -67,6 +67,7 @@
 #include "stringutil.h"
 #include "rltiles/tiledef-dngn.h"
 #include "tag-version.h"
+#include "tags.h"
 #include "tile-env.h"
 #include "tilepick.h"
 #include "tileview.h"
@@ -87,7 +88,8 @@
 
 // DUNGEON BUILDERS
 static bool _build_level_vetoable(bool enable_random_maps);
-static void _build_dungeon_level();
+static bool _build_dungeon_layout();
+static void _build_dungeon_features(bool place_vaults);
 static bool _valid_dungeon_level();
 
 static bool _builder_by_type();
@@ -453,22 +455,161 @@ void dgn_record_veto(const dgn_veto_exception &e)
 
 }
 
-static bool _build_level_vetoable(bool enable_random_maps)
+// How many times the stages after the layout may be retried from the
+// checkpoint before the whole level is thrown away.
+#define BUILDER_CHECKPOINT_RETRIES 2
+
+// Vetoes to force on the stages after the layout, for testing; see
+// dgn_build_level_after_vetoes().
+static int _forced_vetoes = 0;
+
+// The level as it stands once the layout and primary vault are built. Most
+// vetoes come from the vaults, monsters and stairs placed after that, and
+// can be retried from here rather than from a blank level. Restoring it
+// draws nothing from the RNG, so a seed still builds the same level.
+struct builder_checkpoint
+{
+    // The level itself, written the way a save writes it.
+    vector<unsigned char> level;
+    // dgn.persist, likewise.
+    vector<unsigned char> lua_data;
+
+    // What the save rebuilds or leaves out.
+    FixedArray<int, GXM, GYM>          igrid;
+    FixedArray<tile_flavour, GXM, GYM> flv;
+    tile_flavour                       default_flavour;
+    vector<string>                     tile_names;
+    uint32_t                           level_state;
+
+    vector<vault_placement> temp_vaults;
+    unique_ptr<dungeon_colour_grid> colour_grid;
+    int zones;
+    string branch_epilogue;
+
+    set<string> uniq_map_tags;
+    set<string> uniq_map_names;
+    unique_creature_list unique_creatures;
+    FixedVector<unique_item_status_type, MAX_UNRANDARTS> unique_items;
+    set<misc_item_type> generated_misc;
+    mid_t last_mid;
+    vector<god_type> temple_altars;
+    CrawlHashTable *temple_hash;
+#ifdef DEBUG_STATISTICS
+    vector<string> all_vaults;
+#endif
+};
+
+static bool _level_has_ghosts()
+{
+    for (const monster &mons : env.mons)
+        if (mons.type == MONS_PLAYER_GHOST)
+            return true;
+    return false;
+}
+
+static unique_ptr<builder_checkpoint> _take_builder_checkpoint()
 {
+    // Ghosts come out of the bones files as they are placed; putting one
+    // back on every retry would duplicate it.
+    if (_level_has_ghosts())
+        return nullptr;
+
+    unique_ptr<builder_checkpoint> cp(new builder_checkpoint);
+    {
+        writer th(&cp->level);
+        tag_write_unfinished_level(th);
+    }
+    {
+        writer th(&cp->lua_data);
+        if (!dlua.callfn("dgn_save_data", "u", &th))
+        {
+            mprf(MSGCH_ERROR, "Failed to save Lua data: %s",
+                 dlua.error.c_str());
+            return nullptr;
+        }
+    }
+
+    cp->igrid           = env.igrid;
+    cp->flv             = tile_env.flv;
+    cp->default_flavour = tile_env.default_flavour;
+    cp->tile_names      = tile_env.names;
+    cp->level_state     = env.level_state;
+
+    cp->temp_vaults = Temp_Vaults;
+    if (dgn_colour_grid)
+        cp->colour_grid.reset(new dungeon_colour_grid(*dgn_colour_grid));
+    cp->zones           = dgn_zones;
+    cp->branch_epilogue = branch_epilogues[you.where_are_you];
+
+    cp->uniq_map_tags    = get_uniq_map_tags();
+    cp->uniq_map_names   = get_uniq_map_names();
+    cp->unique_creatures = you.unique_creatures;
+    cp->unique_items     = you.unique_items;
+    cp->generated_misc   = you.generated_misc;
+    cp->last_mid         = you.last_mid;
+    cp->temple_altars    = _temple_altar_list;
+    cp->temple_hash      = _current_temple_hash;
 #ifdef DEBUG_STATISTICS
-    mapstat_report_map_build_start();
+    cp->all_vaults = _you_all_vault_list;
 #endif
+    return cp;
+}
 
-    dgn_reset_level(enable_random_maps);
+static void _restore_builder_checkpoint(const builder_checkpoint &cp)
+{
+    {
+        reader th(cp.level, TAG_MINOR_VERSION);
+        tag_read_unfinished_level(th);
+    }
+    {
+        reader th(cp.lua_data, TAG_MINOR_VERSION);
+        if (!dlua.callfn("dgn_load_data", "u", &th))
+        {
+            mprf(MSGCH_ERROR, "Failed to load Lua persist table: %s",
+                 dlua.error.c_str());
+        }
+    }
 
-    if (player_in_branch(BRANCH_TEMPLE))
-        _setup_temple_altars(you.props);
+    // The items are read back with their links; relinking them would
+    // reorder the stacks.
+    env.igrid                = cp.igrid;
+    tile_env.flv             = cp.flv;
+    tile_env.default_flavour = cp.default_flavour;
+    tile_env.names           = cp.tile_names;
+    env.level_state          = cp.level_state;
 
-    crawl_state.last_builder_error = "";
+    Temp_Vaults = cp.temp_vaults;
+    dgn_colour_grid.reset(cp.colour_grid
+                          ? new dungeon_colour_grid(*cp.colour_grid)
+                          : nullptr);
+    clear_subvault_stack();
+    dgn_zones = cp.zones;
+    dgn_check_connectivity = false;
+    branch_epilogues[you.where_are_you] = cp.branch_epilogue;
+
+    get_uniq_map_tags()  = cp.uniq_map_tags;
+    get_uniq_map_names() = cp.uniq_map_names;
+    you.unique_creatures = cp.unique_creatures;
+    you.unique_items     = cp.unique_items;
+    you.generated_misc   = cp.generated_misc;
+    you.last_mid         = cp.last_mid;
+    _temple_altar_list   = cp.temple_altars;
+    _current_temple_hash = cp.temple_hash;
+#ifdef DEBUG_STATISTICS
+    _you_all_vault_list = cp.all_vaults;
+#endif
+
+    // Any listeners belonged to markers that are gone now.
+    dungeon_events.clear();
+    update_portal_entrances();
+}
 
+// Everything after the layout; returns false on a veto.
+static bool _build_level_features(bool place_vaults)
+{
     try
     {
-        _build_dungeon_level();
+        _build_dungeon_features(place_vaults);
     }
     catch (dgn_veto_exception& e)
     {
@@ -488,6 +629,68 @@ static bool _build_level_vetoable(bool enable_random_maps)
         return false;
     }
 
+    return true;
+}
+
+static bool _build_level_vetoable(bool enable_random_maps)
+{
+#ifdef DEBUG_STATISTICS
+    mapstat_report_map_build_start();
+#endif
+
+    dgn_reset_level(enable_random_maps);
+
+    if (player_in_branch(BRANCH_TEMPLE))
+        _setup_temple_altars(you.props);
+
+    crawl_state.last_builder_error = "";
+
+    bool place_vaults;
+    try
+    {
+        place_vaults = _build_dungeon_layout();
+    }
+    catch (dgn_veto_exception& e)
+    {
+        dgn_record_veto(e);
+
+        // try not to lose any ghosts that have been placed
+        save_ghosts(ghost_demon::find_ghosts(false), false);
+        return false;
+    }
+
+    unique_ptr<builder_checkpoint> checkpoint = _take_builder_checkpoint();
+    // A forced veto goes back to the RNG state of the checkpoint too, so
+    // that the level should come out as though it had been built once.
+    CrawlVector rng_state;
+    if (_forced_vetoes > 0)
+        rng_state = rng::generators_to_vector();
+    int retries = BUILDER_CHECKPOINT_RETRIES;
+    while (true)
+    {
+        const bool built = _build_level_features(place_vaults);
+        if (_forced_vetoes > 0 && checkpoint)
+        {
+            --_forced_vetoes;
+            _restore_builder_checkpoint(*checkpoint);
+            rng::load_generators(rng_state);
+        }
+        else if (built)
+            break;
+        // The layout itself may be at fault, so don't retry it forever.
+        else if (!checkpoint || retries-- <= 0)
+            return false;
+        else
+        {
+            dprf(DIAG_DNGN, "Retrying the level from its layout.");
+            _restore_builder_checkpoint(*checkpoint);
+        }
+        crawl_state.last_builder_error = "";
+#ifdef DEBUG_STATISTICS
+        mapstat_report_map_build_start();
+#endif
+    }
+
 #ifdef DEBUG_MONS_SCAN
     // If debug_mons_scan() finds a problem while crawl_state.generating_level is
     // still true then it will announce that a problem was caused
@@ -540,6 +743,21 @@ static bool _build_level_vetoable(bool enable_random_maps)
     return true;
 }
 
+/**
+ * Build the current level, throwing away the stages after the layout the
+ * given number of times as though they had been vetoed. Each retry starts
+ * from the checkpoint with the RNG as it was when that was taken, so the
+ * level should come out the same as from builder().
+ *
+ * @param vetoes how many times to throw away the stages after the layout.
+ * @return whether the level was built.
+ */
+bool dgn_build_level_after_vetoes(int vetoes)
+{
+    unwind_var<int> forced(_forced_vetoes, vetoes);
+    return builder();
+}
+
 // Things that are bugs where we want to assert rather than to sweep it under
 // the rug with a veto.
 static void _builder_assertions()
@@ -952,54 +1170,109 @@ static bool _dgn_square_is_ever_passable(const coord_def &c)
     return _dgn_square_is_passable(c);
 }
 
-static inline void _dgn_point_record_stub(const coord_def &) { }
-
-template <class point_record>
-static bool _dgn_fill_zone(
-    const coord_def &start, int zone,
-    point_record &record_point,
-    bool (*passable)(const coord_def &) = _dgn_square_is_passable,
-    bool (*iswanted)(const coord_def &) = nullptr)
+// One connected zone of the level, as found by _dgn_label_zones().
+struct dgn_zone
 {
-    bool ret = false;
-    list<coord_def> points[2];
-    int cur = 0;
-    int found_points = 0;
+    int size = 0;
+    bool wanted = false;   // Some square in it satisfies iswanted.
+    bool in_vault = false; // Some square in it is part of a vault.
+};
 
-    // No bounds checks, assuming the level has at least one layer of
-    // rock border.
+// For each passable square, the index of another square in its zone, or -1
+// for impassable squares. Following the chain ends at the zone's first
+// square in scan order.
+static int _zone_parent[GXM * GYM];
 
-    for (points[cur].push_back(start); !points[cur].empty();)
+static int _zone_root(int i)
+{
+    while (_zone_parent[i] != i)
     {
-        for (const auto &c : points[cur])
+        _zone_parent[i] = _zone_parent[_zone_parent[i]];
+        i = _zone_parent[i];
+    }
+    return i;
+}
+
+static void _zone_join(int a, int b)
+{
+    a = _zone_root(a);
+    b = _zone_root(b);
+    if (a < b)
+        _zone_parent[b] = a;
+    else if (b < a)
+        _zone_parent[a] = b;
+}
+
+// Label the zones of mutually reachable passable squares in
+// travel_point_distance, leaving 0 on impassable squares. Zones are
+// numbered from 1 in the order that a scan of the rows reaches them, and
+// described in zones[number - 1]. Returns the number of zones.
+//
+// The first scan joins each passable square to the neighbours already
+// scanned (west, and the three to the north); the second numbers the zones
+// and gathers their sizes. This touches each square twice, where a flood
+// fill from every unlabelled square had to queue each one.
+static int _dgn_label_zones(vector<dgn_zone> &zones,
+                            bool (*passable)(const coord_def &),
+                            bool (*iswanted)(const coord_def &) = nullptr)
+{
+    for (int y = 0; y < GYM; ++y)
+        for (int x = 0; x < GXM; ++x)
         {
-            travel_point_distance[c.x][c.y] = zone;
-            found_points++;
+            const int i = y * GXM + x;
+            if (!passable(coord_def(x, y)))
+            {
+                _zone_parent[i] = -1;
+                continue;
+            }
 
-            if (iswanted && iswanted(c))
-                ret = true;
+            _zone_parent[i] = i;
+            if (x > 0 && _zone_parent[i - 1] >= 0)
+                _zone_join(i, i - 1);
+            if (y == 0)
+                continue;
+            for (int dx = -1; dx <= 1; ++dx)
+            {
+                const int j = i - GXM + dx;
+                if (x + dx >= 0 && x + dx < GXM && _zone_parent[j] >= 0)
+                    _zone_join(i, j);
+            }
+        }
 
-            for (adjacent_iterator ai(c); ai; ++ai)
+    zones.clear();
+    for (int y = 0; y < GYM; ++y)
+        for (int x = 0; x < GXM; ++x)
+        {
+            const int i = y * GXM + x;
+            if (_zone_parent[i] < 0)
             {
-                const coord_def& cp = *ai;
-                if (!map_bounds(cp)
-                    || travel_point_distance[cp.x][cp.y] || !passable(cp))
-                {
-                    continue;
-                }
+                travel_point_distance[x][y] = 0;
+                continue;
+            }
 
-                travel_point_distance[cp.x][cp.y] = zone;
-                record_point(cp);
-                points[!cur].push_back(cp);
+            // A zone's root is its first square, so it is already numbered.
+            const int root = _zone_root(i);
+            if (root == i)
+            {
+                zones.emplace_back();
+                travel_point_distance[x][y] = zones.size();
             }
+            else
+            {
+                travel_point_distance[x][y] =
+                    travel_point_distance[root % GXM][root / GXM];
+            }
+
+            const coord_def c(x, y);
+            dgn_zone &zone = zones[travel_point_distance[x][y] - 1];
+            zone.size++;
+            if (iswanted && iswanted(c))
+                zone.wanted = true;
+            if (map_masked(c, MMT_VAULT))
+                zone.in_vault = true;
         }
 
-        points[cur].clear();
-        cur = !cur;
-    }
-    dprf("Zone %d contains %d points from seed %d,%d", zone, found_points,
-        start.x, start.y);
-    return ret;
+    return zones.size();
 }
 
 static bool _is_perm_down_stair(const coord_def &c)
@@ -1106,94 +1379,79 @@ static bool _is_exit_stair(const coord_def &c)
 // If fill is non-zero, it fills any disconnected regions with fill.
 //
 // TODO: refactor this to something more usable
-static int _process_disconnected_zones(int x1, int y1, int x2, int y2,
-                bool choose_stairless,
+static int _process_disconnected_zones(bool choose_stairless,
                 dungeon_feature_type fill,
                 bool (*passable)(const coord_def &) = _dgn_square_is_passable,
                 bool (*fill_check)(const coord_def &) = nullptr,
                 int fill_small_zones = 0)
 {
-    memset(travel_point_distance, 0, sizeof(travel_distance_grid_t));
-    int nzones = 0;
+    vector<dgn_zone> zones;
+    const int nzones = _dgn_label_zones(zones, passable,
+                           choose_stairless ? (at_branch_bottom() ?
+                                               _is_upwards_exit_stair :
+                                               _is_exit_stair) : nullptr);
+
+    vector<bool> chosen(nzones, false);
+    bool filling = false;
     int ngood = 0;
-    for (int y = y1; y <= y2 ; ++y)
+    for (int i = 0; i < nzones; ++i)
+    {
+        // If we want only stairless zones, screen out zones that did
+        // have stairs.
+        if (choose_stairless && zones[i].wanted)
+            ++ngood;
+        // Don't fill in areas connected to vaults.
+        // We want vaults to be accessible; if the area is disconnected
+        // from the rest of the level, this will cause the level to be
+        // vetoed later on.
+        else if (fill && !zones[i].in_vault
+                 && (fill_small_zones <= 0
+                     || zones[i].size <= fill_small_zones))
+        {
+            chosen[i] = true;
+            filling = true;
+        }
+    }
+
+    if (!filling)
+        return nzones - ngood;
+
+    // The squares to fill, by zone, gathered in one pass over the level.
+    vector<vector<coord_def>> fills(nzones);
+    for (rectangle_iterator ri(0); ri; ++ri)
     {
-        for (int x = x1; x <= x2; ++x)
+        const int zone = travel_point_distance[ri->x][ri->y];
+        if (zone && chosen[zone - 1] && (!fill_check || fill_check(*ri)))
         {
-            if (!map_bounds(x, y)
-                || travel_point_distance[x][y]
-                || !passable(coord_def(x, y)))
+            fills[zone - 1].push_back(*ri);
+        }
+    }
+
+    for (int i = 0; i < nzones; ++i)
+    {
+        if (!chosen[i])
+            continue;
+
+        dprf("Filling zone %d", i + 1);
+        for (auto c : fills[i])
+        {
+            // For normal builder scenarios items shouldn't be
+            // placed yet, but it could (if not careful) happen
+            // in weirder cases, such as the abyss.
+            if (env.igrid(c) != NON_ITEM
+                && (!feat_is_traversable(fill)
+                    || feat_destroys_items(fill)))
             {
-                continue;
+                // Alternatively, could place floor instead?
+                dprf("Nuke item stack at (%d, %d)", c.x, c.y);
+                lose_item_stack(c);
             }
-
-            int zone_size = 0;
-            auto inc_zone_size = [&zone_size](const coord_def &) { zone_size++; };
-
-            const bool found_exit_stair =
-                _dgn_fill_zone(coord_def(x, y), ++nzones,
-                               inc_zone_size,
-                               passable,
-                               choose_stairless ? (at_branch_bottom() ?
-                                                   _is_upwards_exit_stair :
-                                                   _is_exit_stair) : nullptr);
-
-            // If we want only stairless zones, screen out zones that did
-            // have stairs.
-            if (choose_stairless && found_exit_stair)
-                ++ngood;
-            else if (fill
-                && (fill_small_zones <= 0 || zone_size <= fill_small_zones))
+            _set_grd(c, fill);
+            if (env.mgrid(c) != NON_MONSTER
+                && !env.mons[env.mgrid(c)].is_habitable_feat(fill))
             {
-                // Don't fill in areas connected to vaults.
-                // We want vaults to be accessible; if the area is disconnected
-                // from the rest of the level, this will cause the level to be
-                // vetoed later on.
-                bool veto = false;
-                vector<coord_def> coords;
-                dprf("Filling zone %d", nzones);
-                for (int fy = y1; fy <= y2 ; ++fy)
-                {
-                    for (int fx = x1; fx <= x2; ++fx)
-                    {
-                        if (travel_point_distance[fx][fy] == nzones)
-                        {
-                            if (map_masked(coord_def(fx, fy), MMT_VAULT))
-                            {
-                                veto = true;
-                                break;
-                            }
-                            else if (!fill_check || fill_check(coord_def(fx, fy)))
-                                coords.emplace_back(fx, fy);
-                        }
-                    }
-                    if (veto)
-                        break;
-                }
-                if (!veto)
-                {
-                    for (auto c : coords)
-                    {
-                        // For normal builder scenarios items shouldn't be
-                        // placed yet, but it could (if not careful) happen
-                        // in weirder cases, such as the abyss.
-                        if (env.igrid(c) != NON_ITEM
-                            && (!feat_is_traversable(fill)
-                                || feat_destroys_items(fill)))
-                        {
-                            // Alternatively, could place floor instead?
-                            dprf("Nuke item stack at (%d, %d)", c.x, c.y);
-                            lose_item_stack(c);
-                        }
-                        _set_grd(c, fill);
-                        if (env.mgrid(c) != NON_MONSTER
-                            && !env.mons[env.mgrid(c)].is_habitable_feat(fill))
-                        {
-                            monster_die(env.mons[env.mgrid(c)],
-                                        KILL_RESET, NON_MONSTER, true);
-                        }
-                    }
-                }
+                monster_die(env.mons[env.mgrid(c)],
+                            KILL_RESET, NON_MONSTER, true);
             }
         }
     }
@@ -1204,8 +1462,8 @@ static int _process_disconnected_zones(int x1, int y1, int x2, int y2,
 int dgn_count_tele_zones(bool choose_stairless)
 {
     dprf("Counting teleport zones");
-    return _process_disconnected_zones(0, 0, GXM-1, GYM-1, choose_stairless,
-                                    DNGN_UNSEEN, _dgn_square_is_tele_connected);
+    return _process_disconnected_zones(choose_stairless, DNGN_UNSEEN,
+                                       _dgn_square_is_tele_connected);
 }
 
 // Count number of mutually isolated zones. If choose_stairless, only count
@@ -1214,8 +1472,7 @@ int dgn_count_tele_zones(bool choose_stairless)
 int dgn_count_disconnected_zones(bool choose_stairless,
                                  dungeon_feature_type fill)
 {
-    return _process_disconnected_zones(0, 0, GXM-1, GYM-1, choose_stairless,
-                                       fill);
+    return _process_disconnected_zones(choose_stairless, fill);
 }
 
 static void _fill_small_disconnected_zones()
@@ -1223,10 +1480,10 @@ static void _fill_small_disconnected_zones()
     // debugging tip: change the feature to something like lava that will be
     // very noticeable.
     // TODO: make even more aggressive, up to ~25?
-    _process_disconnected_zones(0, 0, GXM-1, GYM-1, true, DNGN_ROCK_WALL,
-                                       _dgn_square_is_passable,
-                                       _dgn_square_is_boring,
-                                       10);
+    _process_disconnected_zones(true, DNGN_ROCK_WALL,
+                                _dgn_square_is_passable,
+                                _dgn_square_is_boring,
+                                10);
 }
 
 static void _fixup_hell_stairs()
@@ -2152,88 +2409,77 @@ static bool _fixup_stone_stairs(bool preserve_vault_stairs)
 static bool _add_feat_if_missing(bool (*iswanted)(const coord_def &),
                                  dungeon_feature_type feat)
 {
-    memset(travel_point_distance, 0, sizeof(travel_distance_grid_t));
-    int nzones = 0;
-    for (int y = 0; y < GYM; ++y)
-        for (int x = 0; x < GXM; ++x)
-        {
-            // [ds] Use dgn_square_is_passable instead of
-            // dgn_square_travel_ok here, for we'll otherwise
-            // fail on floorless isolated pocket in vaults (like the
-            // altar surrounded by deep water), and trigger the assert
-            // downstairs.
-            const coord_def gc(x, y);
-            if (!map_bounds(x, y)
-                || travel_point_distance[x][y] // already covered previously
-                || !_dgn_square_is_passable(gc))
-            {
-                continue;
-            }
+    // [ds] Use dgn_square_is_passable instead of
+    // dgn_square_travel_ok here, for we'll otherwise
+    // fail on floorless isolated pocket in vaults (like the
+    // altar surrounded by deep water), and trigger the assert
+    // downstairs.
+    vector<dgn_zone> zones;
+    const int nzones = _dgn_label_zones(zones, _dgn_square_is_passable,
+                                        iswanted);
+    for (int zone = 1; zone <= nzones; ++zone)
+    {
+        if (zones[zone - 1].wanted)
+            continue;
 
-            if (_dgn_fill_zone(gc, ++nzones, _dgn_point_record_stub,
-                               _dgn_square_is_passable, iswanted))
+        bool found_feature = false;
+        for (rectangle_iterator ri(0); ri; ++ri)
+        {
+            if (env.grid(*ri) == feat
+                && travel_point_distance[ri->x][ri->y] == zone)
             {
-                continue;
+                found_feature = true;
+                break;
             }
+        }
 
-            bool found_feature = false;
-            for (rectangle_iterator ri(0); ri; ++ri)
-            {
-                if (env.grid(*ri) == feat
-                    && travel_point_distance[ri->x][ri->y] == nzones)
-                {
-                    found_feature = true;
-                    break;
-                }
-            }
+        if (found_feature)
+            continue;
 
-            if (found_feature)
+        int i = 0;
+        while (i++ < 2000)
+        {
+            coord_def rnd;
+            rnd.x = random2(GXM);
+            rnd.y = random2(GYM);
+            if (env.grid(rnd) != DNGN_FLOOR)
                 continue;
 
-            int i = 0;
-            while (i++ < 2000)
-            {
-                coord_def rnd;
-                rnd.x = random2(GXM);
-                rnd.y = random2(GYM);
-                if (env.grid(rnd) != DNGN_FLOOR)
-                    continue;
+            if (travel_point_distance[rnd.x][rnd.y] != zone)
+                continue;
 
-                if (travel_point_distance[rnd.x][rnd.y] != nzones)
-                    continue;
+            _set_grd(rnd, feat);
+            found_feature = true;
+            break;
+        }
 
-                _set_grd(rnd, feat);
-                found_feature = true;
-                break;
-            }
+        if (found_feature)
+            continue;
 
-            if (found_feature)
+        for (rectangle_iterator ri(0); ri; ++ri)
+        {
+            if (env.grid(*ri) != DNGN_FLOOR)
                 continue;
 
-            for (rectangle_iterator ri(0); ri; ++ri)
-            {
-                if (env.grid(*ri) != DNGN_FLOOR)
-                    continue;
-
-                if (travel_point_distance[ri->x][ri->y] != nzones)
-                    continue;
+            if (travel_point_distance[ri->x][ri->y] != zone)
+                continue;
 
-                _set_grd(*ri, feat);
-                found_feature = true;
-                break;
-            }
+            _set_grd(*ri, feat);
+            found_feature = true;
+            break;
+        }
 
-            if (found_feature)
-                continue;
+        if (found_feature)
+            continue;
 
 #ifdef DEBUG_DIAGNOSTICS
-            dump_map("debug.map", true, true);
+        dump_map("debug.map", true, true);
 #endif
-            // [ds] Too many normal cases trigger this ASSERT, including
-            // rivers that surround a stair with deep water.
-            // die("Couldn't find region.");
-            return false;
-        }
+        // [ds] Too many normal cases trigger this ASSERT, including
+        // rivers that surround a stair with deep water.
+        // die("Couldn't find region.");
+        return false;
+    }
 
     return true;
 }
@@ -2711,19 +2957,25 @@ static void _post_vault_build()
     }
 }
 
-static void _build_dungeon_level()
+// Build the layout and any primary vault; returns whether further vaults
+// may be placed.
+static bool _build_dungeon_layout()
 {
     bool place_vaults = _builder_by_type();
 
     if (player_in_branch(BRANCH_SLIME))
         _slime_connectivity_fixup();
 
-    // Now place items, mons, gates, etc.
-    // Stairs must exist by this point (except in Shoals where they are
-    // yet to be placed). Some items and monsters already exist.
-
     _check_doors();
 
+    return place_vaults;
+}
+
+// Now place items, mons, gates, etc.
+// Stairs must exist by this point (except in Shoals where they are
+// yet to be placed). Some items and monsters already exist.
+static void _build_dungeon_features(bool place_vaults)
+{
     const unsigned nvaults = env.level_vaults.size();
 
     // Any further vaults must make sure not to disrupt level layout.
@@ -4624,13 +4876,13 @@ static const vault_placement *_build_vault_impl(const map_def *vault,
     if (!build_only && (placed_vault_orientation != MAP_ENCOMPASS || is_layout)
         && player_in_branch(BRANCH_SWAMP))
     {
-        _process_disconnected_zones(0, 0, GXM-1, GYM-1, true, DNGN_MANGROVE);
+        _process_disconnected_zones(true, DNGN_MANGROVE);
         // do a second pass to remove tele closets consisting of deep water
         // created by the first pass -- which will not fill in deep water
         // because it is treated as impassable.
         // TODO: get zonify to prevent these?
         // TODO: does this come up anywhere outside of swamp?
-        _process_disconnected_zones(0, 0, GXM-1, GYM-1, true, DNGN_MANGROVE,
+        _process_disconnected_zones(true, DNGN_MANGROVE,
                 _dgn_square_is_ever_passable);
     }
 
@@ -6970,20 +7222,8 @@ static bool _fixup_interlevel_connectivity()
     has_down[0] = has_down[1] = has_down[2] = false;
 
     // Find up stairs and down stairs on the current level.
-    memset(travel_point_distance, 0, sizeof(travel_distance_grid_t));
-    int nzones = 0;
-    for (rectangle_iterator ri(0); ri; ++ri)
-    {
-        if (!map_bounds(ri->x, ri->y)
-            || travel_point_distance[ri->x][ri->y]
-            || !dgn_square_travel_ok(*ri))
-        {
-            continue;
-        }
-
-        _dgn_fill_zone(*ri, ++nzones, _dgn_point_record_stub,
-                       dgn_square_travel_ok, nullptr);
-    }
+    vector<dgn_zone> zones;
+    _dgn_label_zones(zones, dgn_square_travel_ok);
 
     int max_region = 0;
     for (rectangle_iterator ri(0); ri; ++ri)
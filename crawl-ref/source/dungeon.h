@@ -203,6 +203,8 @@ void read_level_connectivity(reader &th);
 void write_level_connectivity(writer &th);
 
 bool builder(bool enable_random_maps = true);
+/* Public for testing purposes only: do not use elsewhere. */
+bool dgn_build_level_after_vetoes(int vetoes);
 
 int dgn_builder_x();
 int dgn_builder_y();
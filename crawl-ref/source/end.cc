@@ -24,7 +24,6 @@
 #include "initfile.h"
 #include "invent.h"
 #include "item-prop.h"
-#include "los.h"
 #include "macro.h"
 #include "message.h"
 #include "misc.h"
@@ -86,7 +85,6 @@ void cio_cleanup()
 // Clear some globally defined variables.
 static void _clear_globals_on_exit()
 {
-    clear_rays_on_exit();
     clear_zap_info_on_exit();
     destroy_abyss();
 }
@@ -9,6 +9,7 @@
 #include "fprop.h"
 #include "map-cell.h"
 #include "mapmark.h"
+#include "mon-index.h"
 #include "monster.h"
 #include "shopping.h"
 #include "trap-def.h"
@@ -102,6 +103,9 @@ struct crawl_environment
     // Mapping mid->mindex until the transition is finished.
     map<mid_t, unsigned short> mid_cache;
 
+    // Which monster slots are in use, and where their monsters are.
+    monster_index mon_index;
+
     // Things to happen when the current attack/etc finishes.
     vector<final_effect *> final_effects;
     // Copies of monsters cached so they can be looked up during a final_effect
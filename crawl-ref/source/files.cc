@@ -20,6 +20,7 @@
 #include <algorithm>
 #include <cctype>
 #include <cerrno>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -62,6 +63,7 @@
 #include "items.h"
 #include "jobs.h"
 #include "kills.h"
+#include "level-cache.h"
 #include "level-state-type.h"
 #include "libutil.h"
 #include "macro.h"
@@ -137,6 +139,8 @@ static void _ghost_dprf(const char *format, ...)
 
 static bool _ghost_version_compatible(const save_version &version);
 
+static bool _read_tagged_chunk(reader &inf, const string &name,
+                               tag_type tag, const char* complaint);
 static bool _restore_tagged_chunk(package *save, const string &name,
                                   tag_type tag, const char* complaint);
 static player_save_info _read_character_info(package *save);
@@ -1041,14 +1045,41 @@ void write_ghost_version(writer &outf)
         marshallInt(outf, 0);
 }
 
-static void _write_tagged_chunk(const string &chunkname, tag_type tag)
+static void _write_tagged_chunk(const string &chunkname, tag_type tag,
+                                chunk_codec codec = CODEC_ZLIB)
 {
-    writer outf(you.save, chunkname);
+    writer outf(you.save, chunkname, codec);
 
     write_save_version(outf, save_version::current());
     tag_write(tag, outf);
 }
 
+static level_cache &_level_cache()
+{
+    static level_cache cache;
+    return cache;
+}
+
+// The tiles chunk as last read or written, and its name.
+static pair<string, vector<unsigned char>> &_last_level_tiles()
+{
+    static pair<string, vector<unsigned char>> tiles;
+    return tiles;
+}
+
+// Drop the levels of any earlier game; call when you.save is replaced.
+void forget_cached_levels()
+{
+    _level_cache().clear();
+    _last_level_tiles().first.clear();
+    _last_level_tiles().second.clear();
+}
+
+static string _level_tiles_chunk(const string &level_name)
+{
+    return level_name + ".tiles";
+}
+
 static int _get_dest_stair_type(dungeon_feature_type stair_taken,
                                 bool &find_first)
 {
@@ -1790,8 +1821,7 @@ bool generate_level(const level_id &l)
         // the level generated before the portals.
         ASSERT(you.save->has_chunk(save_name));
         dprf("Reloading new level '%s'.", save_name.c_str());
-        _restore_tagged_chunk(you.save, save_name, TAG_LEVEL,
-            "Level file is invalid.");
+        restore_level(save_name);
     }
     // Did the generation process actually manage to place the player? This is
     // a useful sanity check, and also is necessary for the initial loading
@@ -1968,6 +1998,11 @@ bool pregen_dungeon(const level_id &stopping_point)
             // (save chunk existence is checked above, so isn't relevant here)
             if (!generate_level(new_level))
                 return false; // level failed to generate -- bail immediately
+
+            // With async_save, compress and write this level in the
+            // background while the next one is being built. It becomes
+            // part of the save at the next commit, as usual.
+            you.save->flush();
         }
 
         return true;
@@ -2204,7 +2239,7 @@ bool load_level(dungeon_feature_type stair_taken, load_mode_type load_mode,
         }
 
         dprf("Loading old level '%s'.", level_name.c_str());
-        _restore_tagged_chunk(you.save, level_name, TAG_LEVEL, "Level file is invalid.");
+        restore_level(level_name);
         if (load_mode != LOAD_VISITOR)
             you.on_current_level = true;
         _redraw_all(); // TODO why is there a redraw call here?
@@ -2504,6 +2539,98 @@ bool load_level(dungeon_feature_type stair_taken, load_mode_type load_mode,
     return just_created_level;
 }
 
+// Tiles (mostly flavour) make up much of a level, but hardly ever change
+// once it has been built. So they are saved in a chunk of their own, which
+// is only rewritten if they differ from what was last read from or written
+// to it: comparing costs far less than compressing them again.
+static void _save_level_tiles(const string &level_name)
+{
+    const string name = _level_tiles_chunk(level_name);
+    vector<unsigned char> tiles;
+    {
+        writer outf(&tiles);
+        write_save_version(outf, save_version::current());
+        tag_write(TAG_LEVEL_TILES, outf);
+    }
+
+    if (Options.level_cache_size > 0)
+    {
+        _level_cache().insert(name, vector<unsigned char>(tiles),
+                              (size_t)Options.level_cache_size * 1024);
+    }
+    else
+        _level_cache().erase(name);
+
+    auto &last = _last_level_tiles();
+    if (last.first == name && last.second == tiles
+        && you.save->has_chunk(name))
+    {
+        return;
+    }
+
+    {
+        writer outf(you.save, name, CODEC_ZLIB_FAST);
+        outf.write(tiles.data(), tiles.size());
+    }
+    last.first = name;
+    last.second = move(tiles);
+}
+
+// Levels saved before TAG_MINOR_LEVEL_TILES_CHUNK have their tiles in
+// the level chunk, and none of their own. Call after reading the level.
+static void _restore_level_tiles(const string &level_name)
+{
+    auto &last = _last_level_tiles();
+    last.first = _level_tiles_chunk(level_name);
+    if (const vector<unsigned char> *cached = _level_cache().find(last.first))
+        last.second = *cached;
+    else if (you.save->has_chunk(last.first))
+    {
+        vector<char> buf;
+        chunk_reader inf(you.save, last.first);
+        inf.read_all(buf);
+        last.second.assign(buf.begin(), buf.end());
+    }
+    else
+    {
+        last.first.clear();
+        last.second.clear();
+#if TAG_MAJOR_VERSION == 34
+        if (crawl_state.minor_version < TAG_MINOR_LEVEL_TILES_CHUNK)
+            return;
+#endif
+        // The chunk has gone missing. Rather than keep the flavour of the
+        // last level, give this one a fresh set, as for a new level.
+        tile_env.names.clear();
+        tile_clear_flavour();
+        tile_init_default_flavour();
+        tile_new_level(true, false);
+        return;
+    }
+
+    reader inf(last.second);
+    _read_tagged_chunk(inf, last.first, TAG_LEVEL_TILES,
+                       "Level file is invalid.");
+}
+
+// Read a level written by save_level() into env and tile_env, from the
+// level cache if it's there. load_level() does the rest of arriving there.
+void restore_level(const string &level_name)
+{
+    if (const vector<unsigned char> *cached = _level_cache().find(level_name))
+    {
+        reader inf(*cached);
+        _read_tagged_chunk(inf, level_name, TAG_LEVEL,
+                           "Level file is invalid.");
+    }
+    else
+    {
+        _restore_tagged_chunk(you.save, level_name, TAG_LEVEL,
+                              "Level file is invalid.");
+    }
+    _restore_level_tiles(level_name);
+}
+
 void save_level(const level_id& lid)
 {
     if (you.level_visited(lid))
@@ -2512,7 +2639,31 @@ void save_level(const level_id& lid)
     // Nail all items to the ground.
     fix_item_coordinates();
 
-    _write_tagged_chunk(lid.describe(), TAG_LEVEL);
+    // Levels are the bulk of the save and are rewritten on every level
+    // change, so trade a little size for speed.
+    const string name = lid.describe();
+    if (Options.level_cache_size <= 0)
+    {
+        _level_cache().erase(name);
+        _write_tagged_chunk(name, TAG_LEVEL, CODEC_ZLIB_FAST);
+    }
+    else
+    {
+        // Serialize the level once, for both the save and the cache.
+        vector<unsigned char> level;
+        {
+            writer outf(&level);
+            write_save_version(outf, save_version::current());
+            tag_write(TAG_LEVEL, outf);
+        }
+        {
+            writer outf(you.save, name, CODEC_ZLIB_FAST);
+            outf.write(level.data(), level.size());
+        }
+        _level_cache().insert(name, move(level),
+                              (size_t)Options.level_cache_size * 1024);
+    }
+    _save_level_tiles(name);
 }
 
 #if TAG_MAJOR_VERSION == 34
@@ -2678,64 +2829,6 @@ static string _make_ghost_filename(bool store=false)
     return string("bones.") + (store ? "store." : "") + level_desc;
 }
 
-static string _bones_permastore_file()
-{
-    string filename = _make_ghost_filename(true);
-    string full_path = _get_bonefile_directory() + filename;
-    if (file_exists(full_path))
-        return full_path;
-
-    string dist_full_path = datafile_path(
-            string("dist_bones") + FILE_SEPARATOR + filename, false, false);
-    if (dist_full_path.empty())
-        return dist_full_path;
-
-    // no matching permastore is in the player's bones file, but one exists in
-    // the crawl distribution. Install it.
-
-    FILE *src = fopen_u(dist_full_path.c_str(), "rb");
-    if (!src)
-    {
-        mprf(MSGCH_ERROR, "Bones file exists but can't be opened: %s",
-            dist_full_path.c_str());
-        return "";
-    }
-    FILE *target = lk_open("wb", full_path);
-    if (!target)
-    {
-        mprf(MSGCH_ERROR, "Unable to open bones file %s for writing",
-            full_path.c_str());
-        fclose(src);
-        return "";
-    }
-
-    _ghost_dprf("Copying %s to %s", dist_full_path.c_str(), full_path.c_str());
-
-    char buf[BUFSIZ];
-
-    size_t size;
-    while ((size = fread(buf, sizeof(char), BUFSIZ, src)) > 0)
-        fwrite(buf, sizeof(char), size, target);
-
-    lk_close(target);
-
-    if (!feof(src))
-    {
-        mprf(MSGCH_ERROR, "Error installing bones file to %s",
-                                                    full_path.c_str());
-        if (unlink(full_path.c_str()) != 0)
-        {
-            mprf(MSGCH_ERROR,
-                "Failed to unlink probably corrupt bones file: %s",
-                full_path.c_str());
-        }
-        fclose(src);
-        return "";
-    }
-    fclose(src);
-    return full_path;
-}
-
 // Bones files
 //
 // There are two kinds of bones files: temporary bones files and the
@@ -2744,28 +2837,41 @@ static string _bones_permastore_file()
 // permanent stock of ghosts (per level) to use as a backup in case the
 // temporary bones files are depleted.
 
+/**
+ * The path of a temporary bones file for the current level. Each level has
+ * GHOST_LIMIT of these, numbered from 0.
+ */
+static string _bones_slot_filename(int slot)
+{
+    return make_stringf("%s%s_%d", _get_bonefile_directory().c_str(),
+                        _make_ghost_filename().c_str(), slot);
+}
+
 /**
  * Lists all bonefiles for the current level.
  *
+ * This looks for each numbered file, rather than listing the bones
+ * directory: on a busy server that holds the files of every level, and
+ * this is done whenever a level is built. Bones files are only ever saved
+ * under these names.
+ *
  * @return A vector containing absolute paths to 0+ bonefiles.
  */
-static vector<string> _list_bones()
+vector<string> list_bones()
 {
-    string bonefile_dir = _get_bonefile_directory();
-    string base_filename = _make_ghost_filename();
-    string underscored_filename = base_filename + "_";
-
-    vector<string> filenames = get_dir_files_sorted(bonefile_dir);
     vector<string> bonefiles;
-    for (const auto &filename : filenames)
-        if (starts_with(filename, underscored_filename)
-                                            && !ends_with(filename, ".backup"))
+    for (int i = 0; i < GHOST_LIMIT; i++)
+    {
+        const string filename = _bones_slot_filename(i);
+        if (file_exists(filename))
         {
-            bonefiles.push_back(bonefile_dir + filename);
-            _ghost_dprf("bonesfile %s", (bonefile_dir + filename).c_str());
+            bonefiles.push_back(filename);
+            _ghost_dprf("bonesfile %s", filename.c_str());
         }
+    }
 
-    string old_bonefile = _get_old_bonefile_directory() + base_filename;
+    string old_bonefile = _get_old_bonefile_directory()
+                          + _make_ghost_filename();
     if (access(old_bonefile.c_str(), F_OK) == 0)
     {
         _ghost_dprf("Found old bonefile %s", old_bonefile.c_str());
@@ -2782,7 +2888,7 @@ static vector<string> _list_bones()
  */
 static string _find_ghost_file()
 {
-    vector<string> bonefiles = _list_bones();
+    vector<string> bonefiles = list_bones();
     if (bonefiles.empty())
         return "";
     return bonefiles[random2(bonefiles.size())];
@@ -3009,9 +3115,383 @@ static vector<ghost_demon> _load_ephemeral_ghosts()
     return results;
 }
 
-static vector<ghost_demon> _load_permastore_ghosts(bool backup_on_upgrade=false)
+// The permastore
+//
+// Each level's permastore is a file of ghost records that is only ever
+// appended to, and a small index of the records in use. Picking a ghost
+// reads the index and one record; storing one appends a record and rewrites
+// the index. Both hold the lock on the index only for that long. Records
+// that have been replaced stay in the file until it has been appended to
+// often enough to be worth compacting.
+
+#define GHOST_PERMASTORE_SIZE 10
+#define GHOST_PERMASTORE_REPLACE_CHANCE 5
+// Bump this on any incompatible change to the index.
+#define GHOST_PERMASTORE_INDEX_FORMAT 1
+// Compact the records once this many have been appended per slot.
+#define GHOST_PERMASTORE_COMPACT_RATIO 4
+
+struct permastore_index
+{
+    // The offset of each slot's record, or -1 if the slot is empty.
+    vector<int> records;
+    // How many records have been appended since the last compaction.
+    int appended = 0;
+};
+
+static size_t _ghost_permastore_size()
+{
+    if (_bones_save_individual_levels(true))
+        return GHOST_PERMASTORE_SIZE;
+    else
+        return GHOST_PERMASTORE_SIZE * 2;
+}
+
+/**
+ * The path of the current level's permastore, without the suffix of its
+ * index or records. The path itself is that of the whole-file permastore
+ * of older versions.
+ */
+static string _permastore_base()
+{
+    return _get_bonefile_directory() + _make_ghost_filename(true);
+}
+
+// Open a file for reading and writing, creating it if need be, and lock it.
+static FILE *_lk_open_update(const string &file)
+{
+    int fd = open_u(file.c_str(), O_RDWR|O_BINARY|O_CREAT, 0666);
+    if (fd < 0)
+        return nullptr;
+
+    if (!lock_file(fd, true))
+    {
+        mprf(MSGCH_ERROR, "ERROR: Could not lock file %s", file.c_str());
+        close(fd);
+        return nullptr;
+    }
+
+    return fdopen(fd, "r+b");
+}
+
+/**
+ * Read a permastore index.
+ *
+ * @param fp     The open index.
+ * @param index  The index read; empty slots if the file is empty.
+ * @param fresh  Set to whether the file was empty.
+ * @return       Whether the index could be read.
+ */
+static bool _read_permastore_index(FILE *fp, permastore_index &index,
+                                   bool &fresh)
+{
+    index = permastore_index();
+    fseek(fp, 0, SEEK_END);
+    fresh = ftell(fp) <= 0;
+    rewind(fp);
+    if (!fresh)
+    {
+        reader inf(fp);
+        inf.set_safe_read(true);
+        try
+        {
+            if (unmarshallInt(inf) != GHOST_PERMASTORE_INDEX_FORMAT)
+                return false;
+            const int slots = unmarshallInt(inf);
+            if (slots < 0 || slots > GHOST_PERMASTORE_SIZE * 2)
+                return false;
+            index.appended = unmarshallInt(inf);
+            for (int i = 0; i < slots; i++)
+                index.records.push_back(unmarshallInt(inf));
+        }
+        catch (short_read_exception &E)
+        {
+            return false;
+        }
+    }
+    index.records.resize(_ghost_permastore_size(), -1);
+    return true;
+}
+
+static bool _write_permastore_index(FILE *fp, const permastore_index &index)
+{
+    vector<unsigned char> buf;
+    writer outw(&buf);
+    marshallInt(outw, GHOST_PERMASTORE_INDEX_FORMAT);
+    marshallInt(outw, index.records.size());
+    marshallInt(outw, index.appended);
+    for (int offset : index.records)
+        marshallInt(outw, offset);
+
+    rewind(fp);
+    return fwrite(buf.data(), 1, buf.size(), fp) == buf.size()
+           && !fflush(fp);
+}
+
+// Read the bytes of the record at offset, without its length.
+static bool _read_permastore_record_bytes(FILE *rec, int offset,
+                                          vector<unsigned char> &buf)
+{
+    if (offset < 0 || fseek(rec, offset, SEEK_SET))
+        return false;
+
+    reader inf(rec);
+    inf.set_safe_read(true);
+    try
+    {
+        const int size = unmarshallInt(inf);
+        // A record holds one ghost.
+        if (size <= 0 || size > 1 << 20)
+            return false;
+        buf.resize(size);
+        inf.read(buf.data(), buf.size());
+    }
+    catch (short_read_exception &E)
+    {
+        return false;
+    }
+    return true;
+}
+
+static vector<ghost_demon> _read_permastore_record(FILE *rec, int offset)
+{
+    vector<ghost_demon> result;
+    vector<unsigned char> buf;
+    if (!_read_permastore_record_bytes(rec, offset, buf))
+        return result;
+
+    reader inf(buf);
+    inf.set_safe_read(true);
+    const save_version version = read_ghost_header(inf);
+    if (!_ghost_version_compatible(version))
+        return result;
+    inf.setMinorVersion(version.minor);
+
+    try
+    {
+        result = tag_read_ghosts(inf);
+    }
+    catch (short_read_exception &E)
+    {
+        result.clear();
+    }
+    if (!debug_check_ghosts(result))
+        result.clear();
+    return result;
+}
+
+/**
+ * Append a record of one ghost to the end of a permastore.
+ *
+ * @return The offset of the record, or -1 if it couldn't be written.
+ */
+static int _append_permastore_record(FILE *rec, const ghost_demon &ghost)
+{
+    vector<unsigned char> ghost_buf;
+    {
+        writer outw(&ghost_buf);
+        write_ghost_version(outw);
+        tag_write_ghosts(outw, { ghost });
+    }
+    vector<unsigned char> buf;
+    writer outw(&buf);
+    marshallInt(outw, ghost_buf.size());
+    outw.write(ghost_buf.data(), ghost_buf.size());
+
+    if (fseek(rec, 0, SEEK_END))
+        return -1;
+    const long offset = ftell(rec);
+    if (offset < 0 || offset > INT_MAX - (long)buf.size())
+        return -1;
+    if (fwrite(buf.data(), 1, buf.size(), rec) != buf.size())
+        return -1;
+    return offset;
+}
+
+/**
+ * Rewrite a permastore's records without the ones no longer in use. The
+ * index must be locked for writing.
+ */
+static void _compact_permastore(const string &base, permastore_index &index)
+{
+    const string rec_file = base + ".rec";
+    FILE *rec = fopen_u(rec_file.c_str(), "rb");
+    if (!rec)
+        return;
+
+    vector<unsigned char> records;
+    writer outw(&records);
+    permastore_index compacted = index;
+    compacted.appended = 0;
+    for (int &offset : compacted.records)
+    {
+        vector<unsigned char> buf;
+        if (!_read_permastore_record_bytes(rec, offset, buf))
+        {
+            offset = -1;
+            continue;
+        }
+        offset = records.size();
+        marshallInt(outw, buf.size());
+        outw.write(buf.data(), buf.size());
+        compacted.appended++;
+    }
+    fclose(rec);
+
+    const string tmp = make_stringf("%s.%d.tmp", rec_file.c_str(),
+                                    process_id());
+    FILE *out = fopen_u(tmp.c_str(), "wb");
+    bool ok = out && fwrite(records.data(), 1, records.size(), out)
+                     == records.size();
+    if (out)
+        ok = !fclose(out) && ok;
+    if (ok)
+        ok = !rename_u(tmp.c_str(), rec_file.c_str());
+    if (!ok)
+    {
+        unlink_u(tmp.c_str());
+        _ghost_dprf("Could not compact ghost permastore %s",
+                    rec_file.c_str());
+        return;
+    }
+
+    _ghost_dprf("Compacted ghost permastore %s to %u bytes",
+                rec_file.c_str(), (unsigned int) records.size());
+    index = compacted;
+}
+
+/**
+ * Fill a new permastore from the current level's whole-file permastore,
+ * either one left in the bones directory by an older version or one
+ * distributed with the game. The one in the bones directory is removed
+ * once its ghosts are in the new store.
+ */
+static void _import_old_permastore(const string &base, permastore_index &index)
+{
+    string old_file = base;
+    const bool installed = file_exists(old_file);
+    if (!installed)
+    {
+        old_file = datafile_path(string("dist_bones") + FILE_SEPARATOR
+                                 + _make_ghost_filename(true), false, false);
+    }
+    if (old_file.empty())
+        return;
+
+    vector<ghost_demon> ghosts;
+    try
+    {
+        ghosts = load_bones_file(old_file, false);
+    }
+    catch (corrupted_save &err)
+    {
+        mprf(MSGCH_ERROR, "%s", err.what());
+        return;
+    }
+
+    FILE *rec = fopen_u((base + ".rec").c_str(), "ab");
+    if (!rec)
+        return;
+    unsigned int imported = 0;
+    for (int &offset : index.records)
+    {
+        if (imported >= ghosts.size())
+            break;
+        offset = _append_permastore_record(rec, ghosts[imported]);
+        if (offset < 0)
+            break;
+        imported++;
+    }
+    const bool ok = !fclose(rec) && imported == min(ghosts.size(),
+                                                    index.records.size());
+    index.appended += imported;
+
+    _ghost_dprf("Imported %u ghosts from %s", imported, old_file.c_str());
+    if (ok && installed && unlink_u(old_file.c_str()) != 0)
+    {
+        mprf(MSGCH_ERROR, "Failed to unlink old bones file: %s",
+             old_file.c_str());
+    }
+}
+
+/**
+ * Open and lock the current level's permastore index, setting the store up
+ * if it's the first time the level has used it.
+ *
+ * @param base   The path from _permastore_base().
+ * @param index  The index read.
+ * @param write  Whether to lock the index for writing.
+ * @return       The locked index, to close with lk_close(); or nullptr.
+ */
+static FILE *_open_permastore(const string &base, permastore_index &index,
+                              bool write)
+{
+    const string idx_file = base + ".idx";
+    // Setting the store up needs the write lock.
+    if (!file_exists(idx_file))
+        write = true;
+
+    FILE *idx = write ? _lk_open_update(idx_file) : lk_open("rb", idx_file);
+    if (!idx)
+        return nullptr;
+
+    bool fresh;
+    if (!_read_permastore_index(idx, index, fresh))
+    {
+        _ghost_dprf("Unknown ghost permastore index: %s", idx_file.c_str());
+        lk_close(idx);
+        return nullptr;
+    }
+    if (fresh && write)
+    {
+        _import_old_permastore(base, index);
+        if (!_write_permastore_index(idx, index))
+        {
+            mprf(MSGCH_ERROR, "Unable to write ghost permastore index: %s",
+                 idx_file.c_str());
+        }
+    }
+    return idx;
+}
+
+/**
+ * Load one ghost, chosen at random, from the current level's permastore.
+ *
+ * @return The ghost, or nothing if the store is empty.
+ */
+vector<ghost_demon> load_permastore_ghost()
 {
-    return _load_ghosts_core(_bones_permastore_file(), backup_on_upgrade);
+    const string base = _permastore_base();
+    permastore_index index;
+    FILE *idx = _open_permastore(base, index, false);
+    if (!idx)
+        return {};
+
+    vector<int> offsets;
+    for (int offset : index.records)
+        if (offset >= 0)
+            offsets.push_back(offset);
+    shuffle_array(offsets);
+
+    vector<ghost_demon> result;
+    if (!offsets.empty())
+    {
+        if (FILE *rec = fopen_u((base + ".rec").c_str(), "rb"))
+        {
+            // Skip any record this version can't read.
+            for (int offset : offsets)
+            {
+                result = _read_permastore_record(rec, offset);
+                if (!result.empty())
+                    break;
+                _ghost_dprf("Skipping unreadable ghost at %d in %s.rec",
+                            offset, base.c_str());
+            }
+            fclose(rec);
+        }
+    }
+    lk_close(idx);
+    return result;
 }
 
 /**
@@ -3030,7 +3510,7 @@ bool define_ghost_from_bones(monster& mons)
     vector<ghost_demon> loaded_ghosts = _load_ephemeral_ghosts();
     if (loaded_ghosts.empty())
     {
-        loaded_ghosts = _load_permastore_ghosts();
+        loaded_ghosts = load_permastore_ghost();
         if (loaded_ghosts.empty())
             return false;
         used_permastore = true;
@@ -3231,6 +3711,10 @@ static bool _restore_game(const string& filename)
         }
     }
     you.init_from_save_info(save_info);
+    if (Options.async_save)
+        you.save->set_async();
+    you.save->set_compact_slack(Options.save_compact_slack);
+    forget_cached_levels();
 
     you.on_current_level = false; // we aren't on the current level until
                                   // everything is fully loaded
@@ -3322,6 +3806,211 @@ bool restore_game(const string& filename)
     }
 }
 
+// How to load a chunk of the save into the game and save it back, for
+// bench_save(). Chunks with neither are only read.
+struct bench_chunk_io
+{
+    function<void(reader &)> load;
+    function<void(writer &)> save;
+    // The codec the game saves the chunk with; CODEC_ZLIB unless set.
+    chunk_codec codec;
+};
+
+static bench_chunk_io _bench_tagged_chunk(const string &name, tag_type tag)
+{
+    return {
+        [name, tag](reader &inf)
+        {
+            _read_tagged_chunk(inf, name, tag, "Save data is invalid.");
+        },
+        [tag](writer &outf)
+        {
+            write_save_version(outf, save_version::current());
+            tag_write(tag, outf);
+        }
+    };
+}
+
+static bench_chunk_io _bench_chunk_io(const string &name)
+{
+    if (name == "you")
+        return _bench_tagged_chunk(name, TAG_YOU);
+    if (name == CHUNK("st", "stashes"))
+    {
+        return { [](reader &inf) { StashTrack.load(inf); },
+                 [](writer &outf) { StashTrack.save(outf); } };
+    }
+    if (name == CHUNK("kil", "kills"))
+    {
+        return { [](reader &inf) { you.kills.load(inf); },
+                 [](writer &outf) { you.kills.save(outf); } };
+    }
+    if (name == CHUNK("tc", "travel_cache"))
+    {
+        return { [](reader &inf)
+                 {
+                     travel_cache.load(inf, crawl_state.minor_version);
+                 },
+                 [](writer &outf) { travel_cache.save(outf); } };
+    }
+    if (name == CHUNK("nts", "notes"))
+    {
+        return { [](reader &inf) { note_list.clear(); load_notes(inf); },
+                 save_notes };
+    }
+    if (name == CHUNK("tut", "tutorial"))
+        return { load_hints, save_hints };
+    if (name == CHUNK("msg", "messages"))
+    {
+        return { [](reader &inf) { clear_message_store(); load_messages(inf); },
+                 save_messages };
+    }
+
+    // Anything else is a level or its tiles, or only read.
+    const bool tiles = ends_with(name, ".tiles");
+    level_id lid;
+    try
+    {
+        lid = level_id::parse_level_id(
+            tiles ? name.substr(0, name.length() - strlen(".tiles")) : name);
+    }
+    catch (const bad_level_id &)
+    {
+        return {};
+    }
+    bench_chunk_io level = _bench_tagged_chunk(name, tiles ? TAG_LEVEL_TILES
+                                                           : TAG_LEVEL);
+    // As in save_level().
+    level.codec = CODEC_ZLIB_FAST;
+    const function<void(reader &)> load = level.load;
+    level.load = [lid, load](reader &inf)
+    {
+        you.where_are_you = lid.branch;
+        you.depth = lid.depth;
+        load(inf);
+    };
+    return level;
+}
+
+/**
+ * Time reading, loading, saving and compressing each chunk of a save, and
+ * print the average times and the chunk sizes. The save is only read;
+ * compressing is done into a scratch package next to it.
+ *
+ * "you" is loaded first, since other chunks depend on it; levels are
+ * followed by their tiles.
+ *
+ * @param name The save's filename, or the character's name.
+ */
+NORETURN void bench_save(const string &name)
+{
+    const int rounds = 10;
+    typedef chrono::steady_clock clock;
+    const auto ms_per_round = [](clock::time_point start)
+    {
+        return chrono::duration<double, milli>(clock::now() - start).count()
+               / rounds;
+    };
+
+    try
+    {
+        string filename = name;
+        // Check for the exact filename first, then go by char name.
+        if (!file_exists(filename))
+            filename = get_savedir_filename(filename);
+        package save(filename.c_str(), false);
+        package scratch((filename + ".bench").c_str(), true, true);
+
+        vector<string> chunks = save.list_chunks();
+        sort(chunks.begin(), chunks.end(), [](const string &a, const string &b)
+             {
+                 return a == "you" ? b != "you"
+                      : b == "you" ? false
+                                   : numcmpstr(a, b);
+             });
+
+        printf("%d rounds of each; times in ms per round, sizes in bytes.\n",
+               rounds);
+        printf("%-16s %9s %9s %9s %9s %9s %9s %9s\n", "chunk", "raw",
+               "packed", "resaved", "read", "load", "save", "pack");
+        double total_ms[4] = { 0, 0, 0, 0 };
+        plen_t total_raw = 0, total_packed = 0;
+        for (const string &chunk : chunks)
+        {
+            const bench_chunk_io io = _bench_chunk_io(chunk);
+            double ms[4] = { 0, 0, 0, 0 };
+
+            // Reading and decompressing.
+            vector<char> raw;
+            clock::time_point start = clock::now();
+            for (int i = 0; i < rounds; ++i)
+            {
+                chunk_reader inc(&save, chunk);
+                raw.clear();
+                inc.read_all(raw);
+            }
+            ms[0] = ms_per_round(start);
+            const vector<unsigned char> data(raw.begin(), raw.end());
+
+            if (io.load)
+            {
+                start = clock::now();
+                for (int i = 0; i < rounds; ++i)
+                {
+                    reader inf(data, crawl_state.minor_version);
+                    io.load(inf);
+                }
+                ms[1] = ms_per_round(start);
+            }
+
+            vector<unsigned char> resaved;
+            if (io.save)
+            {
+                start = clock::now();
+                for (int i = 0; i < rounds; ++i)
+                {
+                    resaved.clear();
+                    writer outf(&resaved);
+                    io.save(outf);
+                }
+                ms[2] = ms_per_round(start);
+            }
+
+            // Compressing and writing, with the codec the game saves the
+            // chunk with.
+            const vector<unsigned char> &packing = io.save ? resaved : data;
+            start = clock::now();
+            for (int i = 0; i < rounds; ++i)
+            {
+                chunk_writer outc(&scratch, chunk, io.codec);
+                if (!packing.empty())
+                    outc.write(&packing[0], packing.size());
+            }
+            ms[3] = ms_per_round(start);
+
+            const plen_t packed = save.get_chunk_compressed_length(chunk);
+            printf("%-16s %9u %9u %9u %9.3f %9.3f %9.3f %9.3f\n",
+                   chunk.c_str(), (unsigned int)data.size(), packed,
+                   (unsigned int)packing.size(), ms[0], ms[1], ms[2], ms[3]);
+            for (int i = 0; i < 4; ++i)
+                total_ms[i] += ms[i];
+            total_raw += data.size();
+            total_packed += packed;
+        }
+        printf("%-16s %9u %9u %9s %9.3f %9.3f %9.3f %9.3f\n", "total",
+               total_raw, total_packed, "", total_ms[0], total_ms[1],
+               total_ms[2], total_ms[3]);
+
+        scratch.unlink();
+    }
+    catch (ext_fail_exception &fe)
+    {
+        fprintf(stderr, "Error: %s\n", fe.what());
+        end(1);
+    }
+    end(0);
+}
+
 static void _load_level(const level_id &level)
 {
     // Load the given level.
@@ -3350,7 +4039,12 @@ void delete_level(const level_id &level)
     clear_level_annotations(level);
 
     if (you.save)
+    {
         you.save->delete_chunk(level.describe());
+        you.save->delete_chunk(_level_tiles_chunk(level.describe()));
+    }
+    _level_cache().erase(level.describe());
+    _level_cache().erase(_level_tiles_chunk(level.describe()));
 
     auto &visited = you.props[VISITED_LEVELS_KEY].get_table();
     visited.erase(level.describe());
@@ -3626,10 +4320,9 @@ static bool _tagged_chunk_version_compatible(reader &inf, string* reason)
     return true;
 }
 
-static bool _restore_tagged_chunk(package *save, const string &name,
-                                  tag_type tag, const char* complaint)
+static bool _read_tagged_chunk(reader &inf, const string &name,
+                               tag_type tag, const char* complaint)
 {
-    reader inf(save, name);
     string reason;
     if (!_tagged_chunk_version_compatible(inf, &reason))
     {
@@ -3656,6 +4349,13 @@ static bool _restore_tagged_chunk(package *save, const string &name,
     return true;
 }
 
+static bool _restore_tagged_chunk(package *save, const string &name,
+                                  tag_type tag, const char* complaint)
+{
+    reader inf(save, name);
+    return _read_tagged_chunk(inf, name, tag, complaint);
+}
+
 static bool _ghost_version_compatible(const save_version &version)
 {
     if (!version.valid())
@@ -3678,13 +4378,9 @@ static bool _ghost_version_compatible(const save_version &version)
  **/
 static FILE* _make_bones_file(string * return_gfilename)
 {
-    const string bone_dir = _get_bonefile_directory();
-    const string base_filename = _make_ghost_filename(false);
-
     for (int i = 0; i < GHOST_LIMIT; i++)
     {
-        const string g_file_name = make_stringf("%s%s_%d", bone_dir.c_str(),
-                                                base_filename.c_str(), i);
+        const string g_file_name = _bones_slot_filename(i);
         FILE *ghost_file = lk_open_exclusive(g_file_name);
         // need to check file size, so can't open 'wb' - would truncate!
 
@@ -3703,15 +4399,14 @@ static FILE* _make_bones_file(string * return_gfilename)
     return nullptr;
 }
 
-#define GHOST_PERMASTORE_SIZE 10
-#define GHOST_PERMASTORE_REPLACE_CHANCE 5
-
-static size_t _ghost_permastore_size()
+static ghost_demon _permastore_ghost(const ghost_demon &ghost)
 {
-    if (_bones_save_individual_levels(true))
-        return GHOST_PERMASTORE_SIZE;
-    else
-        return GHOST_PERMASTORE_SIZE * 2;
+    ghost_demon stored = ghost;
+#ifdef DGAMELAUNCH
+    // randomize name for online play
+    stored.name = make_name();
+#endif
+    return stored;
 }
 
 static vector<ghost_demon> _update_permastore(const vector<ghost_demon> &ghosts)
@@ -3720,82 +4415,78 @@ static vector<ghost_demon> _update_permastore(const vector<ghost_demon> &ghosts)
     if (ghosts.empty())
         return ghosts;
 
-    // this read is not locked...
-    vector<ghost_demon> permastore = _load_permastore_ghosts();
-    vector<ghost_demon> leftovers;
+    const string base = _permastore_base();
+    permastore_index index;
+    FILE *idx = _open_permastore(base, index, true);
+    if (!idx)
+    {
+        // this will fail silently if the lock fails, seems safest
+        _ghost_dprf("Could not open ghost permastore: %s", base.c_str());
+        return ghosts;
+    }
+    FILE *rec = fopen_u((base + ".rec").c_str(), "ab");
+    if (!rec)
+    {
+        _ghost_dprf("Could not open ghost permastore: %s.rec", base.c_str());
+        lk_close(idx);
+        return ghosts;
+    }
 
-    bool rewrite = false;
+    // TODO: heuristics to make this as distinct as possible; maybe
+    // create a new name?
     unsigned int i = 0;
-    const size_t max_ghosts = _ghost_permastore_size();
-    while (permastore.size() < max_ghosts && i < ghosts.size())
+    int appended = 0;
+    for (int &offset : index.records)
     {
-        // TODO: heuristics to make this as distinct as possible; maybe
-        // create a new name?
-        permastore.push_back(ghosts[i]);
-#ifdef DGAMELAUNCH
-        // randomize name for online play
-        permastore.back().name = make_name();
-#endif
+        if (i >= ghosts.size())
+            break;
+        if (offset >= 0)
+            continue;
+        offset = _append_permastore_record(rec, _permastore_ghost(ghosts[i]));
+        if (offset < 0)
+            break;
         i++;
-        rewrite = true;
+        appended++;
     }
     if (i > 0)
         _ghost_dprf("Permastoring %d ghosts", i);
-    if (!rewrite && x_chance_in_y(GHOST_PERMASTORE_REPLACE_CHANCE, 100)
+    if (!appended && x_chance_in_y(GHOST_PERMASTORE_REPLACE_CHANCE, 100)
                                                         && i < ghosts.size())
     {
-        int rewrite_i = random2(permastore.size());
-        permastore[rewrite_i] = ghosts[i];
-#ifdef DGAMELAUNCH
-        permastore[rewrite_i].name = make_name();
-#endif
-        rewrite = true;
-    }
-    while (i < ghosts.size())
-    {
-        leftovers.push_back(ghosts[i]);
-        i++;
+        const int offset = _append_permastore_record(rec,
+                                            _permastore_ghost(ghosts[i]));
+        if (offset >= 0)
+        {
+            index.records[random2(index.records.size())] = offset;
+            appended++;
+        }
     }
 
-    if (rewrite)
+    // The records must be written before the index points at them.
+    if (fclose(rec))
+        i = appended = 0;
+    if (appended)
     {
-        string permastore_file = _bones_permastore_file();
-
-        // the following is to ensure that an old game doesn't overwrite a
-        // permastore that has a version in the future relative to that game.
+        index.appended += appended;
+        if (index.appended >= GHOST_PERMASTORE_COMPACT_RATIO
+                              * (int) index.records.size())
         {
-            reader inf(permastore_file);
-            if (inf.valid())
-            {
-                inf.set_safe_read(true); // don't die on 0-byte bones
-                save_version version = read_ghost_header(inf);
-                if (version.valid() && version.is_future())
-                {
-                    permastore_file = _old_bones_filename(permastore_file,
-                                                    save_version::current());
-                }
-                inf.close();
-            }
+            _compact_permastore(base, index);
         }
-
-        FILE *ghost_file = lk_open("wb", permastore_file);
-
-        if (!ghost_file)
+        _ghost_dprf("Updating ghost permastore %s.idx", base.c_str());
+        if (!_write_permastore_index(idx, index))
         {
-            // this will fail silently if the lock fails, seems safest
-            // TODO: better lock system for servers?
-            _ghost_dprf("Could not open ghost permastore: %s",
-                                                    permastore_file.c_str());
-            return ghosts;
+            mprf(MSGCH_ERROR, "Unable to write ghost permastore index: %s.idx",
+                 base.c_str());
         }
+    }
+    lk_close(idx);
 
-        _ghost_dprf("Rewriting ghost permastore %s with %u ghosts",
-                    permastore_file.c_str(), (unsigned int) permastore.size());
-        writer outw(permastore_file, ghost_file);
-        write_ghost_version(outw);
-        tag_write_ghosts(outw, permastore);
-
-        lk_close(ghost_file);
+    vector<ghost_demon> leftovers;
+    while (i < ghosts.size())
+    {
+        leftovers.push_back(ghosts[i]);
+        i++;
     }
     return leftovers;
 }
@@ -3834,18 +4525,14 @@ void save_ghosts(const vector<ghost_demon> &ghosts, bool force, bool use_store)
     if (leftovers.size() == 0)
         return;
 
-    if (_list_bones().size() >= static_cast<size_t>(GHOST_LIMIT))
-    {
-        _ghost_dprf("Too many ghosts for this level already!");
-        return;
-    }
-
+    // This fails if every bones file of the level is taken.
     string g_file_name = "";
     FILE* ghost_file = _make_bones_file(&g_file_name);
 
     if (!ghost_file)
     {
-        _ghost_dprf("Could not open file to save ghosts.");
+        _ghost_dprf("Too many ghosts for this level already, or could not "
+                    "open file to save ghosts.");
         return;
     }
 
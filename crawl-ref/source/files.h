@@ -72,6 +72,7 @@ bool check_mkdir(const string &what, string *dir, bool silent = false);
 vector<player_save_info> find_all_saved_characters();
 
 NORETURN void print_save_json(const char *name);
+NORETURN void bench_save(const string &name);
 
 string get_save_filename(const string &name);
 string get_savedir_filename(const string &name);
@@ -95,6 +96,8 @@ bool load_level(dungeon_feature_type stair_taken, load_mode_type load_mode,
                 const level_id& old_level);
 void delete_level(const level_id &level);
 void save_level(const level_id& lid);
+void restore_level(const string &level_name);
+void forget_cached_levels();
 
 void save_game(bool leave_game, const char *bye = nullptr);
 
@@ -138,6 +141,8 @@ void save_ghosts(const vector<ghost_demon> &ghosts, bool force = false,
 bool load_ghosts(int max_ghosts, bool creating_level);
 bool define_ghost_from_bones(monster& mons);
 vector<ghost_demon> load_bones_file(string ghost_filename, bool backup=false);
+vector<string> list_bones();
+vector<ghost_demon> load_permastore_ghost();
 void write_ghost_version(writer &outf);
 save_version read_ghost_header(reader &inf);
 
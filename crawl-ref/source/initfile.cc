@@ -572,6 +572,9 @@ const vector<GameOption*> game_options::build_options_list()
             [this]() { update_travel_terrain(); }),
         new BoolGameOption(SIMPLE_NAME(travel_one_unsafe_move), false),
         new BoolGameOption(SIMPLE_NAME(dump_on_save), true),
+        new BoolGameOption(SIMPLE_NAME(async_save), false),
+        new IntGameOption(SIMPLE_NAME(level_cache_size), 0, 0),
+        new IntGameOption(SIMPLE_NAME(save_compact_slack), 0, 0, 100),
         new BoolGameOption(SIMPLE_NAME(rest_wait_both), false),
         new BoolGameOption(SIMPLE_NAME(rest_wait_ancestor), false),
         new BoolGameOption(SIMPLE_NAME(cloud_status), !is_tiles()),
@@ -4585,6 +4588,7 @@ enum commandline_option_type
     CLO_OBJSTAT,
     CLO_ITERATIONS,
     CLO_FORCE_MAP,
+    CLO_JOBS,
     CLO_ARENA,
     CLO_DUMP_MAPS,
     CLO_TEST,
@@ -4626,6 +4630,7 @@ enum commandline_option_type
     CLO_PRINT_WEBTILES_OPTIONS,
 #endif
     CLO_RESET_CACHE,
+    CLO_BENCH_SAVE,
 
     CLO_NOPS
 };
@@ -4636,6 +4641,7 @@ static set<commandline_option_type> clo_headless_ok = {
     CLO_SCORES,
     CLO_BUILDDB,
     CLO_RESET_CACHE,
+    CLO_BENCH_SAVE,
     CLO_HELP,
     CLO_VERSION,
     CLO_PLAYABLE_JSON, // JSON metadata for species, jobs, combos.
@@ -4664,9 +4670,9 @@ static const char *cmd_ops[] =
 {
     "scores", "name", "species", "background", "dir", "rc", "rcdir", "tscores",
     "vscores", "scorefile", "morgue", "macro", "mapstat", "dump-disconnect",
-    "objstat", "iters", "force-map", "arena", "dump-maps", "test", "script",
-    "builddb", "help", "version", "seed", "pregen", "save-version", "sprint",
-    "extra-opt-first", "extra-opt-last", "sprint-map", "edit-save",
+    "objstat", "iters", "force-map", "jobs", "arena", "dump-maps", "test",
+    "script", "builddb", "help", "version", "seed", "pregen", "save-version",
+    "sprint", "extra-opt-first", "extra-opt-last", "sprint-map", "edit-save",
     "print-charset", "tutorial", "wizard", "explore", "no-save",
     "no-player-bones", "gdb", "no-gdb", "nogdb", "throttle", "no-throttle",
     "lua-max-memory", "playable-json", "branches-json", "save-json",
@@ -4677,7 +4683,7 @@ static const char *cmd_ops[] =
 #ifdef USE_TILE_WEB
     "webtiles-socket", "await-connection", "print-webtiles-options",
 #endif
-    "reset-cache",
+    "reset-cache", "bench-save",
 };
 
 
@@ -4806,7 +4812,7 @@ static edit_command<es_command_type> es_commands[] =
     { ES_GET,     "get",     false, 1, 2, },
     { ES_PUT,     "put",     true,  1, 2, },
     { ES_RM,      "rm",      true,  1, 1, },
-    { ES_REPACK,  "repack",  false, 0, 0, },
+    { ES_REPACK,  "repack",  true,  0, 0, },
     { ES_INFO,    "info",    false, 0, 0, },
 };
 
@@ -4933,20 +4939,10 @@ static void _edit_save(int argc, char **argv)
         }
         else if (cmd == ES_REPACK)
         {
-            package save2((filename + ".tmp").c_str(), true, true);
-            for (const string &chunk : save.list_chunks())
-            {
-                char buf[16384];
-
-                chunk_reader in(&save, chunk);
-                chunk_writer out(&save2, chunk);
-
-                while (plen_t s = in.read(buf, sizeof(buf)))
-                    out.write(buf, s);
-            }
-            save2.commit();
-            save.unlink();
-            rename_u((filename + ".tmp").c_str(), filename.c_str());
+            const plen_t before = save.get_size();
+            if (!save.compact())
+                sysfail("Can't replace \"%s\"", filename.c_str());
+            printf("Repacked: %u -> %u bytes\n", before, save.get_size());
         }
         else if (cmd == ES_INFO)
         {
@@ -4956,7 +4952,8 @@ static void _edit_save(int argc, char **argv)
             plen_t frag = save.get_chunk_fragmentation("");
             plen_t flen = save.get_size();
             plen_t slack = save.get_slack();
-            printf("Chunks: (size compressed/uncompressed, fragments, name)\n");
+            printf("Chunks: (size compressed/uncompressed, fragments, codec, "
+                   "name)\n");
             for (const string &chunk : list)
             {
                 int cfrag = save.get_chunk_fragmentation(chunk);
@@ -4968,7 +4965,9 @@ static void _edit_save(int argc, char **argv)
                 plen_t clen = 0;
                 while (plen_t s = in.read(buf, sizeof(buf)))
                     clen += s;
-                printf("%7d/%7d %3u %s\n", cclen, clen, cfrag, chunk.c_str());
+                printf("%7d/%7d %3u %-9s %s\n", cclen, clen, cfrag,
+                       chunk_codec_name(save.get_chunk_codec(chunk)),
+                       chunk.c_str());
             }
             // the directory is not a chunk visible from the outside
             printf("Fragmentation:    %u/%u (%4.2f)\n", frag, nchunks + 1,
@@ -5496,6 +5495,7 @@ bool parse_args(int argc, char **argv, bool rc_only)
 
     SysEnv.rcdirs.clear();
     SysEnv.map_gen_iters = 0;
+    SysEnv.map_gen_jobs = 1;
 
     if (argc < 2)           // no args!
         return true;
@@ -5676,6 +5676,20 @@ bool parse_args(int argc, char **argv, bool rc_only)
 #endif
             break;
 
+        case CLO_JOBS:
+#ifdef DEBUG_STATISTICS
+            if (!next_is_param || !isadigit(*next_arg))
+                end(1, false, "Integer argument required for -%s\n", arg);
+            else
+            {
+                SysEnv.map_gen_jobs = max(1, atoi(next_arg));
+                nextUsed = true;
+            }
+#else
+            end(1, false, "%s", dbg_stat_err);
+#endif
+            break;
+
         case CLO_FORCE_MAP:
 #ifdef DEBUG_STATISTICS
             if (!next_is_param)
@@ -5779,6 +5793,14 @@ bool parse_args(int argc, char **argv, bool rc_only)
             crawl_state.use_des_cache = false;
             break;
 
+        case CLO_BENCH_SAVE:
+            if (!next_is_param)
+                return false;
+            crawl_state.bench_save = next_arg;
+            enter_headless_mode();
+            nextUsed = true;
+            break;
+
         case CLO_GDB:
             crawl_state.no_gdb = 0;
             break;
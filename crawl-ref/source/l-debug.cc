@@ -353,6 +353,7 @@ LUAFN(debug_viewwindow)
 }
 
 LUAWRAP(debug_seen_monsters_react, seen_monsters_react())
+LUAWRAP(debug_handle_monsters, handle_monsters())
 
 static const char* disablements[] =
 {
@@ -494,6 +495,7 @@ const struct luaL_reg debug_dlib[] =
 { "check_uniques", debug_check_uniques },
 { "viewwindow", debug_viewwindow },
 { "seen_monsters_react", debug_seen_monsters_react },
+{ "handle_monsters", debug_handle_monsters },
 { "disable", debug_disable },
 { "cpp_assert", debug_cpp_assert },
 { "reset_rng", debug_reset_rng },
@@ -0,0 +1,58 @@
+/**
+ * @file
+ * @brief Recently saved levels, kept in memory to speed up stair dancing.
+**/
+
+#include "AppHdr.h"
+
+#include "level-cache.h"
+
+const vector<unsigned char> *level_cache::find(const string &name)
+{
+    for (auto i = levels.begin(); i != levels.end(); ++i)
+    {
+        if (i->first != name)
+            continue;
+        levels.splice(levels.begin(), levels, i);
+        return &levels.front().second;
+    }
+    return nullptr;
+}
+
+void level_cache::insert(const string &name, vector<unsigned char> data,
+                         size_t capacity)
+{
+    erase(name);
+    used += data.size();
+    levels.emplace_front(name, move(data));
+    trim(capacity);
+}
+
+void level_cache::erase(const string &name)
+{
+    for (auto i = levels.begin(); i != levels.end(); ++i)
+    {
+        if (i->first != name)
+            continue;
+        used -= i->second.size();
+        levels.erase(i);
+        return;
+    }
+}
+
+void level_cache::clear()
+{
+    levels.clear();
+    used = 0;
+}
+
+// Drop levels until they fit, oldest first. A level too big to fit on its
+// own isn't kept at all.
+void level_cache::trim(size_t capacity)
+{
+    while (used > capacity)
+    {
+        used -= levels.back().second.size();
+        levels.pop_back();
+    }
+}
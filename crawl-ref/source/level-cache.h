@@ -0,0 +1,43 @@
+/**
+ * @file
+ * @brief Recently saved levels, kept in memory to speed up stair dancing.
+**/
+
+#pragma once
+
+#include <list>
+#include <string>
+#include <utility>
+#include <vector>
+
+using std::list;
+using std::pair;
+using std::string;
+using std::vector;
+
+// Serialized levels, uncompressed, by chunk name. Loading a level from here
+// skips reading and decompressing its chunk; the chunk itself is still
+// written to the save as usual. Once the levels take up more than the
+// capacity, the least recently used ones are dropped.
+class level_cache
+{
+public:
+    level_cache() : used(0) {}
+
+    // The level last stored under name, or nullptr.
+    const vector<unsigned char> *find(const string &name);
+    void insert(const string &name, vector<unsigned char> data,
+                size_t capacity);
+    void erase(const string &name);
+    void clear();
+
+    size_t size() const { return used; }
+
+private:
+    void trim(size_t capacity);
+
+private:
+    // Most recently used first.
+    list<pair<string, vector<unsigned char>>> levels;
+    size_t used;
+};
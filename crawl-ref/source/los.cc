@@ -52,8 +52,11 @@
 #include "coordit.h"
 #include "env.h"
 #include "losglobal.h"
+#include "mapped-file.h"
 #include "mon-act.h"
 #include "mpr.h"
+#include "stringutil.h"
+#include "syscalls.h"
 
 // These determine what rays are cast in the precomputation,
 // and affect start-up time significantly.
@@ -61,35 +64,138 @@
 #define LOS_MAX_ANGLE (2*LOS_MAX_RANGE-2)
 #define LOS_INTERCEPT_MULT (2)
 
+#define LOS_QUADRANT_CELLS ((LOS_MAX_RANGE+1) * (LOS_MAX_RANGE+1))
+
 // These store all unique (in terms of footprint) full rays.
 // The footprint of ray=fullray[i] consists of ray.length cells,
 // stored in ray_coords[ray.start..ray.length-1].
-// These are filled during precomputation (_register_ray).
-// XXX: fullrays is not needed anymore after precomputation.
+// These are filled during precomputation (_register_ray) and
+// thrown away once the tables below have been built.
 struct los_ray;
 static vector<los_ray> fullrays;
 static vector<coord_def> ray_coords;
 
-// These store all unique minimal cellrays. For each i,
-// cellray i ends in cellray_ends[i] and passes through
-// those cells p that have blockrays(p)[i] set. In other
-// words, blockrays(p)[i] is set iff an opaque cell p blocks
-// the cellray with index i.
-static vector<coord_def> cellray_ends;
-typedef FixedArray<bit_vector*, LOS_MAX_RANGE+1, LOS_MAX_RANGE+1> blockrays_t;
-static blockrays_t blockrays;
-
-// We also store the minimal cellrays by target position
-// for efficient retrieval by find_ray.
-// XXX: Consider condensing this representation.
-struct cellray;
-static FixedArray<vector<cellray>, LOS_MAX_RANGE+1, LOS_MAX_RANGE+1> min_cellrays;
+// Upper bound on the number of minimal cellrays; checked when
+// precomputing. (There are 428 with LOS_MAX_RANGE == 8.)
+#define LOS_MAX_CELLRAYS 512
+typedef AlignedBitVector<LOS_MAX_CELLRAYS> ray_bitset;
+typedef FixedArray<ray_bitset, LOS_MAX_RANGE+1, LOS_MAX_RANGE+1> blockrays_t;
+
+// The results of the precomputation live in one flat block of memory,
+// so that it can be written to the des cache and memory-mapped from
+// there by later processes (see init_los_tables()). The block is laid
+// out as:
+//   los_tables_header
+//   ray_bitset  blockrays[LOS_MAX_RANGE+1][LOS_MAX_RANGE+1]
+//   los_range   min_cellray_index[LOS_MAX_RANGE+1][LOS_MAX_RANGE+1]
+//   los_cellray min_cellrays[n_min_cellrays]
+//   coord_def   cellray_ends[n_cellray_ends]
+//   coord_def   ray_coords[n_ray_coords]
+//
+// All unique minimal cellrays are numbered. For each i, cellray i ends
+// in cellray_ends[i] and passes through those cells p that have
+// blockrays(p)[i] set. In other words, blockrays(p)[i] is set iff an
+// opaque cell p blocks the cellray with index i.
+//
+// We also store the minimal cellrays by target position for efficient
+// retrieval by find_ray: those ending in p are
+// min_cellrays[first..first+count-1] for min_cellray_index(p), sorted
+// best first.
+#define LOS_TABLES_MAGIC "CRAWLLOS"
+#define LOS_TABLES_FORMAT 1
+
+struct los_tables_header
+{
+    char magic[8];
+    uint32_t format;
+    // Everything the tables depend on, to detect stale cache files.
+    uint32_t byte_order;
+    uint32_t max_range;
+    uint32_t max_angle;
+    uint32_t intercept_mult;
+    uint32_t max_cellrays;
+    uint32_t size;
+    uint32_t n_min_cellrays;
+    uint32_t n_cellray_ends;
+    uint32_t n_ray_coords;
+};
+
+struct los_range
+{
+    uint32_t first;
+    uint32_t count;
+};
+
+// A minimal cellray: the ray, and the cells ray_coords[start..start+end]
+// it passes through.
+struct los_cellray
+{
+    double start_x, start_y;
+    double dir_x, dir_y;
+    uint32_t start;
+    uint32_t end;
+};
+
+// Byte offsets of the parts of the tables block.
+struct los_tables_layout
+{
+    size_t blockrays;
+    size_t min_cellray_index;
+    size_t min_cellrays;
+    size_t cellray_ends;
+    size_t ray_coords;
+    size_t size;
+
+    los_tables_layout(const los_tables_header &h)
+    {
+        COMPILE_CHECK(sizeof(blockrays_t)
+                      == sizeof(ray_bitset) * LOS_QUADRANT_CELLS);
+        blockrays = _align(sizeof(los_tables_header), alignof(ray_bitset));
+        min_cellray_index = blockrays + sizeof(blockrays_t);
+        min_cellrays = _align(min_cellray_index
+                                  + sizeof(los_range) * LOS_QUADRANT_CELLS,
+                              alignof(los_cellray));
+        cellray_ends = min_cellrays + sizeof(los_cellray) * h.n_min_cellrays;
+        ray_coords = cellray_ends + sizeof(coord_def) * h.n_cellray_ends;
+        size = ray_coords + sizeof(coord_def) * h.n_ray_coords;
+    }
+
+private:
+    static size_t _align(size_t offset, size_t alignment)
+    {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+};
+
+// Pointers into the tables block.
+static struct
+{
+    const char *base;
+    size_t size;
+    const blockrays_t *blockrays;
+    const los_range *min_cellray_index;
+    const los_cellray *min_cellrays;
+    const coord_def *cellray_ends;
+    unsigned int n_cellray_ends;
+    const coord_def *ray_coords;
+} los_tables;
+
+// Backing store for the tables: the mapped cache file, or a heap
+// block (over-allocated to align it) if they were computed here.
+static mapped_file los_tables_file;
+static vector<char> los_tables_heap;
+static bool have_los_tables = false;
+
+// blockrays read the other way round: for each cell p, the end
+// cells of those minimal cellrays that p blocks, i.e. the cells whose
+// visibility from the origin can depend on the opacity of p. Used by
+// losglobal.cc to invalidate only the affected cached pairs.
+static FixedArray<vector<coord_def>, LOS_MAX_RANGE+1, LOS_MAX_RANGE+1> blocked_targets;
 
 // Temporary arrays used in losight() to track which rays
 // are blocked or have seen a smoke cloud.
-// Allocated when doing the precomputations.
-static bit_vector *dead_rays     = nullptr;
-static bit_vector *smoke_rays    = nullptr;
+static ray_bitset dead_rays;
+static ray_bitset smoke_rays;
 
 class quadrant_iterator : public rectangle_iterator
 {
@@ -101,14 +207,6 @@ public:
     }
 };
 
-void clear_rays_on_exit()
-{
-    delete dead_rays;
-    delete smoke_rays;
-    for (quadrant_iterator qi; qi; ++qi)
-        delete blockrays(*qi);
-}
-
 // LOS radius.
 int los_radius = LOS_DEFAULT_RANGE;
 
@@ -304,10 +402,13 @@ static compare_type _compare_cellrays(const cellray& a, const cellray& b)
         return compare_type::neither;
 }
 
+typedef FixedArray<vector<cellray>, LOS_MAX_RANGE+1, LOS_MAX_RANGE+1>
+    min_cellrays_t;
+
 // Determine all minimal cellrays.
-// They're stored globally by target in min_cellrays,
-// and returned as a list of indices into ray_coords.
-static vector<int> _find_minimal_cellrays()
+// They're stored by target in min_cellrays, and returned as a list
+// of indices into ray_coords.
+static vector<int> _find_minimal_cellrays(min_cellrays_t &min_cellrays)
 {
     FixedArray<list<cellray>, LOS_MAX_RANGE+1, LOS_MAX_RANGE+1> minima;
     list<cellray>::iterator min_it;
@@ -382,13 +483,72 @@ static void _register_ray(geom::ray r)
     fullrays.push_back(ray);
 }
 
+// Flatten the results of the precomputation into los_tables_heap.
+static void _store_tables(const blockrays_t &blockrays,
+                          const min_cellrays_t &min_cellrays,
+                          const vector<coord_def> &cellray_ends)
+{
+    los_tables_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, LOS_TABLES_MAGIC, sizeof(h.magic));
+    h.format         = LOS_TABLES_FORMAT;
+    h.byte_order     = 0x01020304;
+    h.max_range      = LOS_MAX_RANGE;
+    h.max_angle      = LOS_MAX_ANGLE;
+    h.intercept_mult = LOS_INTERCEPT_MULT;
+    h.max_cellrays   = LOS_MAX_CELLRAYS;
+    for (quadrant_iterator qi; qi; ++qi)
+        h.n_min_cellrays += min_cellrays(*qi).size();
+    h.n_cellray_ends = cellray_ends.size();
+    h.n_ray_coords   = ray_coords.size();
+
+    const los_tables_layout layout(h);
+    h.size = layout.size;
+
+    los_tables_heap.assign(layout.size + alignof(ray_bitset), 0);
+    char *base = los_tables_heap.data()
+        + (-reinterpret_cast<uintptr_t>(los_tables_heap.data())
+           & (alignof(ray_bitset) - 1));
+
+    memcpy(base, &h, sizeof(h));
+    memcpy(base + layout.blockrays, &blockrays, sizeof(blockrays));
+
+    los_range *index
+        = reinterpret_cast<los_range *>(base + layout.min_cellray_index);
+    los_cellray *rays
+        = reinterpret_cast<los_cellray *>(base + layout.min_cellrays);
+    uint32_t n = 0;
+    for (int x = 0; x <= LOS_MAX_RANGE; ++x)
+        for (int y = 0; y <= LOS_MAX_RANGE; ++y)
+        {
+            los_range &range = index[x * (LOS_MAX_RANGE+1) + y];
+            range.first = n;
+            range.count = min_cellrays[x][y].size();
+            for (const cellray &c : min_cellrays[x][y])
+            {
+                los_cellray &r = rays[n++];
+                r.start_x = c.ray.r.start.x;
+                r.start_y = c.ray.r.start.y;
+                r.dir_x   = c.ray.r.dir.x;
+                r.dir_y   = c.ray.r.dir.y;
+                r.start   = c.ray.start;
+                r.end     = c.end;
+            }
+        }
+
+    memcpy(base + layout.cellray_ends, cellray_ends.data(),
+           sizeof(coord_def) * cellray_ends.size());
+    memcpy(base + layout.ray_coords, ray_coords.data(),
+           sizeof(coord_def) * ray_coords.size());
+}
+
 static void _create_blockrays()
 {
     // First, we calculate blocking information for all cell rays.
     // Cellrays are numbered according to the index of their end
     // cell in ray_coords.
     const int n_cellrays = ray_coords.size();
-    blockrays_t all_blockrays;
+    FixedArray<bit_vector*, LOS_MAX_RANGE+1, LOS_MAX_RANGE+1> all_blockrays;
     for (quadrant_iterator qi; qi; ++qi)
         all_blockrays(*qi) = new bit_vector(n_cellrays);
 
@@ -407,20 +567,22 @@ static void _create_blockrays()
     // only the nonduplicated cellrays.
 
     // Determine minimal cellrays and store their indices in ray_coords.
-    vector<int> min_indices = _find_minimal_cellrays();
+    min_cellrays_t min_cellrays;
+    vector<int> min_indices = _find_minimal_cellrays(min_cellrays);
     const int n_min_rays    = min_indices.size();
-    cellray_ends.resize(n_min_rays);
+    ASSERT(n_min_rays <= LOS_MAX_CELLRAYS);
+    vector<coord_def> cellray_ends(n_min_rays);
     for (int i = 0; i < n_min_rays; ++i)
         cellray_ends[i] = ray_coords[min_indices[i]];
 
     // Compress blockrays accordingly.
+    blockrays_t blockrays;
     for (quadrant_iterator qi; qi; ++qi)
     {
-        blockrays(*qi) = new bit_vector(n_min_rays);
         for (int i = 0; i < n_min_rays; ++i)
         {
-            blockrays(*qi)->set(i, all_blockrays(*qi)
-                                   ->get(min_indices[i]));
+            blockrays(*qi).set(i, all_blockrays(*qi)
+                                  ->get(min_indices[i]));
         }
     }
 
@@ -428,11 +590,14 @@ static void _create_blockrays()
     for (quadrant_iterator qi; qi; ++qi)
         delete all_blockrays(*qi);
 
-    dead_rays  = new bit_vector(n_min_rays);
-    smoke_rays = new bit_vector(n_min_rays);
+    _store_tables(blockrays, min_cellrays, cellray_ends);
 
     dprf("Cellrays: %d Fullrays: %u Minimal cellrays: %u",
           n_cellrays, (unsigned int)fullrays.size(), n_min_rays);
+
+    // Only the tables are needed from here on.
+    vector<los_ray>().swap(fullrays);
+    vector<coord_def>().swap(ray_coords);
 }
 
 static int _gcd(int x, int y)
@@ -453,16 +618,123 @@ static bool _complexity_lt(const pair<int,int>& lhs, const pair<int,int>& rhs)
     return lhs.first * lhs.second < rhs.first * rhs.second;
 }
 
+// Point los_tables at a tables block and derive blocked_targets.
+static void _use_tables(const char *base)
+{
+    const los_tables_header &h
+        = *reinterpret_cast<const los_tables_header *>(base);
+    const los_tables_layout layout(h);
+
+    los_tables.base = base;
+    los_tables.size = layout.size;
+    los_tables.blockrays
+        = reinterpret_cast<const blockrays_t *>(base + layout.blockrays);
+    los_tables.min_cellray_index = reinterpret_cast<const los_range *>(
+                                        base + layout.min_cellray_index);
+    los_tables.min_cellrays = reinterpret_cast<const los_cellray *>(
+                                        base + layout.min_cellrays);
+    los_tables.cellray_ends = reinterpret_cast<const coord_def *>(
+                                        base + layout.cellray_ends);
+    los_tables.n_cellray_ends = h.n_cellray_ends;
+    los_tables.ray_coords = reinterpret_cast<const coord_def *>(
+                                        base + layout.ray_coords);
+
+    // Invert blockrays by end cell.
+    const blockrays_t &blockrays = *los_tables.blockrays;
+    blockrays_t rays_to;
+    for (unsigned int i = 0; i < h.n_cellray_ends; ++i)
+        rays_to(los_tables.cellray_ends[i]).set(i);
+    for (quadrant_iterator pi; pi; ++pi)
+    {
+        blocked_targets(*pi).clear();
+        for (quadrant_iterator ti; ti; ++ti)
+            if (blockrays(*pi).intersects(rays_to(*ti)))
+                blocked_targets(*pi).push_back(*ti);
+    }
+
+    have_los_tables = true;
+}
+
+static bool _in_quadrant(const coord_def &c)
+{
+    return c.x >= 0 && c.y >= 0 && c.rdist() <= LOS_MAX_RANGE;
+}
+
+// Is this a tables block of the given size, built with our parameters?
+// A cache file may be truncated or corrupt, so every index in it is
+// checked against the tables it points into.
+static bool _valid_tables(const char *base, size_t size)
+{
+    if (size < sizeof(los_tables_header))
+        return false;
+
+    const los_tables_header &h
+        = *reinterpret_cast<const los_tables_header *>(base);
+    if (memcmp(h.magic, LOS_TABLES_MAGIC, sizeof(h.magic))
+        || h.format != LOS_TABLES_FORMAT
+        || h.byte_order != 0x01020304
+        || h.max_range != LOS_MAX_RANGE
+        || h.max_angle != LOS_MAX_ANGLE
+        || h.intercept_mult != LOS_INTERCEPT_MULT
+        || h.max_cellrays != LOS_MAX_CELLRAYS
+        || h.n_cellray_ends > LOS_MAX_CELLRAYS
+        || h.size != size
+        // Keep the layout's arithmetic from overflowing.
+        || h.n_min_cellrays > size / sizeof(los_cellray)
+        || h.n_ray_coords > size / sizeof(coord_def))
+    {
+        return false;
+    }
+
+    const los_tables_layout layout(h);
+    if (layout.size != size)
+        return false;
+
+    const los_range *index = reinterpret_cast<const los_range *>(
+                                    base + layout.min_cellray_index);
+    for (int i = 0; i < LOS_QUADRANT_CELLS; ++i)
+    {
+        if (index[i].first > h.n_min_cellrays
+            || index[i].count > h.n_min_cellrays - index[i].first)
+        {
+            return false;
+        }
+    }
+
+    const los_cellray *cellrays = reinterpret_cast<const los_cellray *>(
+                                        base + layout.min_cellrays);
+    for (unsigned int i = 0; i < h.n_min_cellrays; ++i)
+    {
+        if (cellrays[i].start >= h.n_ray_coords
+            || cellrays[i].end >= h.n_ray_coords - cellrays[i].start)
+        {
+            return false;
+        }
+    }
+
+    const coord_def *ends = reinterpret_cast<const coord_def *>(
+                                    base + layout.cellray_ends);
+    for (unsigned int i = 0; i < h.n_cellray_ends; ++i)
+        if (!_in_quadrant(ends[i]))
+            return false;
+
+    const coord_def *coords = reinterpret_cast<const coord_def *>(
+                                    base + layout.ray_coords);
+    for (unsigned int i = 0; i < h.n_ray_coords; ++i)
+        if (!_in_quadrant(coords[i]))
+            return false;
+
+    return true;
+}
+
 // Cast all rays
 static void raycast()
 {
-    static bool done_raycast = false;
-    if (done_raycast)
+    if (have_los_tables)
         return;
 
     // Creating all rays for first quadrant
     // We have a considerable amount of overkill.
-    done_raycast = true;
 
     // register perpendiculars FIRST, to make them top choice
     // when selecting beams
@@ -504,6 +776,78 @@ static void raycast()
 
     // Now create the appropriate blockrays array
     _create_blockrays();
+
+    const char *base = los_tables_heap.data();
+    _use_tables(base + (-reinterpret_cast<uintptr_t>(base)
+                        & (alignof(ray_bitset) - 1)));
+}
+
+// Load the precomputed tables from cache_file if it holds valid ones;
+// otherwise compute them and try to write them there for later
+// processes. A mapped cache file is shared between all the processes
+// using it.
+void init_los_tables(const string &cache_file)
+{
+    if (have_los_tables)
+        return;
+
+    if (los_tables_file.open(cache_file)
+        && _valid_tables(los_tables_file.data(), los_tables_file.size()))
+    {
+        _use_tables(los_tables_file.data());
+        return;
+    }
+    los_tables_file.close();
+
+    raycast();
+
+    // Write to a temporary file and rename it into place, so that other
+    // processes never see a partial cache file.
+    const string tmp = make_stringf("%s.%d.tmp", cache_file.c_str(),
+                                    process_id());
+    FILE *f = fopen_u(tmp.c_str(), "wb");
+    bool ok = f && fwrite(los_tables.base, 1, los_tables.size, f)
+                   == los_tables.size;
+    if (f)
+        ok = !fclose(f) && ok;
+    if (ok)
+        ok = !rename_u(tmp.c_str(), cache_file.c_str());
+    if (!ok)
+    {
+        dprf("Can't write LOS cache %s", cache_file.c_str());
+        unlink_u(tmp.c_str());
+    }
+}
+
+// The cells, as offsets in the positive quadrant, whose visibility
+// from the origin can change when the opacity of the cell at offset p
+// changes.
+const vector<coord_def>& los_blocked_targets(const coord_def& p)
+{
+    ASSERT(p.x >= 0 && p.y >= 0);
+    ASSERT(p.rdist() <= LOS_MAX_RANGE);
+    raycast();
+    return blocked_targets(p);
+}
+
+unsigned int los_cellray_count()
+{
+    raycast();
+    return los_tables.n_cellray_ends;
+}
+
+coord_def los_cellray_end(unsigned int ray)
+{
+    ASSERT(ray < los_cellray_count());
+    return los_tables.cellray_ends[ray];
+}
+
+bool los_cell_blocks_ray(const coord_def& p, unsigned int ray)
+{
+    ASSERT(p.x >= 0 && p.y >= 0);
+    ASSERT(p.rdist() <= LOS_MAX_RANGE);
+    ASSERT(ray < los_cellray_count());
+    return (*los_tables.blockrays)(p).get(ray);
 }
 
 static int _imbalance(ray_def ray, const coord_def& target)
@@ -558,32 +902,33 @@ static bool _find_ray_se(const coord_def& target, ray_def& ray,
     // Ensure the precalculations have been done.
     raycast();
 
-    const vector<cellray> &min = min_cellrays(target);
-    ASSERT(!min.empty());
-    cellray c = min[0]; // XXX: const cellray &c ?
+    const los_range &min = los_tables.min_cellray_index[
+                               target.x * (LOS_MAX_RANGE+1) + target.y];
+    ASSERT(min.count > 0);
+    const los_cellray *c = &los_tables.min_cellrays[min.first];
     unsigned int index = 0;
 
     if (cycle)
-        dprf("cycling from %d (total %u)", ray.cycle_idx, (unsigned int)min.size());
+        dprf("cycling from %d (total %u)", ray.cycle_idx, min.count);
 
     unsigned int start = cycle ? ray.cycle_idx + 1 : 0;
-    ASSERT(start <= min.size());
+    ASSERT(start <= min.count);
 
     int blocked = OPC_OPAQUE;
     for (unsigned int i = start;
-         (blocked >= OPC_OPAQUE) && (i < start + min.size()); i++)
+         (blocked >= OPC_OPAQUE) && (i < start + min.count); i++)
     {
-        index = i % min.size();
-        c = min[index];
+        index = i % min.count;
+        c = &los_tables.min_cellrays[min.first + index];
         blocked = OPC_CLEAR;
         // Check all inner points.
-        for (unsigned int j = 0; j < c.end && blocked < OPC_OPAQUE; j++)
-            blocked += opc(c[j]);
+        for (unsigned int j = 0; j < c->end && blocked < OPC_OPAQUE; j++)
+            blocked += opc(los_tables.ray_coords[c->start + j]);
     }
     if (blocked >= OPC_OPAQUE)
         return false;
 
-    ray = c.ray;
+    ray = ray_def(geom::ray(c->start_x, c->start_y, c->dir_x, c->dir_y));
     ray.cycle_idx = index;
 
     return true;
@@ -723,58 +1068,59 @@ bool cell_see_cell_nocache(const coord_def& p1, const coord_def& p2)
 // proper, of the original path. We still store the original cellrays
 // fully for beam detection and such.
 // PERFORMANCE:
-// With reasonable values we have around 6000 cellrays, meaning
-// around 600Kb (75 KB) of data. This gets cut down to 700 cellrays
-// after removing duplicates. That means that we need to do
-// around 22*100*4 ~ 9,000 memory reads + writes per LOS call on a
-// 32-bit system. Not too bad.
+// With reasonable values we have around 1200 cellrays. This gets cut
+// down to some 430 cellrays after removing duplicates, which fit in
+// seven 64-bit words. Each ray set is a cache-line aligned
+// AlignedBitVector, so uniting the ray-killers takes a handful of SIMD
+// ORs per opaque cell, and the surviving rays are read off a word at a
+// time by counting trailing zeros rather than testing every ray.
 // IMPROVEMENTS:
 // Smoke will now only block LOS after two cells of smoke. This is
 // done by updating with a second array.
 
-static void _losight_quadrant(los_grid& sh, const los_param& dat, int sx, int sy)
-{
-    const unsigned int num_cellrays = cellray_ends.size();
+typedef SquareArray<opacity_type, LOS_MAX_RANGE> los_opacity_grid;
 
-    dead_rays->reset();
-    smoke_rays->reset();
+// Opacity and bounds have been fetched into opc and bounds; cells
+// out of bounds are OPC_CLEAR.
+static void _losight_quadrant(los_grid& sh, const los_opacity_grid& opc,
+                              const los_grid& bounds, int sx, int sy)
+{
+    const blockrays_t &blockrays = *los_tables.blockrays;
+    const coord_def *cellray_ends = los_tables.cellray_ends;
 
-    for (quadrant_iterator qi; qi; ++qi)
-    {
-        coord_def p = coord_def(sx*(qi->x), sy*(qi->y));
-        if (!dat.los_bounds(p))
-            continue;
+    dead_rays.reset();
+    smoke_rays.reset();
 
-        switch (dat.opacity(p))
+    // Plain loops rather than quadrant_iterator: this is the hot path.
+    for (int x = 0; x <= LOS_MAX_RANGE; ++x)
+        for (int y = 0; y <= LOS_MAX_RANGE; ++y)
         {
-        case OPC_OPAQUE:
-            // Block the appropriate rays.
-            *dead_rays |= *blockrays(*qi);
-            break;
-        case OPC_HALF:
-            // Block rays which have already seen a cloud.
-            *dead_rays  |= (*smoke_rays & *blockrays(*qi));
-            *smoke_rays |= *blockrays(*qi);
-            break;
-        default:
-            break;
+            switch (opc(coord_def(sx*x, sy*y)))
+            {
+            case OPC_OPAQUE:
+                // Block the appropriate rays.
+                dead_rays |= blockrays[x][y];
+                break;
+            case OPC_HALF:
+                // Block rays which have already seen a cloud.
+                dead_rays.or_and(smoke_rays, blockrays[x][y]);
+                smoke_rays |= blockrays[x][y];
+                break;
+            default:
+                break;
+            }
         }
-    }
 
     // Ray calculation done. Now work out which cells in this
-    // quadrant are visible.
-    for (unsigned int rayidx = 0; rayidx < num_cellrays; ++rayidx)
+    // quadrant are visible: the end cell of every live ray is.
+    dead_rays.for_each_unset(los_tables.n_cellray_ends,
+                             [&](unsigned int rayidx)
     {
-        // make the cells seen by this ray at this point visible
-        if (!dead_rays->get(rayidx))
-        {
-            // This ray is alive, thus the end cell is visible.
-            const coord_def p = coord_def(sx * cellray_ends[rayidx].x,
-                                          sy * cellray_ends[rayidx].y);
-            if (dat.los_bounds(p))
-                sh(p) = true;
-        }
-    }
+        const coord_def p = coord_def(sx * cellray_ends[rayidx].x,
+                                      sy * cellray_ends[rayidx].y);
+        if (bounds(p))
+            sh(p) = true;
+    });
 }
 
 struct los_param_funcs : public los_param
@@ -800,26 +1146,49 @@ struct los_param_funcs : public los_param
     }
 };
 
-void losight(los_grid& sh, const coord_def& center,
-             const opacity_func& opc, const circle_def& bounds)
+// Compute LOS from bounds and opacity already fetched for the square
+// around the centre.
+static void _losight_fetched(los_grid& sh, const los_opacity_grid& opc_grid,
+                             const los_grid& bounds_grid)
 {
-    const los_param& dat = los_param_funcs(center, opc, bounds);
-
     sh.init(false);
 
-    // Do precomputations if necessary.
-    raycast();
-
     const int quadrant_x[4] = {  1, -1, -1,  1 };
     const int quadrant_y[4] = {  1,  1, -1, -1 };
     for (int q = 0; q < 4; ++q)
-        _losight_quadrant(sh, dat, quadrant_x[q], quadrant_y[q]);
+    {
+        _losight_quadrant(sh, opc_grid, bounds_grid,
+                          quadrant_x[q], quadrant_y[q]);
+    }
 
     // Center is always visible.
     const coord_def o = coord_def(0,0);
     sh(o) = true;
 }
 
+void losight(los_grid& sh, const coord_def& center,
+             const opacity_func& opc, const circle_def& bounds)
+{
+    const los_param& dat = los_param_funcs(center, opc, bounds);
+
+    // Do precomputations if necessary.
+    raycast();
+
+    // Fetch bounds and opacity once for the whole square: the quadrants
+    // share their axes, and the quadrant passes avoid virtual calls.
+    los_opacity_grid opc_grid;
+    los_grid bounds_grid;
+    for (int x = -LOS_MAX_RANGE; x <= LOS_MAX_RANGE; ++x)
+        for (int y = -LOS_MAX_RANGE; y <= LOS_MAX_RANGE; ++y)
+        {
+            const coord_def p(x, y);
+            bounds_grid(p) = dat.los_bounds(p);
+            opc_grid(p) = bounds_grid(p) ? dat.opacity(p) : OPC_CLEAR;
+        }
+
+    _losight_fetched(sh, opc_grid, bounds_grid);
+}
+
 opacity_type mons_opacity(const monster* mon, los_type how)
 {
     // no regard for LOS_ARENA
@@ -34,9 +34,16 @@ void fallback_ray(const coord_def& source, const coord_def& target,
 
 bool cell_see_cell_nocache(const coord_def& p1, const coord_def& p2);
 
+const vector<coord_def>& los_blocked_targets(const coord_def& p);
+// The minimal cellrays in the first quadrant, and the cells p that block
+// them; for checking losight() against a plain scan of the rays.
+unsigned int los_cellray_count();
+coord_def los_cellray_end(unsigned int ray);
+bool los_cell_blocks_ray(const coord_def& p, unsigned int ray);
+
 typedef SquareArray<bool, LOS_MAX_RANGE> los_grid;
 
-void clear_rays_on_exit();
+void init_los_tables(const string &cache_file);
 void losight(los_grid& sh, const coord_def& center,
              const opacity_func &opc = opc_default,
              const circle_def &bds = BDS_DEFAULT);
@@ -5,7 +5,8 @@
 #include "coord.h"
 #include "coordit.h"
 #include "libutil.h"
-#include "los-def.h"
+#include "losparam.h"
+#include "los.h"
 
 #define LOS_KNOWN 4
 
@@ -33,9 +34,8 @@ static losfield_t* _lookup_globallos(const coord_def& p, const coord_def& q)
         return &globallos[p.x][p.y][ diff.x + o_half_x][ diff.y + o_half_y];
 }
 
-static void _save_los(los_def* los, los_type l)
+static void _save_los(const coord_def& o, const los_grid& sh, los_type l)
 {
-    const coord_def o = los->get_center();
     int y1 = o.y - LOS_MAX_RANGE;
     int y2 = o.y + LOS_MAX_RANGE;
     int x1 = o.x - LOS_MAX_RANGE;
@@ -43,31 +43,48 @@ static void _save_los(los_def* los, los_type l)
     for (int y = y1; y <= y2; y++)
         for (int x = x1; x <= x2; x++)
         {
-            if (max(abs(o.x - x), abs(o.y - y)) > LOS_MAX_RANGE)
-                continue;
-
             coord_def ri(x, y);
             losfield_t* flags = _lookup_globallos(o, ri);
             if (!flags)
                 continue;
             *flags |= l << LOS_KNOWN;
-            if (los->see_cell(ri))
+            if (sh(ri - o))
                 *flags |= l;
             else
                 *flags &= ~l;
         }
 }
 
-// Opacity at p has changed.
+// Opacity at p has changed. Forget only those pairs that have a
+// minimal cellray passing through p, rather than every pair in range.
 void invalidate_los_around(const coord_def& p)
 {
-    int x1 = max(p.x - LOS_MAX_RANGE, 0);
-    int y1 = max(p.y - LOS_MAX_RANGE, 0);
-    int x2 = min(p.x, GXM - 1);
-    int y2 = min(p.y + LOS_MAX_RANGE, GYM - 1);
-    for (int y = y1; y <= y2; y++)
-        for (int x = x1; x <= x2; x++)
-            memset(globallos[x][y], 0, sizeof(halflos_t));
+    for (int dx = -LOS_MAX_RANGE; dx <= LOS_MAX_RANGE; ++dx)
+        for (int dy = -LOS_MAX_RANGE; dy <= LOS_MAX_RANGE; ++dy)
+        {
+            // p as seen from the source o.
+            const coord_def rel(dx, dy);
+            const coord_def o = p - rel;
+            if (rel.origin() || !map_bounds(o))
+                continue;
+
+            const coord_def abs_rel(abs(dx), abs(dy));
+            const vector<coord_def>& targets = los_blocked_targets(abs_rel);
+
+            // Cells on an axis belong to two quadrants.
+            for (int sx = -1; sx <= 1; sx += 2)
+                for (int sy = -1; sy <= 1; sy += 2)
+                {
+                    if (sx * dx < 0 || sy * dy < 0)
+                        continue;
+                    for (const coord_def &t : targets)
+                    {
+                        const coord_def q(o.x + sx * t.x, o.y + sy * t.y);
+                        if (losfield_t* flags = _lookup_globallos(o, q))
+                            *flags = 0;
+                    }
+                }
+        }
 }
 
 void invalidate_los()
@@ -76,43 +93,30 @@ void invalidate_los()
         memset(globallos[ri->x][ri->y], 0, sizeof(halflos_t));
 }
 
-static void _update_globallos_at(const coord_def& p, los_type l)
+static const opacity_func& _opacity_for(los_type l)
 {
     switch (l)
     {
     case LOS_DEFAULT:
-        {
-            los_def los(p, opc_default);
-            los.update();
-            _save_los(&los, l);
-            break;
-        }
+        return opc_default;
     case LOS_NO_TRANS:
-        {
-            los_def los(p, opc_no_trans);
-            los.update();
-            _save_los(&los, l);
-            break;
-        }
+        return opc_no_trans;
     case LOS_SOLID:
-        {
-            los_def los(p, opc_solid);
-            los.update();
-            _save_los(&los, l);
-            break;
-        }
+        return opc_solid;
     case LOS_SOLID_SEE:
-        {
-            los_def los(p, opc_solid_see);
-            los.update();
-            _save_los(&los, l);
-            break;
-        }
+        return opc_solid_see;
     default:
         die("invalid opacity");
     }
 }
 
+static void _update_globallos_at(const coord_def& p, los_type l)
+{
+    los_grid sh;
+    losight(sh, p, _opacity_for(l));
+    _save_los(p, sh, l);
+}
+
 bool cell_see_cell(const coord_def& p, const coord_def& q, los_type l)
 {
     if (l == LOS_NONE)
@@ -586,11 +586,16 @@ static void _show_commandline_options_help()
          "iterations");
     puts("  -force-map <map>    For -mapstat and -objstat, always choose the "
          "      given map on every level.");
+    puts("  -jobs <num>         For -mapstat and -objstat, build the iterations "
+         "in <num>");
+    puts("      processes at once. Results match a single process run with "
+         "the same -seed.");
 #endif
     puts("");
     puts("Miscellaneous options:");
     puts("  -builddb         don't start the game; rebuild the .des cache and exit");
     puts("  -reset-cache     force a full rebuild of the .des cache");
+    puts("  -bench-save <name> time loading and saving each chunk of a save");
     puts("  -dump-maps       write map Lua to stderr when parsing .des files");
 #ifndef TARGET_OS_WINDOWS
     puts("  -gdb/-no-gdb     produce gdb backtrace when a crash happens (default:on)");
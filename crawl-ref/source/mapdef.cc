@@ -35,6 +35,7 @@
 #include "invent.h"
 #include "libutil.h"
 #include "mapmark.h"
+#include "mapped-file.h"
 #include "maps.h"
 #include "mon-cast.h"
 #include "mon-place.h"
@@ -2469,11 +2470,8 @@ void map_def::load()
     if (!index_only)
         return;
 
-    const string descache_base = get_descache_path(cache_name, "");
-    file_lock deslock(descache_base + ".lk", "rb", false);
-    const string loadfile = descache_base + ".dsc";
-
-    reader inf(loadfile, TAG_MINOR_VERSION);
+    const mapped_file &body = get_des_cache_body(cache_name);
+    reader inf(body.data(), body.size(), TAG_MINOR_VERSION);
     if (!inf.valid())
     {
         throw map_load_exception(
@@ -0,0 +1,106 @@
+/**
+ * @file
+ * @brief Read-only access to a whole file, memory-mapped where possible.
+**/
+
+#include "AppHdr.h"
+
+#include "mapped-file.h"
+
+#include <cstdio>
+#ifdef UNIX
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+#include "syscalls.h"
+#include "unicode.h"
+
+mapped_file::mapped_file() : base(nullptr), len(0), buffer(nullptr)
+{
+}
+
+mapped_file::~mapped_file()
+{
+    close();
+}
+
+bool mapped_file::open(const string &filename)
+{
+    close();
+
+#ifdef UNIX
+    const int fd = open_u(filename.c_str(), O_RDONLY, 0);
+    if (fd == -1)
+        return false;
+
+    const bool ok = map(fd);
+    ::close(fd);
+    return ok;
+#else
+    FILE *f = fopen_u(filename.c_str(), "rb");
+    if (!f)
+        return false;
+
+    long size = -1;
+    if (!fseek(f, 0, SEEK_END))
+        size = ftell(f);
+    if (size <= 0 || fseek(f, 0, SEEK_SET))
+    {
+        fclose(f);
+        return false;
+    }
+
+    // Over-allocate so that the data can be aligned like a mapping.
+    buffer = new char[size + 63];
+    char *aligned = buffer + (-reinterpret_cast<uintptr_t>(buffer) & 63);
+    const bool ok = fread(aligned, 1, size, f) == (size_t)size;
+    fclose(f);
+    if (!ok)
+    {
+        delete[] buffer;
+        buffer = nullptr;
+        return false;
+    }
+
+    base = aligned;
+    len = size;
+    return true;
+#endif
+}
+
+#ifdef UNIX
+bool mapped_file::map(int fd)
+{
+    close();
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size <= 0)
+        return false;
+
+    void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED)
+        return false;
+
+    base = static_cast<const char *>(mem);
+    len = st.st_size;
+    return true;
+}
+#endif
+
+void mapped_file::close()
+{
+    if (!base)
+        return;
+
+#ifdef UNIX
+    munmap(const_cast<char *>(base), len);
+#else
+    delete[] buffer;
+    buffer = nullptr;
+#endif
+    base = nullptr;
+    len = 0;
+}
@@ -0,0 +1,41 @@
+/**
+ * @file
+ * @brief Read-only access to a whole file, memory-mapped where possible.
+**/
+
+#pragma once
+
+#include <string>
+
+#include "macros.h"
+
+// The contents of a file, mapped read-only into memory so that processes
+// reading the same file share its pages. Where mmap() isn't available the
+// file is read into a private buffer instead. Either way data() is
+// aligned to at least 64 bytes.
+class mapped_file
+{
+public:
+    mapped_file();
+    ~mapped_file();
+    DISALLOW_COPY_AND_ASSIGN(mapped_file);
+
+    bool open(const std::string &filename);
+#ifdef UNIX
+    // Map a file that is already open. fd stays open and is still the
+    // caller's to close.
+    bool map(int fd);
+#endif
+    void close();
+
+    bool is_open() const { return base != nullptr; }
+    const char *data() const { return base; }
+    size_t size() const { return len; }
+
+private:
+    const char *base;
+    size_t len;
+    // The allocation backing base, if the file was read rather than
+    // mapped.
+    char *buffer;
+};
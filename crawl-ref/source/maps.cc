@@ -10,6 +10,7 @@
 #include <algorithm>
 #include <cstdlib>
 #include <cstring>
+#include <unordered_map>
 #include <sys/param.h>
 #include <sys/types.h>
 #if defined(UNIX) || defined(TARGET_COMPILER_MINGW)
@@ -25,6 +26,7 @@
 #include "endianness.h"
 #include "files.h"
 #include "mapmark.h"
+#include "mapped-file.h"
 #include "message.h"
 #include "state.h"
 #include "stringutil.h"
@@ -761,6 +763,97 @@ vector<string> find_map_matches(const string &name)
     return matches;
 }
 
+typedef vector<unsigned> vault_indices;
+
+// The index narrows down which maps a selector could accept, so that
+// picking a vault doesn't have to look at every map. It only knows what
+// maps say about themselves (tags, DEPTH, PLACE and CHANCE), and is good
+// until the maps change; anything that depends on the game so far is left
+// to map_selector::accept(), which still checks every candidate. The
+// candidates are in vdefs order, so the same maps are picked as before.
+
+// The maps with each tag.
+static unordered_map<string, vault_indices> maps_by_tag;
+static bool maps_by_tag_built = false;
+
+struct place_maps
+{
+    // The depth of the branch when this was worked out; "$" in a depth
+    // range means the last level of the branch, which can vary.
+    int branch_depth;
+    // Maps with a DEPTH here and no CHANCE here (or dummies), by
+    // is_minivault().
+    vault_indices depth[2];
+    // Non-dummy maps with a DEPTH and a CHANCE here.
+    vault_indices chance;
+    // Maps with a PLACE here, by is_minivault().
+    vault_indices place[2];
+};
+
+// Built for each place the first time it is asked about.
+static map<level_id, place_maps> maps_by_place;
+
+static void _clear_map_index()
+{
+    maps_by_tag.clear();
+    maps_by_tag_built = false;
+    maps_by_place.clear();
+}
+
+// The maps that could have all of the given tags: those with the rarest
+// one.
+static const vault_indices &_maps_with_tags(const unordered_set<string> &tags)
+{
+    static const vault_indices none;
+
+    if (!maps_by_tag_built)
+    {
+        for (unsigned i = 0, size = vdefs.size(); i < size; ++i)
+            for (const string &tag : vdefs[i].get_tags_unsorted())
+                maps_by_tag[tag].push_back(i);
+        maps_by_tag_built = true;
+    }
+
+    const vault_indices *rarest = &none;
+    for (const string &tag : tags)
+    {
+        auto it = maps_by_tag.find(tag);
+        if (it == maps_by_tag.end())
+            return none;
+        if (rarest == &none || it->second.size() < rarest->size())
+            rarest = &it->second;
+    }
+    return *rarest;
+}
+
+static const place_maps &_maps_for_place(const level_id &place)
+{
+    auto it = maps_by_place.find(place);
+    if (it != maps_by_place.end()
+        && it->second.branch_depth == brdepth[place.branch])
+    {
+        return it->second;
+    }
+
+    place_maps &maps = maps_by_place[place];
+    maps = place_maps();
+    maps.branch_depth = brdepth[place.branch];
+    for (unsigned i = 0, size = vdefs.size(); i < size; ++i)
+    {
+        const map_def &mapdef = vdefs[i];
+        const bool mini = mapdef.is_minivault();
+        if (mapdef.place.is_usable_in(place))
+            maps.place[mini].push_back(i);
+        if (!mapdef.is_usable_in(place))
+            continue;
+        if (mapdef.chance(place).valid() && !mapdef.has_tag("dummy"))
+            maps.chance.push_back(i);
+        else
+            maps.depth[mini].push_back(i);
+    }
+    return maps;
+}
+
 mapref_vector find_maps_for_tag(const string &tag,
                                 bool check_depth,
                                 bool check_used)
@@ -769,8 +862,9 @@ mapref_vector find_maps_for_tag(const string &tag,
     level_id place = level_id::current();
     unordered_set<string> tag_set = parse_tags(tag);
 
-    for (const map_def &mapdef : vdefs)
+    for (unsigned i : _maps_with_tags(tag_set))
     {
+        const map_def &mapdef = vdefs[i];
         if (mapdef.has_all_tags(tag_set.begin(), tag_set.end())
             && !mapdef.has_tag("dummy")
             && (!check_depth || _debug_ignore_depth
@@ -796,6 +890,7 @@ private:
     };
 
 public:
+    const vault_indices &candidates() const;
     bool accept(const map_def &md) const;
     void announce(const map_def *map) const;
 
@@ -992,7 +1087,21 @@ string vault_chance_tag(const map_def &map)
     return "";
 }
 
-typedef vector<unsigned> vault_indices;
+const vault_indices &map_selector::candidates() const
+{
+    switch (sel)
+    {
+    case PLACE:
+        return _maps_for_place(place).place[mini];
+    case DEPTH:
+        return _maps_for_place(place).depth[mini];
+    case DEPTH_AND_CHANCE:
+        return _maps_for_place(place).chance;
+    case TAG:
+    default:
+        return _maps_with_tags(parse_tags(tag));
+    }
+}
 
 static vault_indices _eligible_maps_for_selector(const map_selector &sel)
 {
@@ -1000,7 +1109,7 @@ static vault_indices _eligible_maps_for_selector(const map_selector &sel)
 
     if (sel.valid())
     {
-        for (unsigned i = 0, size = vdefs.size(); i < size; ++i)
+        for (unsigned i : sel.candidates())
             if (sel.accept(vdefs[i]))
                 eligible.push_back(i);
     }
@@ -1278,79 +1387,62 @@ string get_descache_path(const string &file, const string &ext)
     return _des_cache_dir(basename);
 }
 
-static bool verify_file_version(const string &file, time_t mtime)
+// The compiled maps of each des file, keyed by cache name. They stay
+// mapped while the maps indexed from them might be loaded, so that
+// map_def::load() reads from the shared pages instead of reopening the
+// file. The cache files are replaced rather than rewritten, so a mapping
+// keeps the version its index was read from.
+static map<string, unique_ptr<mapped_file>> des_cache_bodies;
+
+static bool _verify_cache_header(reader &inf, time_t mtime,
+                                 int *minor_out = nullptr)
 {
-    FILE *fp = fopen_u(file.c_str(), "rb");
-    if (!fp)
+    const auto version = get_save_version(inf);
+    const auto major = version.major, minor = version.minor;
+    const int8_t word = unmarshallByte(inf);
+    const int64_t t = unmarshallSigned(inf);
+    if (minor_out)
+        *minor_out = minor;
+    return major == TAG_MAJOR_VERSION
+           && minor <= TAG_MINOR_VERSION
+           && word == WORD_LEN
+           && t == mtime;
+}
+
+static bool verify_file_version(const mapped_file &file, time_t mtime)
+{
+    if (!file.is_open())
         return false;
     try
     {
-        reader inf(fp);
-        const auto version = get_save_version(inf);
-        const auto major = version.major, minor = version.minor;
-        const int8_t word = unmarshallByte(inf);
-        const int64_t t = unmarshallSigned(inf);
-        fclose(fp);
-        return major == TAG_MAJOR_VERSION
-               && minor <= TAG_MINOR_VERSION
-               && word == WORD_LEN
-               && t == mtime;
+        reader inf(file.data(), file.size());
+        return _verify_cache_header(inf, mtime);
     }
     catch (short_read_exception &E)
     {
-        fclose(fp);
         return false;
     }
 }
 
-static bool _verify_map_index(const string &base, time_t mtime)
-{
-    return verify_file_version(base + ".idx", mtime);
-}
-
-static bool _verify_map_full(const string &base, time_t mtime)
-{
-    return verify_file_version(base + ".dsc", mtime);
-}
-
 static bool _load_map_index(const string& cache, const string &base,
-                            time_t mtime)
+                            const mapped_file &index, time_t mtime)
 {
     // If there's a global prelude, load that first.
-    if (FILE *fp = fopen_u((base + ".lux").c_str(), "rb"))
-    {
-        reader inf(fp, TAG_MINOR_VERSION);
-        const auto version = get_save_version(inf);
-        const auto major = version.major, minor = version.minor;
-        int8_t word = unmarshallByte(inf);
-        int64_t t = unmarshallSigned(inf);
-        if (major != TAG_MAJOR_VERSION || minor > TAG_MINOR_VERSION
-            || word != WORD_LEN || t != mtime)
-        {
+    mapped_file lux;
+    if (lux.open(base + ".lux"))
+    {
+        reader inf(lux.data(), lux.size(), TAG_MINOR_VERSION);
+        if (!_verify_cache_header(inf, mtime))
             return false;
-        }
 
         lc_global_prelude.read(inf);
-        fclose(fp);
-
         global_preludes.push_back(lc_global_prelude);
     }
 
-    FILE* fp = fopen_u((base + ".idx").c_str(), "rb");
-    if (!fp)
-        end(1, true, "Unable to read %s", (base + ".idx").c_str());
-
-    reader inf(fp, TAG_MINOR_VERSION);
-    // Re-check version, might have been modified in the meantime.
-    const auto version = get_save_version(inf);
-    const auto major = version.major, minor = version.minor;
-    int8_t word = unmarshallByte(inf);
-    int64_t t = unmarshallSigned(inf);
-    if (major != TAG_MAJOR_VERSION || minor > TAG_MINOR_VERSION
-        || word != WORD_LEN || t != mtime)
-    {
+    reader inf(index.data(), index.size(), TAG_MINOR_VERSION);
+    int minor;
+    if (!_verify_cache_header(inf, mtime, &minor))
         return false;
-    }
 
 #if TAG_MAJOR_VERSION == 34
     // Throw out indices that could have CHANCE priority entirely.
@@ -1361,6 +1453,7 @@ static bool _load_map_index(const string& cache, const string &base,
     const int nmaps = unmarshallShort(inf);
     const int nexist = vdefs.size();
     vdefs.resize(nexist + nmaps, map_def());
+    _clear_map_index();
     for (int i = 0; i < nmaps; ++i)
     {
         map_def &vdef(vdefs[nexist + i]);
@@ -1372,7 +1465,6 @@ static bool _load_map_index(const string& cache, const string &base,
         lc_loaded_maps[vdef.name] = vdef.place_loaded_from;
         vdef.place_loaded_from.clear();
     }
-    fclose(fp);
 
     return true;
 }
@@ -1388,17 +1480,61 @@ static bool _load_map_cache(const string &filename, const string &cachename)
     file_lock deslock(descache_base + ".lk", "rb", false);
 
     time_t mtime = file_modtime(filename);
-    string file_idx = descache_base + ".idx";
-    string file_dsc = descache_base + ".dsc";
-
-    // What's the point in checking these twice (here and in load_ma_index)?
-    if (!_verify_map_index(descache_base, mtime)
-        || !_verify_map_full(descache_base, mtime))
+    mapped_file index;
+    unique_ptr<mapped_file> body(new mapped_file);
+    if (!index.open(descache_base + ".idx")
+        || !body->open(descache_base + ".dsc")
+        || !verify_file_version(*body, mtime))
     {
         return false;
     }
 
-    return _load_map_index(cachename, descache_base, mtime);
+    if (!_load_map_index(cachename, descache_base, index, mtime))
+        return false;
+
+    des_cache_bodies[cachename] = move(body);
+    return true;
+}
+
+const mapped_file &get_des_cache_body(const string &cachename)
+{
+    unique_ptr<mapped_file> &body = des_cache_bodies[cachename];
+    if (!body)
+    {
+        // Maps compiled by this process, or discarded by reread_maps().
+        body.reset(new mapped_file);
+        const string descache_base = get_descache_path(cachename, "");
+        file_lock deslock(descache_base + ".lk", "rb", false);
+        body->open(descache_base + ".dsc");
+    }
+    return *body;
+}
+
+// Write a cache file beside the old one and then replace it, so that
+// other processes with the old one mapped never see it change.
+static string _cache_tmp_name(const string &cfile)
+{
+    return make_stringf("%s.%d.tmp", cfile.c_str(), process_id());
+}
+
+static FILE *_open_cache_file(const string &cfile)
+{
+    FILE *fp = fopen_u(_cache_tmp_name(cfile).c_str(), "wb");
+    if (!fp)
+        end(1, true, "Unable to open %s for writing", cfile.c_str());
+    return fp;
+}
+
+static void _close_cache_file(const string &cfile, FILE *fp)
+{
+    const string tmp = _cache_tmp_name(cfile);
+    const bool ok = !ferror(fp);
+    fclose(fp);
+    if (!ok || rename_u(tmp.c_str(), cfile.c_str()))
+    {
+        unlink_u(tmp.c_str());
+        end(1, true, "Unable to write %s", cfile.c_str());
+    }
 }
 
 static void _write_map_prelude(const string &filebase, time_t mtime)
@@ -1410,40 +1546,34 @@ static void _write_map_prelude(const string &filebase, time_t mtime)
         return;
     }
 
-    FILE *fp = fopen_u(luafile.c_str(), "wb");
+    FILE *fp = _open_cache_file(luafile);
     writer outf(luafile, fp);
     write_save_version(outf, save_version::current());
     marshallByte(outf, WORD_LEN);
     marshallSigned(outf, mtime);
     lc_global_prelude.write(outf);
-    fclose(fp);
+    _close_cache_file(luafile, fp);
 }
 
 static void _write_map_full(const string &filebase, size_t vs, size_t ve,
                             time_t mtime)
 {
     const string cfile = filebase + ".dsc";
-    FILE *fp = fopen_u(cfile.c_str(), "wb");
-    if (!fp)
-        end(1, true, "Unable to open %s for writing", cfile.c_str());
-
+    FILE *fp = _open_cache_file(cfile);
     writer outf(cfile, fp);
     write_save_version(outf, save_version::current());
     marshallByte(outf, WORD_LEN);
     marshallSigned(outf, mtime);
     for (size_t i = vs; i < ve; ++i)
         vdefs[i].write_full(outf);
-    fclose(fp);
+    _close_cache_file(cfile, fp);
 }
 
 static void _write_map_index(const string &filebase, size_t vs, size_t ve,
                              time_t mtime)
 {
     const string cfile = filebase + ".idx";
-    FILE *fp = fopen_u(cfile.c_str(), "wb");
-    if (!fp)
-        end(1, true, "Unable to open %s for writing", cfile.c_str());
-
+    FILE *fp = _open_cache_file(cfile);
     writer outf(cfile, fp);
     write_save_version(outf, save_version::current());
     marshallByte(outf, WORD_LEN);
@@ -1457,7 +1587,7 @@ static void _write_map_index(const string &filebase, size_t vs, size_t ve,
         vdefs[i].place_loaded_from.clear();
         vdefs[i].strip();
     }
-    fclose(fp);
+    _close_cache_file(cfile, fp);
 }
 
 static void _write_map_cache(const string &filename, size_t vs, size_t ve,
@@ -1472,6 +1602,9 @@ static void _write_map_cache(const string &filename, size_t vs, size_t ve,
     _write_map_prelude(descache_base, mtime);
     _write_map_full(descache_base, vs, ve, mtime);
     _write_map_index(descache_base, vs, ve, mtime);
+
+    // The offsets just indexed are into the new file.
+    des_cache_bodies.erase(filename);
 }
 
 static void _parse_maps(const string &s)
@@ -1547,7 +1680,9 @@ void reread_maps()
 
     // BOOM!
     vdefs.clear();
+    _clear_map_index();
     map_files_read.clear();
+    des_cache_bodies.clear();
     read_maps();
 }
 
@@ -1566,6 +1701,7 @@ void add_parsed_map(const map_def &md)
 
     map.fixup();
     vdefs.push_back(map);
+    _clear_map_index();
 }
 
 void run_map_global_preludes()
@@ -1582,6 +1718,8 @@ void run_map_global_preludes()
 
 void run_map_local_preludes()
 {
+    // Preludes can change their maps' tags and depths.
+    _clear_map_index();
     for (map_def &vdef : vdefs)
     {
         if (!vdef.prelude.empty())
@@ -10,6 +10,7 @@
 #include "mapdef.h"
 #include "unwind.h"
 
+class mapped_file;
 class map_def;
 struct map_file_place;
 struct vault_placement;
@@ -61,6 +62,7 @@ void read_map(const string &file);
 void run_map_global_preludes();
 void run_map_local_preludes();
 string get_descache_path(const string &file, const string &ext);
+const mapped_file &get_des_cache_body(const string &cachename);
 
 typedef map<string, map_file_place> map_load_info_t;
 
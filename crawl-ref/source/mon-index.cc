@@ -0,0 +1,142 @@
+/**
+ * @file
+ * @brief Index of the monster slots in use and where their monsters stand.
+**/
+
+#include "AppHdr.h"
+
+#include "mon-index.h"
+
+#include "coord.h"
+#include "env.h"
+
+void monster_bitset::clear()
+{
+    memset(words, 0, sizeof(words));
+}
+
+void monster_bitset::fill()
+{
+    memset(words, 0xff, sizeof(words));
+}
+
+monster_bitset& monster_bitset::operator|=(const monster_bitset& other)
+{
+    for (int w = 0; w < NUM_WORDS; ++w)
+        words[w] |= other.words[w];
+    return *this;
+}
+
+int monster_bitset::next(int i) const
+{
+    ++i;
+    if (i >= MAX_MONSTERS)
+        return MAX_MONSTERS;
+
+    int w = i / 64;
+    uint64_t bits = words[w] & (~uint64_t(0) << (i % 64));
+    while (!bits)
+    {
+        if (++w >= NUM_WORDS)
+            return MAX_MONSTERS;
+        bits = words[w];
+    }
+    return min<int>(w * 64 + lowest_bit_index(bits), MAX_MONSTERS);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// The index of mons in env.mons, or -1 if it is some other monster object
+// (a copy, or one in transit). Unlike mindex() this is safe to call on
+// any monster.
+static int _slot_of(const monster& mons)
+{
+    const uintptr_t p = reinterpret_cast<uintptr_t>(&mons);
+    const uintptr_t base = reinterpret_cast<uintptr_t>(&env.mons[0]);
+    if (p < base || p >= base + MAX_MONSTERS * sizeof(monster))
+        return -1;
+    return (p - base) / sizeof(monster);
+}
+
+void monster_index::clear()
+{
+    used.clear();
+    for (int x = 0; x < BUCKETS_X; ++x)
+        for (int y = 0; y < BUCKETS_Y; ++y)
+            buckets[x][y].clear();
+    memset(bucket_of, NO_BUCKET, sizeof(bucket_of));
+}
+
+// The slot of mons has been handed out, or it has been copied into.
+void monster_index::add(const monster& mons)
+{
+    const int idx = _slot_of(mons);
+    if (idx < 0)
+        return;
+    used.insert(idx);
+    moved(mons);
+}
+
+// The slot of mons has been reset.
+void monster_index::remove(const monster& mons)
+{
+    const int idx = _slot_of(mons);
+    if (idx < 0)
+        return;
+    used.erase(idx);
+    if (bucket_of[idx] != NO_BUCKET)
+    {
+        buckets[bucket_of[idx] / BUCKETS_Y][bucket_of[idx] % BUCKETS_Y]
+            .erase(idx);
+        bucket_of[idx] = NO_BUCKET;
+    }
+}
+
+// Refile mons under its current position.
+void monster_index::moved(const monster& mons)
+{
+    const int idx = _slot_of(mons);
+    if (idx < 0)
+        return;
+
+    const coord_def p = mons.pos();
+    const uint8_t bucket = map_bounds(p)
+        ? p.x / MON_BUCKET_SIZE * BUCKETS_Y + p.y / MON_BUCKET_SIZE
+        : NO_BUCKET;
+    if (bucket == bucket_of[idx])
+        return;
+
+    if (bucket_of[idx] != NO_BUCKET)
+    {
+        buckets[bucket_of[idx] / BUCKETS_Y][bucket_of[idx] % BUCKETS_Y]
+            .erase(idx);
+    }
+    if (bucket != NO_BUCKET)
+        buckets[bucket / BUCKETS_Y][bucket % BUCKETS_Y].insert(idx);
+    bucket_of[idx] = bucket;
+}
+
+// Is mons filed correctly? For debugging.
+bool monster_index::indexed(const monster& mons) const
+{
+    const int idx = _slot_of(mons);
+    if (idx < 0 || !used.contains(idx))
+        return false;
+    const coord_def p = mons.pos();
+    return !map_bounds(p)
+           || buckets[p.x / MON_BUCKET_SIZE][p.y / MON_BUCKET_SIZE]
+                  .contains(idx);
+}
+
+void monster_index::near(const coord_def& c, int radius,
+                         monster_bitset& result) const
+{
+    result.clear();
+    const int x1 = max(0, c.x - radius) / MON_BUCKET_SIZE;
+    const int x2 = min(GXM - 1, c.x + radius) / MON_BUCKET_SIZE;
+    const int y1 = max(0, c.y - radius) / MON_BUCKET_SIZE;
+    const int y2 = min(GYM - 1, c.y + radius) / MON_BUCKET_SIZE;
+    for (int x = x1; x <= x2; ++x)
+        for (int y = y1; y <= y2; ++y)
+            result |= buckets[x][y];
+}
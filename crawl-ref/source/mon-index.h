@@ -0,0 +1,77 @@
+/**
+ * @file
+ * @brief Index of the monster slots in use and where their monsters stand.
+**/
+
+#pragma once
+
+#include <cstdint>
+
+#include "bitary.h"
+#include "coord-def.h"
+#include "defines.h"
+
+class monster;
+
+// Cells per side of the squares the level is divided into for lookups by
+// position.
+#define MON_BUCKET_SIZE 8
+
+// A set of monster indices, kept as a bitmap so that it is iterated in
+// index order, the same order as a scan of env.mons.
+class monster_bitset
+{
+public:
+    monster_bitset() { clear(); }
+
+    void clear();
+    void fill();
+    void insert(int idx) { words[idx / 64] |= uint64_t(1) << (idx % 64); }
+    void erase(int idx) { words[idx / 64] &= ~(uint64_t(1) << (idx % 64)); }
+    bool contains(int idx) const
+    {
+        return words[idx / 64] & (uint64_t(1) << (idx % 64));
+    }
+    monster_bitset& operator|=(const monster_bitset& other);
+
+    // The first index after i in the set, or MAX_MONSTERS.
+    int next(int i) const;
+
+    static const int NUM_WORDS = (MAX_MONSTERS + 63) / 64;
+
+private:
+    uint64_t words[NUM_WORDS];
+};
+
+// Which slots of env.mons are in use, and the monsters standing in each
+// MON_BUCKET_SIZE square of the level. Both are supersets: a slot stays
+// in use until its monster is reset, so callers still need to check
+// alive() and the actual position.
+class monster_index
+{
+public:
+    monster_index() { clear(); }
+
+    void clear();
+
+    void add(const monster& mons);
+    void remove(const monster& mons);
+    void moved(const monster& mons);
+    bool indexed(const monster& mons) const;
+
+    // The first slot in use after i, or MAX_MONSTERS.
+    int next(int i) const { return used.next(i); }
+
+    // The monsters that may stand within the given distance (in the
+    // rdist() sense) of c.
+    void near(const coord_def& c, int radius, monster_bitset& result) const;
+
+private:
+    static const int BUCKETS_X = (GXM + MON_BUCKET_SIZE - 1) / MON_BUCKET_SIZE;
+    static const int BUCKETS_Y = (GYM + MON_BUCKET_SIZE - 1) / MON_BUCKET_SIZE;
+    static const uint8_t NO_BUCKET = 0xff;
+
+    monster_bitset used;
+    monster_bitset buckets[BUCKETS_X][BUCKETS_Y];
+    uint8_t bucket_of[MAX_MONSTERS];
+};
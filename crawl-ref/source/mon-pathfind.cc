@@ -2,12 +2,19 @@
 
 #include "mon-pathfind.h"
 
+#include <bitset>
+
+#include "areas.h"
+#include "coordit.h"
 #include "directn.h"
 #include "env.h"
+#include "level-id.h"
 #include "los.h"
+#include "mapmark.h"
 #include "misc.h"
 #include "mon-movetarget.h"
 #include "mon-place.h"
+#include "mon-util.h"
 #include "religion.h"
 #include "state.h"
 #include "terrain.h"
@@ -29,6 +36,79 @@
 // then there's no path that matches the requirements fed into monster_pathfind.
 // (These requirements are usually preference of habitat of a specific monster
 // or a limit of the distance between start and any grid on the path.)
+//
+// The hash is a bucket queue: one stack of positions per total path length.
+// Positions whose estimate improves are pushed again rather than searched
+// for and erased; the stale entries are skipped when they are reached.
+//
+// Monsters pathfind many times a turn, so the grids are not cleared between
+// searches. Instead each search has a new generation number, and a cell's
+// distance and traversability only count if they were stamped with the
+// current generation. The grids themselves are pooled, so constructing a
+// monster_pathfind doesn't allocate or clear anything either.
+
+struct pathfind_grids
+{
+    pathfind_grids();
+    void new_search();
+
+    unsigned int generation;
+    // Generation in which dist and queued (resp. traversable) were set.
+    unsigned int dist_gen[GXM][GYM];
+    unsigned int traversable_gen[GXM][GYM];
+
+    // The array of distances from start to any already tried point.
+    int dist[GXM][GYM];
+    // The total path length a point is queued with, or -1 once taken.
+    int queued[GXM][GYM];
+    // An array to store where we came from on a given shortest path.
+    int prev[GXM][GYM];
+    bool traversable[GXM][GYM];
+
+    FixedVector<vector<coord_def>, GXM * GYM> hash;
+    // Highest hash entry that may be non-empty.
+    int max_hash;
+};
+
+pathfind_grids::pathfind_grids()
+    : generation(0), dist_gen(), traversable_gen(), dist(), queued(), prev(),
+      traversable(), hash(), max_hash(0)
+{
+}
+
+void pathfind_grids::new_search()
+{
+    if (++generation == 0)
+    {
+        // Wrapped around: old stamps could look current again.
+        memset(dist_gen, 0, sizeof(dist_gen));
+        memset(traversable_gen, 0, sizeof(traversable_gen));
+        generation = 1;
+    }
+
+    for (int i = 0; i <= max_hash; ++i)
+        hash[i].clear();
+    max_hash = 0;
+}
+
+// Grids not in use by any monster_pathfind. Searches can nest (a callback
+// may pathfind for another monster), so there may be more than one.
+static vector<unique_ptr<pathfind_grids>> _free_grids;
+
+static pathfind_grids* _get_grids()
+{
+    if (_free_grids.empty())
+        return new pathfind_grids;
+
+    pathfind_grids *grids = _free_grids.back().release();
+    _free_grids.pop_back();
+    return grids;
+}
+
+static void _release_grids(pathfind_grids *grids)
+{
+    _free_grids.emplace_back(grids);
+}
 
 int mons_tracking_range(const monster* mon)
 {
@@ -64,13 +144,13 @@ int mons_tracking_range(const monster* mon)
 monster_pathfind::monster_pathfind()
     : mons(nullptr), start(), target(), pos(), allow_diagonals(true),
       traverse_unmapped(false), fill_range(false),
-      range(0), min_length(0), max_length(0),
-      dist(), prev(), hash(), traversable_cache()
+      range(0), min_length(0), max_length(0), grids(_get_grids())
 {
 }
 
 monster_pathfind::~monster_pathfind()
 {
+    _release_grids(grids);
 }
 
 void monster_pathfind::set_range(int r)
@@ -81,7 +161,7 @@ void monster_pathfind::set_range(int r)
 
 coord_def monster_pathfind::next_pos(const coord_def &c) const
 {
-    return c + Compass[prev[c.x][c.y]];
+    return c + Compass[grids->prev[c.x][c.y]];
 }
 
 // The main method in the monster_pathfind class.
@@ -163,14 +243,10 @@ bool monster_pathfind::start_pathfind(bool msg)
         min_length = 1;
         max_length = range;
     }
-    for (int i = 0; i < GXM; i++)
-        for (int j = 0; j < GYM; j++)
-        {
-            dist[i][j] = INFINITE_DISTANCE;
-            traversable_cache[i][j] = maybe_bool::maybe;
-        }
-
-    dist[pos.x][pos.y] = 0;
+    grids->new_search();
+    grids->dist[pos.x][pos.y] = 0;
+    grids->dist_gen[pos.x][pos.y] = grids->generation;
+    grids->queued[pos.x][pos.y] = -1;
 
     bool success = false;
     do
@@ -240,8 +316,8 @@ bool monster_pathfind::calc_path_to_neighbours()
         if (!traversable_memoized(npos) && npos != target)
             continue;
 
-        distance = dist[pos.x][pos.y] + travel_cost(npos);
-        old_dist = dist[npos.x][npos.y];
+        distance = dist(pos) + travel_cost(npos);
+        old_dist = dist(npos);
 
         // Also bail out if this would make the path longer than twice the
         // allowed distance from the target. (This factor may need tuning.)
@@ -283,7 +359,8 @@ bool monster_pathfind::calc_path_to_neighbours()
             }
 
             // Update distance start->pos.
-            dist[npos.x][npos.y] = distance;
+            grids->dist[npos.x][npos.y] = distance;
+            grids->dist_gen[npos.x][npos.y] = grids->generation;
 
             // Set backtracking information.
             // Converts the Compass direction to its counterpart.
@@ -291,7 +368,7 @@ bool monster_pathfind::calc_path_to_neighbours()
             //      7  .  3   ==>   3  .  7       e.g. (3 + 4) % 8          = 7
             //      6  5  4         2  1  0            (7 + 4) % 8 = 11 % 8 = 3
 
-            prev[npos.x][npos.y] = (dir + 4) % 8;
+            grids->prev[npos.x][npos.y] = (dir + 4) % 8;
 
             // Are we finished?
             if (npos == target)
@@ -313,16 +390,21 @@ bool monster_pathfind::get_best_position()
 {
     for (int i = min_length; i <= max_length; i++)
     {
-        if (!hash[i].empty())
+        vector<coord_def> &vec = grids->hash[i];
+        // Pick the last position pushed into the vector as it's most
+        // likely to be close to the target. Skip positions that have
+        // since been queued with a shorter total.
+        while (!vec.empty() && grids->queued[vec.back().x][vec.back().y] != i)
+            vec.pop_back();
+
+        if (!vec.empty())
         {
             if (i > min_length)
                 min_length = i;
 
-            vector<coord_def> &vec = hash[i];
-            // Pick the last position pushed into the vector as it's most
-            // likely to be close to the target.
-            pos = vec[vec.size()-1];
+            pos = vec.back();
             vec.pop_back();
+            grids->queued[pos.x][pos.y] = -1;
 
 #ifdef DEBUG_PATHFIND
             mprf("Returning (%d, %d) as best pos with total dist %d.",
@@ -357,7 +439,7 @@ vector<coord_def> monster_pathfind::backtrack()
     int dir;
     do
     {
-        dir = prev[pos.x][pos.y];
+        dir = grids->prev[pos.x][pos.y];
         pos = pos + Compass[dir];
         ASSERT_IN_BOUNDS(pos);
 #ifdef DEBUG_PATHFIND
@@ -382,24 +464,27 @@ vector<coord_def> monster_pathfind::backtrack()
 // This is done because Crawl's pathfinding - once a target is in sight and easy
 // reach - is both very robust and natural, especially if we want to flexibly
 // avoid plants and other monsters in the way.
-vector<coord_def> monster_pathfind::calc_waypoints()
+static vector<coord_def> _path_waypoints(const monster* mons,
+                                         const vector<coord_def> &path,
+                                         bool in_sight)
 {
-    vector<coord_def> path = backtrack();
-
     // If no path found, nothing to be done.
     if (path.empty())
         return path;
 
     vector<coord_def> waypoints;
-    pos = path[0];
+    coord_def pos = path[0];
 
 #ifdef DEBUG_PATHFIND
     mpr("\nWaypoints:");
 #endif
     for (unsigned int i = 1; i < path.size(); i++)
     {
-        if (can_go_straight(mons, pos, path[i]) && mons_traversable(path[i]))
+        if (can_go_straight(mons, pos, path[i])
+            && mons_can_traverse(*mons, path[i], in_sight))
+        {
             continue;
+        }
         else
         {
             pos = path[i-1];
@@ -419,11 +504,26 @@ vector<coord_def> monster_pathfind::calc_waypoints()
     return waypoints;
 }
 
+vector<coord_def> monster_pathfind::calc_waypoints()
+{
+    return _path_waypoints(mons, backtrack(), traverse_in_sight);
+}
+
 bool monster_pathfind::traversable_memoized(const coord_def& p)
 {
-    if (traversable_cache[p.x][p.y] == maybe_bool::maybe)
-        traversable_cache[p.x][p.y] = traversable(p);
-    return bool(traversable_cache[p.x][p.y]);
+    if (grids->traversable_gen[p.x][p.y] != grids->generation)
+    {
+        grids->traversable[p.x][p.y] = traversable(p);
+        grids->traversable_gen[p.x][p.y] = grids->generation;
+    }
+    return grids->traversable[p.x][p.y];
+}
+
+// The distance from start to p found so far in this search.
+int monster_pathfind::dist(const coord_def& p) const
+{
+    return grids->dist_gen[p.x][p.y] == grids->generation
+           ? grids->dist[p.x][p.y] : INFINITE_DISTANCE;
 }
 
 // Since traversable_memoized is only called for spaces that were at least
@@ -432,7 +532,9 @@ bool monster_pathfind::traversable_memoized(const coord_def& p)
 // pathfinding range.
 bool monster_pathfind::is_reachable(const coord_def& p)
 {
-    return dist[p.x][p.y] <= range && bool(traversable_cache[p.x][p.y]);
+    return dist(p) <= range
+           && grids->traversable_gen[p.x][p.y] == grids->generation
+           && grids->traversable[p.x][p.y];
 }
 
 bool monster_pathfind::traversable(const coord_def& p)
@@ -535,24 +637,289 @@ int monster_pathfind::estimated_cost(coord_def p)
 
 void monster_pathfind::add_new_pos(coord_def npos, int total)
 {
-    hash[total].push_back(npos);
+    grids->hash[total].push_back(npos);
+    grids->queued[npos.x][npos.y] = total;
+    if (total > grids->max_hash)
+        grids->max_hash = total;
 }
 
 void monster_pathfind::update_pos(coord_def npos, int total)
 {
-    // Find hash position of old distance and delete it,
-    // then call_add_new_pos.
-    int old_total = dist[npos.x][npos.y] + estimated_cost(npos);
+    // The entry under the old total is left in the hash, and skipped by
+    // get_best_position() since it no longer matches queued.
+    add_new_pos(npos, total);
+}
 
-    vector<coord_def> &vec = hash[old_total];
-    for (unsigned int i = 0; i < vec.size(); i++)
+/////////////////////////////////////////////////////////////////////////////
+// Shared travel fields
+
+// Hostile monsters mostly head for the same foe, and many of them move the
+// same way. Rather than have each of them search for its own path, we work
+// outwards from the target once for every kind of movement and range, and
+// let each monster follow the distances downhill.
+//
+// The fields mirror what monster_pathfind would do for the same monster:
+// the same cells are traversable, entering them costs the same, no cell on
+// the path may be further than the range from the target, and no path may
+// cost more than twice the range. Among paths of equal cost the chosen one
+// may differ.
+//
+// Fields are dropped whenever time passes or terrain changes. Stationary
+// monsters that block paths can still come and go during a turn, which
+// a field won't notice until the next one.
+
+// What decides where a monster can go and how costly it is to get there,
+// for monsters that fit shared_travel_path().
+struct travel_class
+{
+    std::bitset<NUM_FEATURES> habitable;
+    std::bitset<NUM_FEATURES> flounders;
+    bool grounded;
+    bool passes_doors;
+
+    explicit travel_class(const monster& mon)
+        : grounded(mon.ground_level()),
+          passes_doors(mons_hostile_can_pass_doors(mon))
     {
-        if (vec[i] == npos)
+        for (int i = 0; i < NUM_FEATURES; ++i)
         {
-            vec.erase(vec.begin() + i);
-            break;
+            const dungeon_feature_type feat = static_cast<dungeon_feature_type>(i);
+            habitable[i] = mon.is_habitable_feat(feat);
+            flounders[i] = grounded && mon.floundering_in(feat);
         }
     }
 
-    add_new_pos(npos, total);
+    bool operator==(const travel_class& other) const
+    {
+        return habitable == other.habitable
+               && flounders == other.flounders
+               && grounded == other.grounded
+               && passes_doors == other.passes_doors;
+    }
+
+    // The same as monster_pathfind::traversable() for such monsters.
+    bool passable(const coord_def& p) const
+    {
+        const dungeon_feature_type grid = env.grid(p);
+        if (grid == DNGN_UNSEEN
+            || (opc_immob(p) == OPC_OPAQUE && !feat_is_closed_door(grid))
+            || cell_is_runed(p))
+        {
+            return false;
+        }
+
+        if (feat_is_closed_door(grid) && passes_doors
+            && env.markers.property_at(p, MAT_ANY, "door_restrict") != "veto")
+        {
+            return true;
+        }
+
+        return habitable[grid];
+    }
+
+    // The same as monster_pathfind::mons_travel_cost() for such monsters.
+    int cost(const coord_def& p) const
+    {
+        const dungeon_feature_type grid = env.grid(p);
+        if (feat_is_closed_door(grid))
+            return 2;
+        if (flounders[grid] || (grounded && liquefied(p)))
+            return 2;
+        if (const trap_def* ptrap = trap_at(p))
+            return ptrap->is_bad_for_player() ? 1 : 2;
+        return 1;
+    }
+};
+
+// The cost of the cheapest path from each cell to the target.
+struct travel_field
+{
+    coord_def target;
+    int range;
+    travel_class cls;
+    int dist[GXM][GYM];
+
+    travel_field(const coord_def& t, int r, const travel_class& c)
+        : target(t), range(r), cls(c)
+    {
+        fill();
+    }
+
+    bool reaches(const coord_def& p) const
+    {
+        return dist[p.x][p.y] != INFINITE_DISTANCE;
+    }
+
+private:
+    void fill();
+};
+
+// Dijkstra's algorithm outwards from the target, with a bucket queue as in
+// monster_pathfind since costs are small integers.
+void travel_field::fill()
+{
+    for (int x = 0; x < GXM; ++x)
+        for (int y = 0; y < GYM; ++y)
+            dist[x][y] = INFINITE_DISTANCE;
+
+    const int max_dist = range * 2;
+    vector<vector<coord_def>> queue(max_dist + 1);
+    dist[target.x][target.y] = 0;
+    queue[0].push_back(target);
+
+    for (int d = 0; d <= max_dist; ++d)
+    {
+        // Entries may be added to this bucket while it is worked through.
+        for (unsigned int i = 0; i < queue[d].size(); ++i)
+        {
+            const coord_def p = queue[d][i];
+            if (dist[p.x][p.y] != d)
+                continue;
+
+            const int nd = d + cls.cost(p);
+            if (nd > max_dist)
+                continue;
+
+            for (adjacent_iterator ai(p); ai; ++ai)
+            {
+                const coord_def n = *ai;
+                if (!in_bounds(n)
+                    || nd >= dist[n.x][n.y]
+                    || grid_distance(n, target) > range
+                    || !cls.passable(n))
+                {
+                    continue;
+                }
+                dist[n.x][n.y] = nd;
+                queue[nd].push_back(n);
+            }
+        }
+    }
+}
+
+// Fields computed since time last passed.
+static vector<unique_ptr<travel_field>> _travel_fields;
+static int _travel_fields_time = -1;
+static level_id _travel_fields_level;
+
+// More distinct fields than this in one turn aren't worth keeping; the
+// monsters beyond them search on their own.
+#define MAX_TRAVEL_FIELDS 32
+
+void clear_travel_fields()
+{
+    _travel_fields.clear();
+}
+
+static const travel_field* _get_travel_field(const coord_def& target,
+                                             int range,
+                                             const travel_class& cls)
+{
+    if (_travel_fields_time != you.elapsed_time
+        || _travel_fields_level != level_id::current())
+    {
+        clear_travel_fields();
+        _travel_fields_time = you.elapsed_time;
+        _travel_fields_level = level_id::current();
+    }
+
+    for (const auto &field : _travel_fields)
+        if (field->target == target && field->range == range
+            && field->cls == cls)
+        {
+            return field.get();
+        }
+
+    if (_travel_fields.size() >= MAX_TRAVEL_FIELDS)
+        return nullptr;
+
+    _travel_fields.emplace_back(new travel_field(target, range, cls));
+    return _travel_fields.back().get();
+}
+
+// The cost of reaching the target through n, if a field path may start
+// by stepping onto n.
+static int _cost_via(const travel_field& field, const coord_def& n)
+{
+    if (!in_bounds(n) || (n != field.target && !field.reaches(n)))
+        return INFINITE_DISTANCE;
+    return field.dist[n.x][n.y] + field.cls.cost(n);
+}
+
+/**
+ * Find a path for a hostile monster to the given target, as
+ * monster_pathfind::init_pathfind() with the given range would, but using
+ * distances shared with other monsters heading the same way.
+ *
+ * @param mon       The monster.
+ * @param target    Where it is going.
+ * @param range     How far from the target the path may stray.
+ * @param path      Set to every step of the path, from the monster's
+ *                  position to the target, if one is found.
+ * @return          Whether there is a path, or maybe if this monster can't
+ *                  use shared distances and needs its own search.
+ */
+maybe_bool shared_travel_steps(const monster& mon, const coord_def& target,
+                               int range, vector<coord_def>& path)
+{
+    // Allies avoid traps and keep in sight of the player, thorn hunters
+    // shelter behind briars, and in the arena traps are a danger to all.
+    if (mon.wont_attack() || mon.type == MONS_THORN_HUNTER
+        || crawl_state.game_is_arena())
+    {
+        return maybe_bool::maybe;
+    }
+
+    const travel_field* field = _get_travel_field(target, range,
+                                                  travel_class(mon));
+    if (!field)
+        return maybe_bool::maybe;
+
+    path.clear();
+    coord_def pos = mon.pos();
+    path.push_back(pos);
+    while (pos != target)
+    {
+        // Step to the neighbour on a cheapest path, preferring those
+        // nearest the target.
+        coord_def best;
+        int best_cost = INFINITE_DISTANCE;
+        int best_dist = INFINITE_DISTANCE;
+        for (adjacent_iterator ai(pos); ai; ++ai)
+        {
+            const int cost = _cost_via(*field, *ai);
+            const int dist = distance2(*ai, target);
+            if (cost < best_cost || (cost == best_cost && dist < best_dist))
+            {
+                best = *ai;
+                best_cost = cost;
+                best_dist = dist;
+            }
+        }
+
+        if (best_cost > range * 2)
+        {
+            path.clear();
+            return false;
+        }
+
+        pos = best;
+        path.push_back(pos);
+    }
+
+    return true;
+}
+
+/**
+ * As shared_travel_steps(), but giving only the waypoints of the path, as
+ * monster_pathfind::calc_waypoints() does.
+ */
+maybe_bool shared_travel_path(const monster& mon, const coord_def& target,
+                              int range, vector<coord_def>& waypoints)
+{
+    vector<coord_def> path;
+    const maybe_bool found = shared_travel_steps(mon, target, range, path);
+    if (found)
+        waypoints = _path_waypoints(&mon, path, false);
+    return found;
 }
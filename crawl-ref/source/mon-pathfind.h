@@ -2,7 +2,6 @@
 
 #include "coord-def.h"
 #include "defines.h"
-#include "fixedvector.h"
 #include "maybe-bool.h"
 #include <unordered_map>
 #include <vector>
@@ -10,8 +9,14 @@
 using std::vector;
 
 class monster;
+struct pathfind_grids;
 
 int mons_tracking_range(const monster* mon);
+maybe_bool shared_travel_steps(const monster& mon, const coord_def& target,
+                               int range, vector<coord_def>& path);
+maybe_bool shared_travel_path(const monster& mon, const coord_def& target,
+                              int range, vector<coord_def>& waypoints);
+void clear_travel_fields();
 
 class monster_pathfind
 {
@@ -47,6 +52,7 @@ protected:
     void add_new_pos(coord_def pos, int total);
     void update_pos(coord_def pos, int total);
     bool get_best_position();
+    int  dist(const coord_def& p) const;
 
     // The monster trying to find a path.
     const monster* mons;
@@ -85,12 +91,10 @@ protected:
     int min_length;
     int max_length;
 
-    // The array of distances from start to any already tried point.
-    int dist[GXM][GYM];
-    // An array to store where we came from on a given shortest path.
-    int prev[GXM][GYM];
+    // Distances, backtracking information and the queue of positions to
+    // look at, borrowed from a pool for the lifetime of this object.
+    pathfind_grids *grids;
 
-    FixedVector<vector<coord_def>, GXM * GYM> hash;
-
-    maybe_bool traversable_cache[GXM][GYM];
+private:
+    DISALLOW_COPY_AND_ASSIGN(monster_pathfind);
 };
@@ -836,6 +836,7 @@ monster* get_free_monster()
         if (mons.type == MONS_NO_MONSTER)
         {
             mons.reset();
+            env.mon_index.add(mons);
             return &mons;
         }
 
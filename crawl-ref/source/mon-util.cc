@@ -4144,6 +4144,20 @@ bool mons_can_destroy_door(const monster& mon, const coord_def& pos)
     return true;
 }
 
+/**
+ * Can a monster that isn't allied with the player get through any closed
+ * door without a door_restrict veto? For such monsters this is what
+ * _mons_can_pass_door() checks, apart from the veto.
+ */
+bool mons_hostile_can_pass_doors(const monster& mon)
+{
+    return mon.can_pass_through_feat(DNGN_FLOOR)
+           && (_mons_can_open_doors(&mon)
+               || mons_eats_items(mon)
+               || mons_class_flag(mons_base_type(mon), M_EAT_DOORS)
+               || mons_class_flag(mons_base_type(mon), M_CRASH_DOORS));
+}
+
 static bool _mons_can_pass_door(const monster* mon, const coord_def& pos)
 {
     return mon->can_pass_through_feat(DNGN_FLOOR)
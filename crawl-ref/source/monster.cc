@@ -170,6 +170,8 @@ void monster::reset()
     // Just for completeness.
     speed           = 0;
     colour         = COLOUR_INHERIT;
+
+    env.mon_index.remove(*this);
 }
 
 void monster::init_with(const monster& mon)
@@ -213,6 +215,9 @@ void monster::init_with(const monster& mon)
         ghost.reset(new ghost_demon(*mon.ghost));
     else
         ghost.reset(nullptr);
+
+    if (type != MONS_NO_MONSTER)
+        env.mon_index.add(*this);
 }
 
 uint32_t monster::last_client_id = 0;
@@ -268,7 +273,11 @@ bool monster::swimming() const
 
 bool monster::extra_balanced_at(const coord_def p) const
 {
-    const dungeon_feature_type grid = env.grid(p);
+    return extra_balanced_in(env.grid(p));
+}
+
+bool monster::extra_balanced_in(dungeon_feature_type grid) const
+{
     return grid == DNGN_SHALLOW_WATER
            && (mons_genus(type) == MONS_NAGA // tails, not feet
                || mons_genus(type) == MONS_SALAMANDER
@@ -291,17 +300,23 @@ bool monster::extra_balanced() const
  */
 bool monster::floundering_at(const coord_def p) const
 {
-    const dungeon_feature_type grid = env.grid(p);
-    return (liquefied(p)
-            || (feat_is_water(grid)
-                // Can't use monster_habitable_feat() because that'll return
-                // true for non-water monsters in shallow water.
-                && mons_primary_habitat(*this) != HT_WATER
-                // Use real_amphibious to detect giant non-water monsters in
-                // deep water, who flounder despite being treated as amphibious.
-                && mons_habitat(*this, true) != HT_AMPHIBIOUS
-                && !extra_balanced_at(p)))
-           && ground_level();
+    return (liquefied(p) || floundering_in(env.grid(p))) && ground_level();
+}
+
+/**
+ * Would the monster flounder in the given terrain, leaving aside
+ * liquefaction and flight?
+ */
+bool monster::floundering_in(dungeon_feature_type grid) const
+{
+    return feat_is_water(grid)
+           // Can't use monster_habitable_feat() because that'll return
+           // true for non-water monsters in shallow water.
+           && mons_primary_habitat(*this) != HT_WATER
+           // Use real_amphibious to detect giant non-water monsters in
+           // deep water, who flounder despite being treated as amphibious.
+           && mons_habitat(*this, true) != HT_AMPHIBIOUS
+           && !extra_balanced_in(grid);
 }
 
 bool monster::floundering() const
@@ -2603,6 +2618,7 @@ void monster::set_position(const coord_def &c)
     }
 
     actor::set_position(c);
+    env.mon_index.moved(*this);
 }
 
 void monster::moveto(const coord_def& c, bool clear_net, bool clear_constrict)
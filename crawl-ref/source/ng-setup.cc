@@ -646,6 +646,11 @@ static void _setup_generic(const newgame_def& ng,
     else
         you.save = new package(get_savedir_filename(you.your_name).c_str(),
                                true, true);
+    if (Options.async_save)
+        you.save->set_async();
+    if (!Options.no_save)
+        you.save->set_compact_slack(Options.save_compact_slack);
+    forget_cached_levels();
 
     // pregen temple -- it's quick and easy, and this prevents a popup from
     // happening. This needs to happen after you.save is created.
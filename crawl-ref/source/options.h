@@ -725,6 +725,9 @@ public:
     bool        single_column_item_menus;
 
     bool        dump_on_save;       // Automatically dump character when saving.
+    bool        async_save;         // Write saves in the background.
+    int         level_cache_size;   // KB of recent levels kept in memory.
+    int         save_compact_slack; // % of unused space that compacts the save.
     kill_dump_options dump_kill_places;   // How to dump place information for kills.
     int         dump_message_count; // How many old messages to dump
 
@@ -16,6 +16,18 @@ Notes:
 * Readers always get the last complete (but not necessarily committed) write
   (ie, READ_UNCOMMITTED) at the time they started; it is safe to continue
   reading even if the chunk has been changed since.
+* An asynchronous package (see set_async()) keeps written chunks in memory
+  until commit(), which hands them to a background thread to compress, write
+  and commit. The next commit() (or anything else that needs the file)
+  waits for it, and errors are reported there. A crash before the thread is
+  done returns the save to the commit before. flush() does the same short
+  of the commit, so that a long run of writes needn't wait for it to
+  compress everything at once.
+* A package opened read-only is memory-mapped where possible, and chunks are
+  decompressed straight from the mapping.
+* compact() copies the committed chunks into a new file, commits that, and
+  only then renames it over the old one; a crash at any point leaves either
+  the old or the new file, each with the same contents.
 */
 
 #include "AppHdr.h"
@@ -25,6 +37,7 @@ Notes:
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <exception>
 #include <sstream>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -38,6 +51,8 @@ Notes:
 #include "errors.h"
 #include "syscalls.h"
 #include "libutil.h" // map_find
+#include "mapped-file.h"
+#include "threads.h"
 
 // debugging defines
 #undef  FSCK_VERBOSE
@@ -59,9 +74,21 @@ static plen_t htole(plen_t x)
 #define dprintf(...) do {} while (0)
 #endif
 
-#define PACKAGE_VERSION 1
+// Version 2 tags each chunk in the directory with its codec. Packages
+// that don't need the tags are written as version 1, which older versions
+// can still read.
+#define PACKAGE_VERSION 2
+#define PACKAGE_VERSION_UNTAGGED 1
 #define PACKAGE_MAGIC   0x53534344 /* "DCSS" */
 
+// Only chunks that a plain inflate can't read are tagged. Fast deflate is
+// an ordinary zlib stream, so tagging it would only make the save version 2
+// for no reason, and older versions would refuse to load it.
+static bool _codec_needs_tag(chunk_codec codec)
+{
+    return codec == CODEC_STORED;
+}
+
 struct file_header
 {
     uint32_t magic;
@@ -81,11 +108,54 @@ typedef pair<plen_t, plen_t> bm_p;
 typedef map<plen_t, bm_p> bm_t;
 typedef map<plen_t, plen_t> fb_t;
 
+// The background commit of an asynchronous package.
+struct package_worker
+{
+    package_worker() : running(false), commit(false)
+    {
+        mutex_init(lock);
+    }
+
+    ~package_worker()
+    {
+        mutex_destroy(lock);
+    }
+
+    // Guards the block lists, the directory and the file offset, which
+    // the game thread's readers use while a commit is being written.
+    mutex_t lock;
+    thread_t thread;
+    bool running;
+    bool commit; // or only write the chunks, for flush()
+    std::exception_ptr error;
+};
+
+// Holds the lock of an asynchronous package for the current scope.
+class package_guard
+{
+public:
+    package_guard(package_worker *w) : worker(w)
+    {
+        if (worker)
+            mutex_lock(worker->lock);
+    }
+
+    ~package_guard()
+    {
+        if (worker)
+            mutex_unlock(worker->lock);
+    }
+
+private:
+    package_worker *worker;
+};
+
 package::package(const char* file, bool writeable, bool empty)
-  : n_users(0), dirty(false), aborted(false)
+  : n_users(0), dirty(false), aborted(false), compact_slack(0)
 #ifdef DO_FSYNC
     , tmp(false)
 #endif
+    , worker(nullptr), mapping(nullptr)
 {
     dprintf("package: initializing file=\"%s\" rw=%d\n", file, writeable);
     ASSERT(writeable || !empty);
@@ -132,10 +202,11 @@ package::package(const char* file, bool writeable, bool empty)
 }
 
 package::package()
-  : rw(true), n_users(0), dirty(false), aborted(false)
+  : rw(true), n_users(0), dirty(false), aborted(false), compact_slack(0)
 #ifdef DO_FSYNC
     , tmp(true)
 #endif
+    , worker(nullptr), mapping(nullptr)
 {
     dprintf("package: initializing tmp file\n");
     filename = "[tmp]";
@@ -180,6 +251,21 @@ void package::load()
     if (len == -1)
         sysfail("save file (%s) is not seekable", filename.c_str());
     file_len = len;
+
+#ifdef UNIX
+    // Nothing writes to the file while we hold it read-only, so the mapping
+    // stays good.
+    if (!rw)
+    {
+        mapping = new mapped_file;
+        if (!mapping->map(fd) || mapping->size() != file_len)
+        {
+            delete mapping;
+            mapping = nullptr;
+        }
+    }
+#endif
+
     read_directory(htole(head.start), head.version);
 
     if (rw)
@@ -188,6 +274,7 @@ void package::load()
 
 void package::load_traces()
 {
+    finish_commit();
     ASSERT(!dirty);
     ASSERT(!n_users);
     if (directory.empty() || !block_map.empty())
@@ -208,6 +295,8 @@ void package::load_traces()
 package::~package()
 {
     dprintf("package: finalizing\n");
+    // The background commit uses writers too.
+    finish_commit(!aborted);
     ASSERT(!n_users || CrawlIsCrashing); // not merely aborted, there are
         // live pointers to us. With normal stack unwinding, destructors
         // will make sure this never happens and this assert is good for
@@ -217,9 +306,12 @@ package::~package()
     if (rw && !aborted)
     {
         commit();
+        finish_commit();
         if (ftruncate(fd, file_len))
             sysfail("failed to update save file");
     }
+    delete worker;
+    delete mapping;
 
     // all errors here should be cached write errors
     if (fd != -1)
@@ -234,32 +326,255 @@ package::~package()
 void package::commit()
 {
     ASSERT(rw);
-    if (!dirty)
+    if (!worker)
+    {
+        write_commit();
+        maybe_compact();
+        return;
+    }
+
+    finish_commit();
+    maybe_compact();
+    if (queued.empty() && !dirty)
         return;
     ASSERT(!aborted);
+    start_pending(true);
+}
 
-#ifdef COSTLY_ASSERTS
-    fsck();
+// Start writing out the chunks written so far, without committing them:
+// like for a synchronous package, they become part of the save at the
+// next commit(). Does nothing unless the package is asynchronous.
+void package::flush()
+{
+    ASSERT(rw);
+    if (!worker)
+        return;
+
+    finish_commit();
+    if (queued.empty())
+        return;
+    ASSERT(!aborted);
+    start_pending(false);
+}
+
+// Hand the queued chunks over to the background thread.
+void package::start_pending(bool commit)
+{
+    in_flight.swap(queued);
+    worker->commit = commit;
+    worker->running = !thread_create_joinable(&worker->thread,
+                                              commit_thread, this);
+    // No thread to be had; do it ourselves.
+    if (!worker->running)
+    {
+        write_pending();
+        in_flight.clear();
+    }
+}
+
+// Keep chunks in memory until commit(), and write them in the background
+// from then on.
+void package::set_async()
+{
+    ASSERT(rw);
+    if (!worker)
+        worker = new package_worker;
+}
+
+// Compact the file whenever a commit leaves more than this percentage of
+// it unused; 0 never does.
+void package::set_compact_slack(int percent)
+{
+    ASSERT(rw);
+    compact_slack = percent;
+}
+
+void package::maybe_compact()
+{
+    if (!compact_slack || n_users || dirty || aborted)
+        return;
+#ifdef DO_FSYNC
+    if (tmp)
+        return;
+#endif
+    const uint64_t slack = get_slack();
+    // If the new file can't be put in place (on Windows, for one, renaming
+    // over an open file fails), don't copy the whole save again at every
+    // commit; leave it be for the rest of the session.
+    if (slack * 100 >= (uint64_t)file_len * compact_slack && !compact())
+        compact_slack = 0;
+}
+
+// Rewrite the file with every chunk in one piece and no unused space, and
+// swap it in for the old one. Returns false, leaving the old file in use,
+// if the new one can't be put in place.
+bool package::compact()
+{
+    ASSERT(rw);
+    ASSERT(!aborted);
+    ASSERT(!n_users);
+    finish_commit();
+    ASSERT(!dirty);
+    load_traces();
+
+    const string tmpname = filename + ".tmp";
+    package dest(tmpname.c_str(), true, true);
+    for (const auto &entry : directory)
+    {
+        // The new directory is written by the commit.
+        if (entry.first.empty())
+            continue;
+
+        // Copy the chunk as it is on disk, without decompressing it.
+        {
+            chunk_reader in(this, entry.second, CODEC_STORED);
+            chunk_writer out(&dest, entry.first, CODEC_STORED, false);
+            char buf[16384];
+            while (plen_t s = in.read(buf, sizeof(buf)))
+                out.write(buf, s);
+        }
+        if (const chunk_codec *codec = map_find(codecs, entry.first))
+            dest.codecs[entry.first] = *codec;
+        else
+            dest.codecs.erase(entry.first);
+    }
+    dest.write_commit();
+
+    if (rename_u(tmpname.c_str(), filename.c_str()))
+    {
+        dest.unlink();
+        return false;
+    }
+#if defined(DO_FSYNC) && defined(UNIX)
+    // Make the rename itself durable, or a crash could bring back the old
+    // file after we had committed to the new one.
+    const string::size_type slash = filename.rfind('/');
+    const string dir = slash == string::npos ? "." : filename.substr(0, slash);
+    const int dir_fd = open_u(dir.c_str(), O_RDONLY, 0);
+    if (dir_fd != -1)
+    {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
 #endif
 
+    // Take over the new file, leaving dest with the old one to close.
+    swap(fd, dest.fd);
+    swap(file_len, dest.file_len);
+    swap(directory, dest.directory);
+    swap(codecs, dest.codecs);
+    swap(free_blocks, dest.free_blocks);
+    swap(unlinked_blocks, dest.unlinked_blocks);
+    swap(block_map, dest.block_map);
+    swap(new_chunks, dest.new_chunks);
+    ASSERT(reader_count.empty());
+    dest.aborted = true;
+    return true;
+}
+
+void *package::commit_thread(void *arg)
+{
+    package *pkg = static_cast<package *>(arg);
+    try
+    {
+        pkg->write_pending();
+    }
+    catch (...)
+    {
+        pkg->worker->error = std::current_exception();
+    }
+    return nullptr;
+}
+
+// Write out the chunks handed over by commit() or flush(), and commit them
+// if it was the former.
+void package::write_pending()
+{
+    for (const auto &entry : in_flight)
+    {
+        if (const auto &data = entry.second.data)
+        {
+            chunk_writer ch(this, entry.first, entry.second.codec, false);
+            if (!data->empty())
+                ch.write(&(*data)[0], data->size());
+        }
+        else
+        {
+            package_guard guard(worker);
+            erase_chunk(entry.first);
+        }
+    }
+    if (worker->commit)
+        write_commit();
+}
+
+// Wait for the commit in progress, if any.
+void package::finish_commit(bool report_errors)
+{
+    if (!worker || !worker->running)
+        return;
+
+    thread_join(worker->thread);
+    worker->running = false;
+    in_flight.clear();
+
+    std::exception_ptr error = worker->error;
+    worker->error = nullptr;
+    if (error && report_errors)
+        std::rethrow_exception(error);
+}
+
+// The latest write or deletion of this chunk that hasn't been written out
+// yet, if any.
+const pending_chunk *package::find_pending(const string &name) const
+{
+    for (const auto *pending : { &queued, &in_flight })
+    {
+        auto ch = pending->find(name);
+        if (ch != pending->end())
+            return &ch->second;
+    }
+    return nullptr;
+}
+
+// Readers may go on while the background commit waits for the disk, so it
+// only holds the lock while it uses the block lists or the file offset.
+void package::write_commit()
+{
     file_header head;
-    head.magic = htole(PACKAGE_MAGIC);
-    head.version = PACKAGE_VERSION;
-    memset(&head.padding, 0, sizeof(head.padding));
-    head.start = htole(write_directory());
+    {
+        package_guard guard(worker);
+        if (!dirty)
+            return;
+        ASSERT(!aborted);
+
+#ifdef COSTLY_ASSERTS
+        fsck();
+#endif
+
+        head.magic = htole(PACKAGE_MAGIC);
+        head.version = codecs.empty() ? PACKAGE_VERSION_UNTAGGED
+                                      : PACKAGE_VERSION;
+        memset(&head.padding, 0, sizeof(head.padding));
+        head.start = htole(write_directory());
+    }
 #ifdef DO_FSYNC
     // We need a barrier before updating the link to point at the new directory.
     if (!tmp && fdatasync(fd))
         sysfail("flush error while saving");
 #endif
-    seek(0);
-    if (write(fd, &head, sizeof(head)) != sizeof(head))
-        sysfail("write error while saving");
+    {
+        package_guard guard(worker);
+        seek(0);
+        if (write(fd, &head, sizeof(head)) != sizeof(head))
+            sysfail("write error while saving");
+    }
 #ifdef DO_FSYNC
     if (!tmp && fdatasync(fd))
         sysfail("flush error while saving");
 #endif
 
+    package_guard guard(worker);
     new_chunks.clear();
     collect_blocks();
     dirty = false;
@@ -279,15 +594,39 @@ void package::seek(plen_t to)
         sysfail("failed to seek inside the save file");
 }
 
-chunk_writer* package::writer(const string &name)
+// Read len bytes of the file, from the mapping if there is one.
+void package::read_at(plen_t at, void *data, plen_t len)
 {
-    return new chunk_writer(this, name);
+    if (mapping)
+    {
+        ASSERT(!aborted);
+        if (at > file_len || len > file_len - at)
+            corrupted("save file corrupted -- block past eof");
+        memcpy(data, mapping->data() + at, len);
+        return;
+    }
+
+    seek(at);
+    ssize_t res = ::read(fd, data, len);
+    if (res < 0)
+        sysfail("error reading the save file");
+    if ((plen_t)res != len)
+        corrupted("save file corrupted -- block past eof");
+}
+
+chunk_writer* package::writer(const string &name, chunk_codec codec)
+{
+    return new chunk_writer(this, name, codec);
 }
 
 chunk_reader* package::reader(const string &name)
 {
+    if (const pending_chunk *pending = find_pending(name))
+        return pending->data ? new chunk_reader(this, name) : 0;
+
+    package_guard guard(worker);
     if (plen_t *ch = map_find(directory, name))
-        return new chunk_reader(this, *ch);
+        return new chunk_reader(this, *ch, get_chunk_codec(name));
     return 0;
 }
 
@@ -359,10 +698,14 @@ plen_t package::alloc_block(plen_t &size)
     return at;
 }
 
-void package::finish_chunk(const string &name, plen_t at)
+void package::finish_chunk(const string &name, plen_t at, chunk_codec codec)
 {
     free_chunk(name);
     directory[name] = at;
+    if (_codec_needs_tag(codec))
+        codecs[name] = codec;
+    else
+        codecs.erase(name);
     new_chunks.insert(at);
     dirty = true;
 }
@@ -383,14 +726,23 @@ void package::free_chunk(const string &name)
 }
 
 void package::delete_chunk(const string &name)
+{
+    if (worker)
+        queued[name] = { nullptr, CODEC_ZLIB };
+    else
+        erase_chunk(name);
+}
+
+void package::erase_chunk(const string &name)
 {
     free_chunk(name);
     directory.erase(name);
+    codecs.erase(name);
 }
 
 plen_t package::write_directory()
 {
-    delete_chunk("");
+    erase_chunk("");
 
     stringstream dir;
     for (const auto &entry : directory)
@@ -398,6 +750,12 @@ plen_t package::write_directory()
         uint8_t name_len = entry.first.length();
         dir.write((const char*)&name_len, sizeof(name_len));
         dir.write(&entry.first[0], entry.first.length());
+        if (!codecs.empty())
+        {
+            const chunk_codec *ch = map_find(codecs, entry.first);
+            const uint8_t codec = ch ? *ch : CODEC_ZLIB;
+            dir.write((const char*)&codec, sizeof(codec));
+        }
         plen_t start = htole(entry.second);
         dir.write((const char*)&start, sizeof(plen_t));
     }
@@ -405,7 +763,7 @@ plen_t package::write_directory()
     ASSERT(dir.str().size());
     dprintf("writing directory (%u bytes)\n", (unsigned int)dir.str().size());
     {
-        chunk_writer dch(this, "");
+        chunk_writer dch(this, "", CODEC_ZLIB, false);
         dch.write(&dir.str()[0], dir.str().size());
     }
 
@@ -523,7 +881,7 @@ void package::read_directory(plen_t start, uint8_t version)
     directory[""] = start;
 
     dprintf("package: reading directory\n");
-    chunk_reader rd(this, start);
+    chunk_reader rd(this, start, CODEC_ZLIB);
 
     switch (version)
     {
@@ -540,7 +898,9 @@ void package::read_directory(plen_t start, uint8_t version)
         }
         break;
     case 1:
+    case 2:
         uint8_t name_len;
+        uint8_t codec;
         plen_t bstart;
         while (plen_t res = rd.read(&name_len, sizeof(name_len)))
         {
@@ -550,6 +910,20 @@ void package::read_directory(plen_t start, uint8_t version)
             chname.resize(name_len);
             if (rd.read(&chname[0], name_len) != name_len)
                 corrupted("save file corrupted -- truncated directory");
+            if (version >= 2)
+            {
+                if (rd.read(&codec, sizeof(codec)) != sizeof(codec))
+                    corrupted("save file corrupted -- truncated directory");
+                if (codec >= NUM_CHUNK_CODECS)
+                {
+                    corrupted("save file (%s) uses an unknown codec %u",
+                              filename.c_str(), codec);
+                }
+                // Drop tags that aren't needed, so that the save goes back
+                // to version 1 when it can.
+                if (_codec_needs_tag((chunk_codec)codec))
+                    codecs[chname] = (chunk_codec)codec;
+            }
             if (rd.read(&bstart, sizeof(bstart)) != sizeof(bstart))
                 corrupted("save file corrupted -- truncated directory");
             directory[chname] = htole(bstart);
@@ -564,15 +938,30 @@ void package::read_directory(plen_t start, uint8_t version)
 
 bool package::has_chunk(const string &name)
 {
+    if (const pending_chunk *pending = find_pending(name))
+        return pending->data != nullptr;
+
+    package_guard guard(worker);
     return !name.empty() && directory.count(name);
 }
 
 vector<string> package::list_chunks()
 {
+    map<string, bool> present;
+    {
+        package_guard guard(worker);
+        for (const auto &entry : directory)
+            if (!entry.first.empty())
+                present[entry.first] = true;
+    }
+    for (const auto *pending : { &in_flight, &queued })
+        for (const auto &entry : *pending)
+            present[entry.first] = entry.second.data != nullptr;
+
     vector<string> list;
-    list.reserve(directory.size());
-    for (const auto &entry : directory)
-        if (!entry.first.empty())
+    list.reserve(present.size());
+    for (const auto &entry : present)
+        if (entry.second)
             list.push_back(entry.first);
 
     return list;
@@ -583,12 +972,7 @@ void package::trace_chunk(plen_t start)
     while (start)
     {
         block_header bl;
-        seek(start);
-        ssize_t res = ::read(fd, &bl, sizeof(block_header));
-        if (res < 0)
-            sysfail("error reading the save file");
-        if (res != sizeof(block_header))
-            corrupted("save file corrupted -- block past eof");
+        read_at(start, &bl, sizeof(block_header));
 
         plen_t len  = htole(bl.len);
         plen_t next = htole(bl.next);
@@ -619,6 +1003,8 @@ void package::abort()
     // Disable any further operations, allow a shutdown. All errors past
     // this point are ignored (assuming we already failed). All writes since
     // the last commit() are lost.
+    finish_commit(false);
+    queued.clear();
     aborted = true;
 }
 
@@ -673,7 +1059,35 @@ plen_t package::get_chunk_compressed_length(const string &name)
     return len;
 }
 
-chunk_writer::chunk_writer(package *parent, const string &_name)
+chunk_codec package::get_chunk_codec(const string &name)
+{
+    if (const pending_chunk *pending = find_pending(name))
+        return _codec_needs_tag(pending->codec) ? pending->codec : CODEC_ZLIB;
+
+    package_guard guard(worker);
+    const chunk_codec *codec = map_find(codecs, name);
+    return codec ? *codec : CODEC_ZLIB;
+}
+
+const char *chunk_codec_name(chunk_codec codec)
+{
+    switch (codec)
+    {
+    case CODEC_ZLIB:      return "zlib";
+    case CODEC_ZLIB_FAST: return "zlib-fast";
+    case CODEC_STORED:    return "stored";
+    default:              return "buggy";
+    }
+}
+
+chunk_writer::chunk_writer(package *parent, const string &_name,
+                           chunk_codec _codec)
+    : chunk_writer(parent, _name, _codec, parent && parent->worker)
+{
+}
+
+chunk_writer::chunk_writer(package *parent, const string &_name,
+                           chunk_codec _codec, bool deferred)
     : first_block(0), cur_block(0), block_len(0)
 {
     ASSERT(parent);
@@ -685,16 +1099,37 @@ chunk_writer::chunk_writer(package *parent, const string &_name)
 
     dprintf("chunk_writer(%s): starting\n", _name.c_str());
     pkg = parent;
-    pkg->n_users++;
+    {
+        package_guard guard(pkg->worker);
+        pkg->n_users++;
+    }
     name = _name;
+    ASSERT(_codec < NUM_CHUNK_CODECS);
+#ifdef USE_ZLIB
+    codec = _codec;
+#else
+    codec = CODEC_STORED;
+#endif
+
+    if (deferred)
+    {
+        buffer = make_shared<vector<char>>();
+        return;
+    }
 
 #ifdef USE_ZLIB
+    if (codec == CODEC_STORED)
+        return;
+
     zs.data_type = Z_BINARY;
     zs.zalloc    = 0;
     zs.zfree     = 0;
     zs.opaque    = Z_NULL;
-    if (deflateInit(&zs, Z_DEFAULT_COMPRESSION))
+    if (deflateInit(&zs, codec == CODEC_ZLIB_FAST ? Z_BEST_SPEED
+                                                  : Z_DEFAULT_COMPRESSION))
+    {
         fail("save file compression failed during init: %s", zs.msg);
+    }
 #define ZB_SIZE 32768
     zs.next_out  = z_buffer = (Bytef*)malloc(ZB_SIZE);
     zs.avail_out = ZB_SIZE;
@@ -705,22 +1140,34 @@ chunk_writer::~chunk_writer()
 {
     dprintf("chunk_writer(%s): closing\n", name.c_str());
 
-    ASSERT(pkg->n_users > 0);
-    pkg->n_users--;
+    {
+        package_guard guard(pkg->worker);
+        ASSERT(pkg->n_users > 0);
+        pkg->n_users--;
+    }
+    if (buffer)
+    {
+        if (!pkg->aborted)
+            pkg->queued[name] = { buffer, codec };
+        return;
+    }
     if (pkg->aborted)
     {
 #ifdef USE_ZLIB
-        // ignore errors, they're not relevant anymore
-        deflateEnd(&zs);
-        free(z_buffer);
+        if (codec != CODEC_STORED)
+        {
+            // ignore errors, they're not relevant anymore
+            deflateEnd(&zs);
+            free(z_buffer);
+        }
 #endif
         return;
     }
 
 #ifdef USE_ZLIB
+    int res = codec == CODEC_STORED ? Z_STREAM_END : Z_OK;
     zs.avail_in = 0;
-    int res;
-    do
+    while (res != Z_STREAM_END)
     {
         res = deflate(&zs, Z_FINISH);
         if (res != Z_STREAM_END && res != Z_OK && res != Z_BUF_ERROR)
@@ -728,18 +1175,26 @@ chunk_writer::~chunk_writer()
         raw_write(z_buffer, zs.next_out - z_buffer);
         zs.next_out = z_buffer;
         zs.avail_out = ZB_SIZE;
-    } while (res != Z_STREAM_END);
-    if (deflateEnd(&zs) != Z_OK)
-        fail("save file compression failed during clean-up: %s", zs.msg);
-    free(z_buffer);
+        if (res == Z_STREAM_END)
+        {
+            if (deflateEnd(&zs) != Z_OK)
+            {
+                fail("save file compression failed during clean-up: %s",
+                     zs.msg);
+            }
+            free(z_buffer);
+        }
+    }
 #endif
+    package_guard guard(pkg->worker);
     if (cur_block)
         finish_block(0);
-    pkg->finish_chunk(name, first_block);
+    pkg->finish_chunk(name, first_block, codec);
 }
 
 void chunk_writer::raw_write(const void *data, plen_t len)
 {
+    package_guard guard(pkg->worker);
     while (len > 0)
     {
         plen_t space = pkg->extend_block(cur_block, block_len, len);
@@ -782,6 +1237,19 @@ void chunk_writer::write(const void *data, plen_t len)
     ASSERT(data);
     ASSERT(!pkg->aborted);
 
+    if (buffer)
+    {
+        buffer->insert(buffer->end(), (const char*)data,
+                       (const char*)data + len);
+        return;
+    }
+
+    if (codec == CODEC_STORED)
+    {
+        raw_write(data, len);
+        return;
+    }
+
 #ifdef USE_ZLIB
     zs.next_in  = (Bytef*)data;
     zs.avail_in = len;
@@ -797,19 +1265,23 @@ void chunk_writer::write(const void *data, plen_t len)
         if (deflate(&zs, Z_NO_FLUSH) != Z_OK)
             fail("save file compression failed: %s", zs.msg);
     }
-#else
-    raw_write(data, len);
 #endif
 }
 
 void chunk_reader::init(plen_t start)
 {
     ASSERT(!pkg->aborted);
-    pkg->n_users++;
-    pkg->reader_count[start]++;
+    {
+        package_guard guard(pkg->worker);
+        pkg->n_users++;
+        pkg->reader_count[start]++;
+    }
     first_block = next_block = start;
     block_left = 0;
 
+    if (codec == CODEC_STORED)
+        return;
+
 #ifdef USE_ZLIB
     if (!start)
         corrupted("save file corrupted -- zlib header missing");
@@ -822,14 +1294,17 @@ void chunk_reader::init(plen_t start)
     if (inflateInit(&zs))
         fail("save file decompression failed during init: %s", zs.msg);
     eof = false;
+#else
+    corrupted("save file compressed, but zlib is not available");
 #endif
 }
 
-chunk_reader::chunk_reader(package *parent, plen_t start)
+chunk_reader::chunk_reader(package *parent, plen_t start, chunk_codec _codec)
 {
     ASSERT(parent);
     dprintf("chunk_reader[%u]: starting\n", start);
     pkg = parent;
+    codec = _codec;
     init(start);
 }
 
@@ -840,15 +1315,40 @@ chunk_reader::chunk_reader(package *parent, const string &_name)
         corrupted("save file corrupted -- chunk \"%s\" missing", _name.c_str());
     dprintf("chunk_reader(%s): starting\n", _name.c_str());
     pkg = parent;
-    init(parent->directory[_name]);
+
+    codec = pkg->get_chunk_codec(_name);
+    if (const pending_chunk *pending = pkg->find_pending(_name))
+    {
+        buffer = pending->data;
+        first_block = next_block = 0;
+        off = block_left = 0;
+        package_guard guard(pkg->worker);
+        pkg->n_users++;
+        return;
+    }
+
+    plen_t start;
+    {
+        package_guard guard(pkg->worker);
+        start = pkg->directory[_name];
+    }
+    init(start);
 }
 
 chunk_reader::~chunk_reader()
 {
     dprintf("chunk_reader: closing\n");
 
+    package_guard guard(pkg->worker);
+    if (buffer)
+    {
+        ASSERT(pkg->n_users > 0);
+        pkg->n_users--;
+        return;
+    }
+
 #ifdef USE_ZLIB
-    if (inflateEnd(&zs) != Z_OK)
+    if (codec != CODEC_STORED && inflateEnd(&zs) != Z_OK)
         fail("save file decompression failed during clean-up: %s", zs.msg);
 #endif
     ASSERT(pkg->reader_count[first_block] > 0);
@@ -858,42 +1358,37 @@ chunk_reader::~chunk_reader()
     pkg->n_users--;
 }
 
+// Move on to the next block once the current one is used up. Returns false
+// at the end of the chunk.
+bool chunk_reader::start_block()
+{
+    if (block_left)
+        return true;
+    if (!next_block)
+        return false;
+
+    block_header bl;
+    pkg->read_at(next_block, &bl, sizeof(block_header));
+
+    off = next_block + sizeof(block_header);
+    block_left = htole(bl.len);
+    next_block = htole(bl.next);
+    // This reeks of on-disk corruption (zeroed data).
+    if (!block_left)
+        corrupted("save file corrupted -- empty block");
+    return true;
+}
+
 plen_t chunk_reader::raw_read(void *data, plen_t len)
 {
+    package_guard guard(pkg->worker);
     void *buf = data;
-    while (len)
+    while (len && start_block())
     {
-        if (!block_left)
-        {
-            if (!next_block)
-                return (char*)buf - (char*)data;
-
-            block_header bl;
-            pkg->seek(next_block);
-            ssize_t res = ::read(pkg->fd, &bl, sizeof(block_header));
-            if (res < 0)
-                sysfail("error reading the save file");
-            if (res != sizeof(block_header))
-                corrupted("save file corrupted -- block past eof");
-
-            off = next_block + sizeof(block_header);
-            block_left = htole(bl.len);
-            next_block = htole(bl.next);
-            // This reeks of on-disk corruption (zeroed data).
-            if (!block_left)
-                corrupted("save file corrupted -- empty block");
-        }
-        else
-            pkg->seek(off);
-
         plen_t s = len;
         if (s > block_left)
             s = block_left;
-        ssize_t res = ::read(pkg->fd, buf, s);
-        if (res < 0)
-            sysfail("error reading the save file");
-        if ((plen_t)res != s)
-            corrupted("save file corrupted -- block past eof");
+        pkg->read_at(off, buf, s);
 
         buf = (char*)buf + s;
         off += s;
@@ -910,6 +1405,18 @@ plen_t chunk_reader::read(void *data, plen_t len)
     if (pkg->aborted)
         return 0;
 
+    if (buffer)
+    {
+        len = min<plen_t>(len, buffer->size() - off);
+        if (len)
+            memcpy(data, &(*buffer)[off], len);
+        off += len;
+        return len;
+    }
+
+    if (codec == CODEC_STORED)
+        return raw_read(data, len);
+
 #ifdef USE_ZLIB
     if (!len)
         return 0;
@@ -920,7 +1427,19 @@ plen_t chunk_reader::read(void *data, plen_t len)
     zs.avail_out = len;
     while (zs.avail_out)
     {
-        if (!zs.avail_in)
+        if (!zs.avail_in && pkg->mapping)
+        {
+            // Inflate a whole block at a time, in place.
+            if (!start_block())
+                corrupted("save file corrupted -- block truncated");
+            if (off > pkg->file_len || block_left > pkg->file_len - off)
+                corrupted("save file corrupted -- block past eof");
+            zs.next_in  = (Bytef*)pkg->mapping->data() + off;
+            zs.avail_in = block_left;
+            off += block_left;
+            block_left = 0;
+        }
+        else if (!zs.avail_in)
         {
             zs.next_in  = z_buffer;
             zs.avail_in = raw_read(z_buffer, sizeof(z_buffer));
@@ -938,7 +1457,7 @@ plen_t chunk_reader::read(void *data, plen_t len)
     }
     return zs.next_out - (Bytef*)data;
 #else
-    return raw_read(data, len);
+    return 0;
 #endif
 }
 
@@ -3,6 +3,7 @@
 #define USE_ZLIB
 
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <vector>
@@ -13,6 +14,7 @@
 using std::map;
 using std::pair;
 using std::set;
+using std::shared_ptr;
 using std::string;
 using std::vector;
 
@@ -24,16 +26,45 @@ using std::vector;
 
 typedef uint32_t plen_t;
 
+// How a chunk is encoded in the file. Saves without a codec tag in the
+// directory use CODEC_ZLIB throughout. Only CODEC_STORED chunks are tagged;
+// the others read back as CODEC_ZLIB.
+enum chunk_codec : uint8_t
+{
+    CODEC_ZLIB,      // deflate at the default level
+    CODEC_ZLIB_FAST, // deflate at the fastest level; reads like CODEC_ZLIB
+    CODEC_STORED,    // not compressed
+    NUM_CHUNK_CODECS
+};
+
+const char *chunk_codec_name(chunk_codec codec);
+
+class mapped_file;
 class package;
+struct package_worker;
+
+// A chunk written to an asynchronous package but not yet to the file. It
+// was deleted if there is no data.
+struct pending_chunk
+{
+    shared_ptr<vector<char>> data;
+    chunk_codec codec;
+};
 
 class chunk_writer
 {
 private:
+    chunk_writer(package *parent, const string &_name, chunk_codec _codec,
+                 bool deferred);
     package *pkg;
     string name;
+    chunk_codec codec;
     plen_t first_block;
     plen_t cur_block;
     plen_t block_len;
+    // For an asynchronous package, the uncompressed chunk, which is handed
+    // to the package when the writer is closed.
+    shared_ptr<vector<char>> buffer;
 #ifdef USE_ZLIB
     z_stream zs;
     Bytef *z_buffer;
@@ -41,7 +72,8 @@ private:
     void raw_write(const void *data, plen_t len);
     void finish_block(plen_t next);
 public:
-    chunk_writer(package *parent, const string &_name);
+    chunk_writer(package *parent, const string &_name,
+                 chunk_codec _codec = CODEC_ZLIB);
     ~chunk_writer();
     void write(const void *data, plen_t len);
     friend class package;
@@ -50,16 +82,20 @@ public:
 class chunk_reader
 {
 private:
-    chunk_reader(package *parent, plen_t start);
+    chunk_reader(package *parent, plen_t start, chunk_codec _codec);
     void init(plen_t start);
     package *pkg;
+    chunk_codec codec;
     plen_t first_block, next_block;
     plen_t off, block_left;
+    // A chunk that is still waiting to be written out, read as is.
+    shared_ptr<const vector<char>> buffer;
 #ifdef USE_ZLIB
     bool eof;
     z_stream zs;
     Bytef z_buffer[32768];
 #endif
+    bool start_block();
     plen_t raw_read(void *data, plen_t len);
 public:
     chunk_reader(package *parent, const string &_name);
@@ -75,9 +111,14 @@ public:
     package(const char* file, bool writeable, bool empty = false);
     package();
     ~package();
-    chunk_writer* writer(const string &name);
+    chunk_writer* writer(const string &name,
+                         chunk_codec codec = CODEC_ZLIB);
     chunk_reader* reader(const string &name);
     void commit();
+    void flush();
+    void set_async();
+    void set_compact_slack(int percent);
+    bool compact();
     void delete_chunk(const string &name);
     bool has_chunk(const string &name);
     vector<string> list_chunks();
@@ -90,6 +131,7 @@ public:
     plen_t get_size() const { return file_len; };
     plen_t get_chunk_fragmentation(const string &name);
     plen_t get_chunk_compressed_length(const string &name);
+    chunk_codec get_chunk_codec(const string &name);
 private:
     string filename;
     bool rw;
@@ -98,24 +140,43 @@ private:
     int n_users;
     bool dirty;
     bool aborted;
+    int compact_slack;
 #ifdef DO_FSYNC
     bool tmp;
 #endif
+    // Asynchronous packages only: chunks written (or deleted, if null)
+    // since the last commit(), and those being written by the commit that
+    // is still in progress.
+    package_worker *worker;
+    // Read-only packages only: the file, mapped into memory if possible.
+    mapped_file *mapping;
+    map<string, pending_chunk> queued;
+    map<string, pending_chunk> in_flight;
     map<string, plen_t> directory;
+    map<string, chunk_codec> codecs; // tagged chunks only
     map<plen_t, plen_t> free_blocks;
     vector<plen_t> unlinked_blocks;
     map<plen_t, pair<plen_t, plen_t> > block_map;
     set<plen_t> new_chunks;
     map<plen_t, uint32_t> reader_count;
+    const pending_chunk *find_pending(const string &name) const;
+    void start_pending(bool commit);
+    void write_pending();
+    void write_commit();
+    void finish_commit(bool report_errors = true);
+    void maybe_compact();
+    static void *commit_thread(void *arg);
     plen_t extend_block(plen_t at, plen_t size, plen_t by);
     plen_t alloc_block(plen_t &size);
-    void finish_chunk(const string &name, plen_t at);
+    void finish_chunk(const string &name, plen_t at, chunk_codec codec);
     void free_chunk(const string &name);
+    void erase_chunk(const string &name);
     plen_t write_directory();
     void collect_blocks();
     void free_block_chain(plen_t at);
     void free_block(plen_t at, plen_t size);
     void seek(plen_t to);
+    void read_at(plen_t at, void *data, plen_t len);
     void fsck();
     void read_directory(plen_t start, uint8_t version);
     void trace_chunk(plen_t start);
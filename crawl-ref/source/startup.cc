@@ -29,6 +29,7 @@
 #include "items.h"
 #include "libutil.h"
 #include "loading-screen.h"
+#include "los.h"
 #include "macro.h"
 #include "maps.h"
 #include "menu.h"
@@ -150,6 +151,10 @@ static void _initialize()
     read_maps();
     run_map_global_preludes();
 
+    // Load the LOS ray tables from the des cache, or precompute and
+    // cache them, so that -builddb leaves them for later processes.
+    init_los_tables(get_descache_path("los", ".cache"));
+
     if (crawl_state.build_db)
         end(0);
 
@@ -176,6 +181,12 @@ static void _initialize()
     }
 #endif
 
+    if (!crawl_state.bench_save.empty())
+    {
+        release_cli_signals();
+        bench_save(crawl_state.bench_save);
+    }
+
     if (!crawl_state.test_list)
     {
         if (!crawl_state.io_inited)
@@ -143,6 +143,15 @@ bool read_urandom(char *buf, int len)
 #endif
 }
 
+int process_id()
+{
+#ifdef TARGET_OS_WINDOWS
+    return GetCurrentProcessId();
+#else
+    return getpid();
+#endif
+}
+
 #ifdef TARGET_OS_WINDOWS
 # ifndef UNIX
 // should check the presence of alarm() instead
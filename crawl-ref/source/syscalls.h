@@ -14,6 +14,8 @@ bool unlock_file(int fd);
 
 bool read_urandom(char *buf, int len);
 
+int process_id();
+
 #ifdef TARGET_OS_WINDOWS
 # ifndef UNIX
 void alarm(unsigned int seconds);
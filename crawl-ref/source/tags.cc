@@ -115,16 +115,18 @@ extern set<pair<string, level_id> > auto_unique_annotations;
 extern abyss_state abyssal_state;
 
 reader::reader(const string &_read_filename, int minorVersion)
-    : _filename(_read_filename), _chunk(0), _pbuf(nullptr), _read_offset(0),
-      _minorVersion(minorVersion), _safe_read(false)
+    : _filename(_read_filename), _chunk(0), _pbuf(nullptr), _pbuf_size(0),
+      _read_offset(0), _buffer_pos(0), _buffer_end(0), _minorVersion(minorVersion),
+      _safe_read(false)
 {
     _file       = fopen_u(_filename.c_str(), "rb");
     opened_file = !!_file;
 }
 
 reader::reader(package *save, const string &chunkname, int minorVersion)
-    : _file(0), _chunk(0), opened_file(false), _pbuf(0), _read_offset(0),
-     _minorVersion(minorVersion), _safe_read(false)
+    : _file(0), _chunk(0), opened_file(false), _pbuf(0), _pbuf_size(0),
+      _read_offset(0), _buffer(writer::CHUNK_BUFFER_SIZE), _buffer_pos(0), _buffer_end(0),
+      _minorVersion(minorVersion), _safe_read(false)
 {
     ASSERT(save);
     _chunk = new chunk_reader(save, chunkname);
@@ -146,6 +148,13 @@ void reader::close()
 
 void reader::advance(size_t offset)
 {
+    // Buffers can skip ahead without copying.
+    if (_pbuf)
+    {
+        read(nullptr, offset);
+        return;
+    }
+
     char junk[128];
 
     while (offset)
@@ -159,7 +168,7 @@ void reader::advance(size_t offset)
 bool reader::valid() const
 {
     return (_file && !feof(_file)) ||
-           (_pbuf && _read_offset < _pbuf->size());
+           (_pbuf && _read_offset < _pbuf_size);
 }
 
 static NORETURN void _short_read(bool safe_read)
@@ -172,7 +181,7 @@ static NORETURN void _short_read(bool safe_read)
 }
 
 // Reads input in network byte order, from a file or buffer.
-unsigned char reader::readByte()
+unsigned char reader::read_unbuffered_byte()
 {
     if (_file)
     {
@@ -184,15 +193,14 @@ unsigned char reader::readByte()
     else if (_chunk)
     {
         unsigned char buf;
-        if (_chunk->read(&buf, 1) != 1)
-            _short_read(_safe_read);
+        read(&buf, 1);
         return buf;
     }
     else
     {
-        if (_read_offset >= _pbuf->size())
+        if (_read_offset >= _pbuf_size)
             _short_read(_safe_read);
-        return (*_pbuf)[_read_offset++];
+        return _pbuf[_read_offset++];
     }
 }
 
@@ -210,15 +218,34 @@ void reader::read(void *data, size_t size)
     }
     else if (_chunk)
     {
-        if (_chunk->read(data, size) != size)
+        const size_t buffered = min(size, _buffer_end - _buffer_pos);
+        memcpy(data, _buffer.data() + _buffer_pos, buffered);
+        _buffer_pos += buffered;
+        data = (char*)data + buffered;
+        size -= buffered;
+        if (!size)
+            return;
+
+        // Large reads go straight through; small ones refill the buffer.
+        if (size >= _buffer.size())
+        {
+            if (_chunk->read(data, size) != size)
+                _short_read(_safe_read);
+            return;
+        }
+        _buffer_pos = 0;
+        _buffer_end = _chunk->read(_buffer.data(), _buffer.size());
+        if (_buffer_end < size)
             _short_read(_safe_read);
+        memcpy(data, _buffer.data(), size);
+        _buffer_pos = size;
     }
     else
     {
-        if (_read_offset+size > _pbuf->size())
+        if (_read_offset+size > _pbuf_size)
             _short_read(_safe_read);
         if (data && size)
-            memcpy(data, &(*_pbuf)[_read_offset], size);
+            memcpy(data, _pbuf + _read_offset, size);
 
         _read_offset += size;
     }
@@ -238,9 +265,9 @@ void reader::setMinorVersion(int minorVersion)
 void reader::fail_if_not_eof(const string &name)
 {
     char dummy;
-    if (_chunk ? _chunk->read(&dummy, 1) :
+    if (_chunk ? _buffer_pos < _buffer_end || _chunk->read(&dummy, 1) :
         _file ? (fgetc(_file) != EOF) :
-        _read_offset >= _pbuf->size())
+        _read_offset < _pbuf_size)
     {
         fail("Incomplete read of \"%s\" - aborting.", name.c_str());
     }
@@ -256,17 +283,21 @@ void writer::check_ok(bool ok)
     }
 }
 
-void writer::writeByte(unsigned char ch)
+writer::~writer()
 {
-    if (failed)
+    if (!_chunk)
         return;
+    // If we're unwinding, the chunk is being thrown away anyway.
+    if (!uncaught_exception())
+        flush_buffer();
+    delete _chunk;
+}
 
-    if (_chunk)
-        _chunk->write(&ch, 1);
-    else if (_file)
-        check_ok(fputc(ch, _file) != EOF);
-    else
-        _pbuf->push_back(ch);
+void writer::flush_buffer()
+{
+    if (_buffered)
+        _chunk->write(_buffer.data(), _buffered);
+    _buffered = 0;
 }
 
 void writer::write(const void *data, size_t size)
@@ -275,7 +306,17 @@ void writer::write(const void *data, size_t size)
         return;
 
     if (_chunk)
-        _chunk->write(data, size);
+    {
+        if (_buffered + size > _buffer.size())
+            flush_buffer();
+        if (size >= _buffer.size())
+            _chunk->write(data, size);
+        else
+        {
+            memcpy(_buffer.data() + _buffered, data, size);
+            _buffered += size;
+        }
+    }
     else if (_file)
         check_ok(fwrite(data, 1, size, _file) == size);
     else
@@ -375,52 +416,55 @@ uint8_t unmarshallUByte(reader &th)
     return th.readByte();
 }
 
+// Encode and decode a 4 byte int in network order, in place. These let
+// runs of ints be marshalled with a single write.
+static inline void _put_int(unsigned char *buf, int32_t data)
+{
+    buf[0] = (data >> 24) & 0xFF;
+    buf[1] = (data >> 16) & 0xFF;
+    buf[2] = (data >> 8) & 0xFF;
+    buf[3] = data & 0xFF;
+}
+
+static inline int32_t _get_int(const unsigned char *buf)
+{
+    return (int32_t)((uint32_t)buf[0] << 24 | (uint32_t)buf[1] << 16
+                     | (uint32_t)buf[2] << 8 | (uint32_t)buf[3]);
+}
+
 // Marshall 2 byte short in network order.
 void marshallShort(writer &th, short data)
 {
     // TODO: why does this use `short` and `char` when unmarshall uses int16_t??
     CHECK_INITIALIZED(data);
-    const char b2 = (char)(data & 0x00FF);
-    const char b1 = (char)((data & 0xFF00) >> 8);
-    th.writeByte(b1);
-    th.writeByte(b2);
+    const unsigned char buf[2] = { (unsigned char)((data & 0xFF00) >> 8),
+                                   (unsigned char)(data & 0x00FF) };
+    th.write(buf, sizeof(buf));
 }
 
 // Unmarshall 2 byte short in network order.
 int16_t unmarshallShort(reader &th)
 {
-    int16_t b1 = th.readByte();
-    int16_t b2 = th.readByte();
-    int16_t data = (b1 << 8) | (b2 & 0x00FF);
-    return data;
+    unsigned char buf[2];
+    th.read(buf, sizeof(buf));
+    return (int16_t)(buf[0] << 8 | buf[1]);
 }
 
 // Marshall 4 byte int in network order.
 void marshallInt(writer &th, int32_t data)
 {
     CHECK_INITIALIZED(data);
-    char b4 = (char) (data & 0x000000FF);
-    char b3 = (char)((data & 0x0000FF00) >> 8);
-    char b2 = (char)((data & 0x00FF0000) >> 16);
-    char b1 = (char)((data & 0xFF000000) >> 24);
-
-    th.writeByte(b1);
-    th.writeByte(b2);
-    th.writeByte(b3);
-    th.writeByte(b4);
+    unsigned char buf[4];
+    _put_int(buf, data);
+    th.write(buf, sizeof(buf));
 }
 
 // Unmarshall 4 byte signed int in network order.
 int32_t unmarshallInt(reader &th)
 {
-    int32_t b1 = th.readByte();
-    int32_t b2 = th.readByte();
-    int32_t b3 = th.readByte();
-    int32_t b4 = th.readByte();
-
-    int32_t data = (b1 << 24) | ((b2 & 0x000000FF) << 16);
-    data |= ((b3 & 0x000000FF) << 8) | (b4 & 0x000000FF);
-    return data;
+    unsigned char buf[4];
+    th.read(buf, sizeof(buf));
+    return _get_int(buf);
 }
 
 void marshallUnsigned(writer& th, uint64_t v)
@@ -1268,6 +1312,8 @@ void tag_write(tag_type tagID, writer &outf)
         CANARY;
         _tag_construct_level_monsters(th);
         CANARY;
+        break;
+    case TAG_LEVEL_TILES:
         _tag_construct_level_tiles(th);
         break;
     case TAG_GHOST:
@@ -1312,6 +1358,7 @@ static void _shunt_monsters_out_of_walls()
                     env.mgrid(m.pos()) = NON_MONSTER;
                     m.position = *di;
                     env.mgrid(*di) = i;
+                    env.mon_index.moved(m);
                     break;
                 }
         }
@@ -1416,8 +1463,10 @@ void tag_read(reader &inf, tag_type tag_id)
             unwind_var<coord_def> you_pos(you.position, coord_def());
             check_map_validity();
         }
-        _tag_read_level_tiles(th);
 #if TAG_MAJOR_VERSION == 34
+        if (th.getMinorVersion() < TAG_MINOR_LEVEL_TILES_CHUNK)
+            _tag_read_level_tiles(th);
+
         if (you.where_are_you == BRANCH_GAUNTLET
             && th.getMinorVersion() < TAG_MINOR_GAUNTLET_TRAPPED)
         {
@@ -1463,6 +1512,9 @@ void tag_read(reader &inf, tag_type tag_id)
         }
 #endif
         break;
+    case TAG_LEVEL_TILES:
+        _tag_read_level_tiles(th);
+        break;
     case TAG_GHOST:
         global_ghosts = _tag_read_ghost(th);
         break;
@@ -1472,6 +1524,34 @@ void tag_read(reader &inf, tag_type tag_id)
     }
 }
 
+// Unlike TAG_LEVEL, this is never length-prefixed or kept past the
+// builder, and reading it back makes none of the repairs a loaded level
+// gets: the builder's own checks come later.
+void tag_write_unfinished_level(writer &th)
+{
+    _tag_construct_level(th);
+    CANARY;
+    _tag_construct_level_items(th);
+    CANARY;
+    _tag_construct_level_monsters(th);
+    CANARY;
+}
+
+void tag_read_unfinished_level(reader &th)
+{
+    // Nobody has been on the level yet; keep what the builder set up.
+    unwind_var<int> elapsed_time(env.elapsed_time);
+    unwind_var<coord_def> old_player_pos(env.old_player_pos);
+
+    env.shop.clear();
+    _tag_read_level(th);
+    EAT_CANARY;
+    _tag_read_level_items(th);
+    EAT_CANARY;
+    _tag_read_level_monsters(th);
+    EAT_CANARY;
+}
+
 static void _tag_construct_char(writer &th)
 {
     marshallByte(th, TAG_CHR_FORMAT);
@@ -2097,21 +2177,33 @@ static i_transit_list unmarshall_item_list(reader &th)
 }
 #endif
 
+// Each row of the masks is marshalled as one block; the order is that of
+// rectangle_iterator(0), with the mask and id of each cell together.
 static void marshall_level_map_masks(writer &th)
 {
-    for (rectangle_iterator ri(0); ri; ++ri)
+    unsigned char row[GXM * 8];
+    for (int y = 0; y < GYM; ++y)
     {
-        marshallInt(th, env.level_map_mask(*ri));
-        marshallInt(th, env.level_map_ids(*ri));
+        for (int x = 0; x < GXM; ++x)
+        {
+            _put_int(row + x * 8, env.level_map_mask[x][y]);
+            _put_int(row + x * 8 + 4, env.level_map_ids[x][y]);
+        }
+        th.write(row, sizeof(row));
     }
 }
 
 static void unmarshall_level_map_masks(reader &th)
 {
-    for (rectangle_iterator ri(0); ri; ++ri)
+    unsigned char row[GXM * 8];
+    for (int y = 0; y < GYM; ++y)
     {
-        env.level_map_mask(*ri) = unmarshallInt(th);
-        env.level_map_ids(*ri)  = unmarshallInt(th);
+        th.read(row, sizeof(row));
+        for (int x = 0; x < GXM; ++x)
+        {
+            env.level_map_mask[x][y] = _get_int(row + x * 8);
+            env.level_map_ids[x][y]  = _get_int(row + x * 8 + 4);
+        }
     }
 }
 
@@ -7569,6 +7661,8 @@ static void _tag_read_level_monsters(reader &th)
     {
         monster& m = env.mons[i];
         unmarshallMonster(th, m);
+        if (m.type != MONS_NO_MONSTER)
+            env.mon_index.add(m);
 
         // place monster
         if (!m.alive())
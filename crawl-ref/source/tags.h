@@ -38,6 +38,7 @@ enum tag_type   // used during save/load process to identify data blocks
     TAG_YOU,                            // the main part of the save
     TAG_LEVEL,                          // a single dungeon level
     TAG_GHOST,                          // ghost
+    TAG_LEVEL_TILES,                    // the tiles of a dungeon level
     NUM_TAGS,
 
     // Returned when a known tag was deliberately not read. This value is
@@ -54,31 +55,43 @@ class writer
 public:
     writer(const string &filename, FILE* output, bool ignore_errors = false)
         : _filename(filename), _file(output), _chunk(0),
-          _ignore_errors(ignore_errors), _pbuf(0), failed(false)
+          _ignore_errors(ignore_errors), _pbuf(0), _buffered(0), failed(false)
     {
         ASSERT(output);
     }
     writer(vector<unsigned char>* poutput)
         : _filename(), _file(0), _chunk(0), _ignore_errors(false),
-          _pbuf(poutput), failed(false) { ASSERT(poutput); }
-    writer(package *save, const string &chunkname)
+          _pbuf(poutput), _buffered(0), failed(false) { ASSERT(poutput); }
+    writer(package *save, const string &chunkname,
+           chunk_codec codec = CODEC_ZLIB)
         : _filename(), _file(0), _chunk(0), _ignore_errors(false),
-          failed(false)
+          _buffer(CHUNK_BUFFER_SIZE), _buffered(0), failed(false)
     {
         ASSERT(save);
-        _chunk = save->writer(chunkname);
+        _chunk = save->writer(chunkname, codec);
     }
 
-    ~writer() { if (_chunk) delete _chunk; }
+    ~writer();
 
-    void writeByte(unsigned char byte);
+    // Chunk output is staged here and handed to the compressor in blocks,
+    // rather than a byte at a time.
+    void writeByte(unsigned char byte)
+    {
+        if (_buffered < _buffer.size())
+            _buffer[_buffered++] = byte;
+        else
+            write(&byte, 1);
+    }
     void write(const void *data, size_t size);
     long tell();
 
     bool succeeded() const { return !failed; }
 
+    static const size_t CHUNK_BUFFER_SIZE = 16384;
+
 private:
     void check_ok(bool ok);
+    void flush_buffer();
 
 private:
     string _filename;
@@ -88,6 +101,10 @@ private:
 
     vector<unsigned char>* _pbuf;
 
+    // Only chunk writers have a buffer.
+    vector<unsigned char> _buffer;
+    size_t _buffered;
+
     bool failed;
 };
 
@@ -116,16 +133,29 @@ public:
     reader(const string &filename, int minorVersion = TAG_MINOR_INVALID);
     reader(FILE* input, int minorVersion = TAG_MINOR_INVALID)
         : _file(input), _chunk(0), opened_file(false), _pbuf(0),
-          _read_offset(0), _minorVersion(minorVersion), _safe_read(false) {}
+          _pbuf_size(0), _read_offset(0), _buffer_pos(0), _buffer_end(0),
+          _minorVersion(minorVersion), _safe_read(false) {}
     reader(const vector<unsigned char>& input,
            int minorVersion = TAG_MINOR_INVALID)
-        : _file(0), _chunk(0), opened_file(false), _pbuf(&input),
-          _read_offset(0), _minorVersion(minorVersion), _safe_read(false) {}
+        : reader(input.data(), input.size(), minorVersion) {}
+    // Read from memory that outlives the reader, such as a mapped file.
+    reader(const void *input, size_t size,
+           int minorVersion = TAG_MINOR_INVALID)
+        : _file(0), _chunk(0), opened_file(false),
+          _pbuf(static_cast<const unsigned char *>(input)), _pbuf_size(size),
+          _read_offset(0), _buffer_pos(0), _buffer_end(0),
+          _minorVersion(minorVersion), _safe_read(false) {}
     reader(package *save, const string &chunkname,
            int minorVersion = TAG_MINOR_INVALID);
     ~reader();
 
-    unsigned char readByte();
+    // Chunks are decompressed into a buffer ahead of the caller.
+    unsigned char readByte()
+    {
+        if (_buffer_pos < _buffer_end)
+            return _buffer[_buffer_pos++];
+        return read_unbuffered_byte();
+    }
     void read(void *data, size_t size);
     void advance(size_t size);
     int getMinorVersion() const;
@@ -138,13 +168,20 @@ public:
 
     void set_safe_read(bool setting) { _safe_read = setting; }
 
+private:
+    unsigned char read_unbuffered_byte();
+
 private:
     string _filename;
     FILE* _file;
     chunk_reader *_chunk;
     bool  opened_file;
-    const vector<unsigned char>* _pbuf;
-    unsigned int _read_offset;
+    const unsigned char *_pbuf;
+    size_t _pbuf_size;
+    size_t _read_offset;
+    // Only chunk readers have a buffer.
+    vector<unsigned char> _buffer;
+    size_t _buffer_pos, _buffer_end;
     int _minorVersion;
     // always throw an exception rather than dying when reading past EOF
     bool _safe_read;
@@ -210,6 +247,10 @@ player_save_info tag_read_char_info(reader &th, uint8_t format, uint8_t major,
 vector<ghost_demon> tag_read_ghosts(reader &th);
 void tag_write_ghosts(writer &th, const vector<ghost_demon> &ghosts);
 
+// The current level partway through building it, without its tiles.
+void tag_write_unfinished_level(writer &th);
+void tag_read_unfinished_level(reader &th);
+
 /* ***********************************************************************
  * misc
  * *********************************************************************** */
@@ -0,0 +1,26 @@
+-- Time level generation across the dungeon, where picking vaults for each
+-- level (primary vaults, minivaults, chance vaults, tagged subvaults) is
+-- a large part of the work. Compare the times between builds.
+-- Run with: ./crawl -test big/levelgen
+
+local ROUNDS = 10
+local PLACES = { "D:2", "D:8", "D:14", "Lair:3", "Orc:1", "Elf:2", "Snake:2",
+                 "Vaults:3", "Crypt:2", "Depths:3", "Zot:4" }
+
+local function bench(place)
+  local start = crawl.millis()
+  for i = 1, ROUNDS do
+    test.regenerate_level(place, true)
+  end
+  local elapsed = crawl.millis() - start
+  crawl.stderr(place .. ": " .. ROUNDS .. " levels in " .. elapsed .. " ms, "
+               .. string.format("%.1f", elapsed / ROUNDS) .. " ms per level\n")
+  return elapsed
+end
+
+local total = 0
+for _, place in ipairs(PLACES) do
+  total = total + bench(place)
+end
+crawl.stderr("all: " .. string.format("%.1f", total / (ROUNDS * #PLACES))
+             .. " ms per level\n")
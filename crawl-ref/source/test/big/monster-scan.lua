@@ -0,0 +1,35 @@
+-- Time monster turns on crowded Abyss and Pandemonium levels, where most
+-- of the monster slots are in use and iteration over them dominates.
+-- Run with: ./crawl -test big/monster-scan
+
+local ROUNDS = 200
+local CROWD = dgn.max_monsters() - 50
+
+local function fill_level()
+  local gxm, gym = dgn.max_bounds()
+  local placed, tries = 0, 0
+  while placed < CROWD and tries < CROWD * 20 do
+    tries = tries + 1
+    local x, y = crawl.random2(gxm), crawl.random2(gym)
+    if dgn.in_bounds(x, y) and not dgn.mons_at(x, y)
+       and dgn.create_monster(x, y, "random") then
+      placed = placed + 1
+    end
+  end
+  return placed
+end
+
+local function bench(place)
+  test.regenerate_level(place)
+  local placed = fill_level()
+  local start = crawl.millis()
+  for i = 1, ROUNDS do
+    debug.handle_monsters()
+  end
+  crawl.stderr(place .. ": " .. placed .. " monsters, " .. ROUNDS
+               .. " rounds in " .. (crawl.millis() - start) .. " ms\n")
+end
+
+debug.disable("death")
+bench("Abyss")
+bench("Pan")
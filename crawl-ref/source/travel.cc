@@ -638,6 +638,8 @@ bool is_resting()
 static void _start_running()
 {
     _userdef_run_startrunning_hook();
+    // Much may have changed since the last run.
+    travel_knowledge_changed();
     you.running.turns_passed = 0;
     const bool unsafe = Options.travel_one_unsafe_move &&
                         (you.running == RMODE_TRAVEL
@@ -890,9 +892,381 @@ void explore_pickup_event(int did_pickup, int tried_pickup)
     }
 }
 
+/////////////////////////////////////////////////////////////////////////////
+// travel_dist_cache
+
+travel_dist_cache::terrain_rules::terrain_rules()
+    : traversable(), safe_clouds(), likes_water(false), slime_immune(false),
+      sigil_immune(false)
+{
+}
+
+travel_dist_cache::terrain_rules::terrain_rules(bool fallback)
+    : likes_water(player_likes_water(true)),
+      slime_immune(actor_slime_wall_immune(&you)),
+      sigil_immune(you.is_binding_sigil_immune())
+{
+    for (int i = 0; i < NUM_FEATURES; ++i)
+    {
+        traversable[i] = feat_is_traversable_now(
+                            static_cast<dungeon_feature_type>(i), fallback);
+    }
+    for (int i = 0; i < NUM_CLOUD_TYPES; ++i)
+    {
+        const cloud_type cloud = static_cast<cloud_type>(i);
+        safe_clouds[i * 2] = !is_damaging_cloud(cloud, true, false);
+        safe_clouds[i * 2 + 1] = !is_damaging_cloud(cloud, true, true);
+    }
+}
+
+bool travel_dist_cache::terrain_rules::operator==(
+    const terrain_rules &other) const
+{
+    return traversable == other.traversable
+           && safe_clouds == other.safe_clouds
+           && likes_water == other.likes_water
+           && slime_immune == other.slime_immune
+           && sigil_immune == other.sigil_immune;
+}
+
+travel_dist_cache::travel_dist_cache(bool fallback)
+    : try_fallback(fallback), level(), start(), links(), settled(-1),
+      rules(), recheck_everything(false)
+{
+}
+
+void travel_dist_cache::recheck_all()
+{
+    recheck_everything = true;
+}
+
+vector<pair<coord_def, coord_def>> travel_dist_cache::transporter_links()
+{
+    vector<pair<coord_def, coord_def>> result;
+    LevelInfo &li = travel_cache.get_level_info(level_id::current());
+    for (const transporter_info &ti : li.get_transporters())
+    {
+        if (map_bounds(ti.destination)
+            && env.grid(ti.destination) == DNGN_TRANSPORTER_LANDING)
+        {
+            result.emplace_back(ti.destination, ti.position);
+        }
+    }
+    return result;
+}
+
+void travel_dist_cache::reset(const coord_def &dest)
+{
+    level = level_id::current();
+    start = dest;
+    links = transporter_links();
+
+    for (int x = 0; x < GXM; ++x)
+        for (int y = 0; y < GYM; ++y)
+            dist[x][y] = INFINITE_DISTANCE;
+    memset(safe, -1, sizeof(safe));
+    checked.clear();
+    in_view.clear();
+    rules = terrain_rules(try_fallback);
+    recheck_everything = false;
+    queue.assign(1, vector<coord_def>(1, start));
+    settled = -1;
+
+    dist[start.x][start.y] = 0;
+    check(start);
+}
+
+// Look at c if we haven't yet, and return whether it can be entered.
+bool travel_dist_cache::check(const coord_def &c)
+{
+    if (safe[c.x][c.y] < 0)
+    {
+        safe[c.x][c.y] = is_travelsafe_square(c, false, false, try_fallback);
+        cost[c.x][c.y] = _feature_traverse_cost(env.map_knowledge(c).feat());
+        checked.push_back(c);
+    }
+    return safe[c.x][c.y];
+}
+
+// The squares that can be reached from c, as travel_pathfind floods from
+// the destination: its neighbours, and transporters that lead to c.
+void travel_dist_cache::successors(const coord_def &c,
+                                   vector<coord_def> &out) const
+{
+    out.clear();
+    for (int dir = 0; dir < 8; (dir += 2) == 8 && (dir = 1))
+        if (in_bounds(c + Compass[dir]))
+            out.push_back(c + Compass[dir]);
+    for (const auto &link : links)
+        if (link.first == c && in_bounds(link.second))
+            out.push_back(link.second);
+}
+
+// The squares from which c can be reached. Orthogonal neighbours come
+// first, so that next_move() prefers them.
+void travel_dist_cache::predecessors(const coord_def &c,
+                                     vector<coord_def> &out) const
+{
+    out.clear();
+    for (int dir = 0; dir < 8; (dir += 2) == 8 && (dir = 1))
+        if (in_bounds(c + Compass[dir]))
+            out.push_back(c + Compass[dir]);
+    for (const auto &link : links)
+        if (link.second == c)
+            out.push_back(link.first);
+}
+
+// The shortest distance to c through settled squares.
+int travel_dist_cache::best_predecessor(const coord_def &c) const
+{
+    vector<coord_def> preds;
+    predecessors(c, preds);
+    int best = INFINITE_DISTANCE;
+    for (const coord_def &p : preds)
+        if (dist[p.x][p.y] <= settled)
+            best = min(best, dist[p.x][p.y] + cost[p.x][p.y]);
+    return best;
+}
+
+void travel_dist_cache::push(const coord_def &c, int d)
+{
+    if ((int)queue.size() <= d)
+        queue.resize(d + 1);
+    queue[d].push_back(c);
+}
+
+void travel_dist_cache::expand(const coord_def &c)
+{
+    const int d = dist[c.x][c.y] + cost[c.x][c.y];
+    vector<coord_def> succs;
+    successors(c, succs);
+    for (const coord_def &n : succs)
+    {
+        if (n == start || !check(n) || d >= dist[n.x][n.y])
+            continue;
+        dist[n.x][n.y] = d;
+        push(n, d);
+    }
+}
+
+// Settle the squares one step further out, returning false if there are
+// none left.
+bool travel_dist_cache::settle_next()
+{
+    const int d = settled + 1;
+    if (d >= (int)queue.size())
+        return false;
+
+    // expand() only adds to later entries.
+    for (const coord_def &c : queue[d])
+        if (dist[c.x][c.y] == d)
+            expand(c);
+    queue[d].clear();
+    settled = d;
+    return true;
+}
+
+// Recheck the squares that may have changed since the last step, and
+// repair the distances around those that have.
+void travel_dist_cache::validate()
+{
+    const terrain_rules now(try_fallback);
+    vector<coord_def> recheck;
+    if (recheck_everything || !(now == rules))
+        recheck = checked;
+    else
+    {
+        recheck = in_view;
+        for (const coord_def &c : env.visible)
+            if (safe[c.x][c.y] >= 0)
+                recheck.push_back(c);
+    }
+    rules = now;
+    recheck_everything = false;
+
+    vector<coord_def> changed;
+    for (const coord_def &c : recheck)
+    {
+        const int8_t now_safe =
+            is_travelsafe_square(c, false, false, try_fallback);
+        const uint8_t now_cost =
+            _feature_traverse_cost(env.map_knowledge(c).feat());
+        if (now_safe != safe[c.x][c.y] || now_cost != cost[c.x][c.y])
+        {
+            safe[c.x][c.y] = now_safe;
+            cost[c.x][c.y] = now_cost;
+            changed.push_back(c);
+        }
+    }
+
+    if (!changed.empty())
+        repair(changed);
+}
+
+void travel_dist_cache::repair(const vector<coord_def> &changed)
+{
+    vector<coord_def> succs;
+
+    // First forget the distances that no longer hold, nearest first so
+    // that a square is only judged once those it may be reached from are.
+    typedef pair<int, coord_def> entry;
+    priority_queue<entry, vector<entry>, greater<entry>> suspects;
+    auto suspect = [&](const coord_def &c)
+    {
+        if (c != start && dist[c.x][c.y] != INFINITE_DISTANCE)
+            suspects.emplace(dist[c.x][c.y], c);
+    };
+
+    vector<coord_def> seeds;
+    for (const coord_def &c : changed)
+    {
+        seeds.push_back(c);
+        successors(c, succs);
+        seeds.insert(seeds.end(), succs.begin(), succs.end());
+    }
+    for (const coord_def &c : seeds)
+        suspect(c);
+
+    while (!suspects.empty())
+    {
+        const entry e = suspects.top();
+        suspects.pop();
+        const coord_def c = e.second;
+        if (dist[c.x][c.y] != e.first
+            || (safe[c.x][c.y] > 0 && best_predecessor(c) == e.first))
+        {
+            continue;
+        }
+
+        dist[c.x][c.y] = INFINITE_DISTANCE;
+        seeds.push_back(c);
+        successors(c, succs);
+        for (const coord_def &n : succs)
+            suspect(n);
+    }
+
+    // Then work out distances afresh around the changes, and spread any
+    // that got shorter through the settled squares.
+    int lowest = INFINITE_DISTANCE;
+    for (const coord_def &c : seeds)
+    {
+        if (c == start || safe[c.x][c.y] <= 0)
+            continue;
+        const int d = best_predecessor(c);
+        if (d < dist[c.x][c.y])
+        {
+            dist[c.x][c.y] = d;
+            push(c, d);
+            lowest = min(lowest, d);
+        }
+    }
+
+    for (int d = lowest; d <= settled; ++d)
+    {
+        for (const coord_def &c : queue[d])
+            if (dist[c.x][c.y] == d)
+                expand(c);
+        queue[d].clear();
+    }
+}
+
+int travel_dist_cache::distance(const coord_def &dest,
+                                const coord_def &youpos, coord_def &move)
+{
+    unwind_bool slime_wall_check(g_Slime_Wall_Check,
+                                 !actor_slime_wall_immune(&you));
+    unwind_slime_wall_precomputer slime_neighbours(g_Slime_Wall_Check);
+
+    if (level != level_id::current() || start != dest
+        || links != transporter_links())
+    {
+        reset(dest);
+    }
+    else
+        validate();
+
+    // Settle squares until none could be a shorter way to youpos than the
+    // best found so far.
+    vector<coord_def> preds;
+    predecessors(youpos, preds);
+    int best;
+    do
+    {
+        best = INFINITE_DISTANCE;
+        for (const coord_def &p : preds)
+        {
+            if (dist[p.x][p.y] <= settled
+                && dist[p.x][p.y] + cost[p.x][p.y] < best)
+            {
+                best = dist[p.x][p.y] + cost[p.x][p.y];
+                move = p;
+            }
+        }
+    }
+    while (best > settled + 1 && settle_next());
+
+    // Once we are much closer than the squares looked at, start afresh
+    // rather than keep repairing them all.
+    if (best != INFINITE_DISTANCE && settled > 2 * best)
+        reset(dest);
+
+    in_view.clear();
+    for (const coord_def &c : env.visible)
+        if (safe[c.x][c.y] >= 0)
+            in_view.push_back(c);
+
+    return best;
+}
+
+coord_def travel_dist_cache::next_move(const coord_def &dest,
+                                       const coord_def &youpos)
+{
+    coord_def move;
+    if (distance(dest, youpos, move) == INFINITE_DISTANCE)
+        return coord_def();
+
+    return _is_safe_move(move) ? move : coord_def();
+}
+
+// Distances for normal travel, and for travel through temporary
+// obstructions.
+static travel_dist_cache _travel_dists[2] =
+{
+    travel_dist_cache(false), travel_dist_cache(true)
+};
+
+/**
+ * Make travel recheck every square it has looked at on its next step, as
+ * map knowledge or exclusions out of the player's view may have changed.
+ */
+void travel_knowledge_changed()
+{
+    for (travel_dist_cache &cache : _travel_dists)
+        cache.recheck_all();
+}
+
+// The next move of travel from youpos to dest, as found by
+// travel_pathfind::pathfind(RMODE_TRAVEL).
+static coord_def _travel_move(const coord_def &youpos, const coord_def &dest,
+                              bool try_fallback)
+{
+    if (!in_bounds(dest))
+        return coord_def();
+
+    // Abort run if we're trying to go someplace evil. Travel to traps is
+    // specifically allowed here if the player insists on it.
+    if (!is_travelsafe_square(dest, false, false, true) && !is_trap(dest))
+        return coord_def();
+
+    if (youpos == dest)
+        return dest;
+
+    return _travel_dists[try_fallback].next_move(dest, youpos);
+}
+
 /**
- * Run the travel_pathfind algorithm with a destination with the aim of
- * determining the next travel move. Try to avoid to let travel (including
+ * Find the next travel move towards a destination, using the distances kept
+ * between steps by travel_dist_cache. Try to avoid to let travel (including
  * autoexplore) move the player right next to a lurking (previously unseen)
  * monster.
  *
@@ -908,13 +1282,9 @@ void explore_pickup_event(int did_pickup, int tried_pickup)
  */
 static void _find_travel_pos(const coord_def& youpos, int *move_x, int *move_y)
 {
-    travel_pathfind tp;
-
-    tp.set_src_dst(youpos, you.running.pos);
-
-    coord_def dest = tp.pathfind(RMODE_TRAVEL, false);
+    coord_def dest = _travel_move(youpos, you.running.pos, false);
     if (dest.origin())
-        dest = tp.pathfind(RMODE_TRAVEL, true);
+        dest = _travel_move(youpos, you.running.pos, true);
     coord_def new_dest = dest;
 
     // We'd either have to travel through a runed door, in which case we'll be
@@ -2925,11 +3295,35 @@ static int _target_distance_from(const coord_def &pos)
     return -1;
 }
 
+// A place interlevel route planning has reached by taking stairs, and the
+// stair on the player's level that the route starts with.
+struct transtravel_step
+{
+    int distance;
+    int order;
+    level_pos pos;
+    coord_def first_stair;
+
+    bool operator>(const transtravel_step &other) const
+    {
+        return distance > other.distance
+               || (distance == other.distance && order > other.order);
+    }
+};
+
 /*
  * Sets best_stair to the coordinates of the best stair on the player's current
- * level to take to get to the 'target' level. Should be called with 'distance'
- * set to 0, 'stair' set to (you.x_pos, you.y_pos) and 'best_distance' set to
- * -1. 'cur' should be the player's current level.
+ * level to take to get to the 'target' level. Should be called with 'cur' set
+ * to the player's current level, 'start' set to (you.x_pos, you.y_pos) and
+ * 'best_level_distance' set to -1. Returns the length of the best route, or
+ * -1 if there is none.
+ *
+ * The levels in the travel cache form a graph whose nodes are stairs and
+ * whose edges are the cached distances between stairs on each level, plus
+ * the cost of taking a stair. This searches that graph in order of distance
+ * from the player, so each stair is expanded at most once and the search
+ * stops as soon as nothing left can beat the best route. Stair distances
+ * are kept in stair_info::distance, which must be cleared beforehand.
  *
  * If best_stair remains unchanged when this function returns, there is no
  * travel-safe path between the player's current level and the target level OR
@@ -2942,127 +3336,164 @@ static int _target_distance_from(const coord_def &pos)
  * This function has undefined behaviour when the target position is not
  * traversable.
  */
-static int _find_transtravel_stair(const level_id &cur,
-                                    const level_pos &target,
-                                    int distance,
-                                    // This is actually the current position
-                                    // on cur, not necessarily a stair.
-                                    const coord_def &stair,
-                                    level_id &closest_level,
-                                    int &best_level_distance,
-                                    coord_def &best_stair,
-                                    int search_depth = 0)
-{
-    int local_distance = -1;
-    level_id player_level = level_id::current();
-
-    LevelInfo &li = travel_cache.get_level_info(cur);
-
-    // Have we reached the target level?
-    if (cur == target.id)
-    {
-        // Are we in an exclude? If so, bail out. Unless it is just a stair exclusion.
-        if (is_excluded(stair, li.get_excludes()) && !is_stair_exclusion(stair))
-            return -1;
-
-        // If there's no target position on the target level, or we're on the
-        // target, we're home.
-        if (target.pos.x == -1 || target.pos == stair)
-            return distance;
+int find_transtravel_stair(const level_id &cur, const level_pos &target,
+                           const coord_def &start, level_id &closest_level,
+                           int &best_level_distance, coord_def &best_stair)
+{
+    const level_id player_level = level_id::current();
+    int best_distance = -1;
+    int order = 0;
 
-        // If there *is* a target position, we need to work out our distance
-        // from it.
-        int deltadist = _target_distance_from(stair);
+    priority_queue<transtravel_step, vector<transtravel_step>,
+                   greater<transtravel_step>> todo;
+    todo.push({0, order++, level_pos(cur, start), coord_def(-1, -1)});
 
-        if (deltadist == -1 && cur == player_level)
+    auto found_route = [&](int distance, const coord_def &first_stair)
+    {
+        if (best_distance == -1 || distance < best_distance)
         {
-            // Okay, we don't seem to have a distance available to us, which
-            // means we're either (a) not standing on stairs or (b) whoever
-            // initiated interlevel travel didn't call
-            // _populate_stair_distances. Assuming we're not on stairs, that
-            // situation can arise only if interlevel travel has been triggered
-            // for a location on the same level. If that's the case, we can get
-            // the distance off the travel_point_distance matrix.
-            deltadist = travel_point_distance[target.pos.x][target.pos.y];
-            if (!deltadist && stair != target.pos)
-                deltadist = -1;
+            best_distance = distance;
+            best_stair = first_stair;
         }
+    };
+
+    while (!todo.empty())
+    {
+        const transtravel_step step = todo.top();
+        todo.pop();
+
+        // Nothing left can beat the route we have.
+        if (best_distance != -1 && step.distance >= best_distance)
+            break;
+
+        // This is actually the current position on the level, not
+        // necessarily a stair.
+        const coord_def &stair = step.pos.pos;
+        const level_id &here = step.pos.id;
+        LevelInfo &li = travel_cache.get_level_info(here);
 
-        if (deltadist != -1)
+        // this_stair being -1 is perfectly acceptable, since we start with
+        // coords as the player coords, and the player need not be standing
+        // on stairs.
+        const int this_stair = li.get_stair_index(stair);
+
+        // Already reached more cheaply, by walking here from another stair.
+        if (this_stair != -1)
         {
-            local_distance = distance + deltadist;
-
-            // See if this is a degenerate case of interlevel travel:
-            // A degenerate case of interlevel travel decays to normal travel;
-            // we identify this by checking if:
-            // a. The current level is the target level.
-            // b. The target square is reachable from the 'current' square.
-            // c. The current square is where the player is.
-            //
-            // Note that even if this *is* degenerate, interlevel travel may
-            // still be able to find a shorter route, since it can consider
-            // routes that leave and reenter the current level.
-            if (player_level == target.id && stair == you.pos())
-                best_stair = target.pos;
-
-            // The local_distance is already set, but there may actually be
-            // stairs we can take that'll get us to the target faster than the
-            // direct route, so we also try the stairs.
+            const int known = li.get_stairs()[this_stair].distance;
+            if (known != -1 && known < step.distance)
+                continue;
         }
-    }
-
-    vector<stair_info> &stairs = li.get_stairs();
 
-    // this_stair being nullptr is perfectly acceptable, since we start with
-    // coords as the player coords, and the player need not be standing on
-    // stairs.
-    stair_info *this_stair = li.get_stair(stair);
+        // Have we reached the target level?
+        if (here == target.id)
+        {
+            // Are we in an exclude? If so, bail out. Unless it is just a
+            // stair exclusion.
+            if (is_excluded(stair, li.get_excludes())
+                && !is_stair_exclusion(stair))
+            {
+                continue;
+            }
 
-    if (!this_stair && cur != player_level)
-    {
-        // Whoops, there's no stair in the travel cache for the current
-        // position, and we're not on the player's current level (i.e., there
-        // certainly *should* be a stair here). Since we can't proceed in any
-        // reasonable way, bail out.
-        return local_distance;
-    }
+            // If there's no target position on the target level, or we're on
+            // the target, we're home.
+            if (target.pos.x == -1 || target.pos == stair)
+            {
+                found_route(step.distance, step.first_stair);
+                continue;
+            }
 
-    for (stair_info &si : stairs)
-    {
-        if (stairs_destination_is_excluded(si))
-            continue;
+            // If there *is* a target position, we need to work out our
+            // distance from it.
+            int deltadist = _target_distance_from(stair);
 
-        // Skip placeholders and excluded stairs.
-        if (!si.can_travel() || is_excluded(si.position, li.get_excludes()))
-            continue;
+            if (deltadist == -1 && here == player_level)
+            {
+                // Okay, we don't seem to have a distance available to us,
+                // which means we're either (a) not standing on stairs or (b)
+                // whoever initiated interlevel travel didn't call
+                // _populate_stair_distances. Assuming we're not on stairs,
+                // that situation can arise only if interlevel travel has been
+                // triggered for a location on the same level. If that's the
+                // case, we can get the distance off the travel_point_distance
+                // matrix.
+                deltadist = travel_point_distance[target.pos.x][target.pos.y];
+                if (!deltadist && stair != target.pos)
+                    deltadist = -1;
+            }
 
-        int deltadist = li.distance_between(this_stair, &si);
+            if (deltadist != -1)
+            {
+                // See if this is a degenerate case of interlevel travel:
+                // A degenerate case of interlevel travel decays to normal
+                // travel; we identify this by the route not having taken any
+                // stairs yet, which means that the current level is the
+                // target level and the current square is where the player is.
+                //
+                // Note that even if this *is* degenerate, interlevel travel
+                // may still be able to find a shorter route, since it can
+                // consider routes that leave and reenter the current level.
+                found_route(step.distance + deltadist,
+                            step.first_stair.x == -1 ? target.pos
+                                                     : step.first_stair);
+
+                // There may actually be stairs we can take that'll get us to
+                // the target faster than the direct route, so we also try
+                // the stairs.
+            }
+        }
 
-        if (!this_stair)
+        if (this_stair == -1 && here != player_level)
         {
-            deltadist = travel_point_distance[si.position.x][si.position.y];
-            if (!deltadist && you.pos() != si.position)
-                deltadist = -1;
-        }
-        // deltadist == 0 is legal (if this_stair is nullptr), since the player
-        // may be standing on the stairs. If two stairs are disconnected,
-        // deltadist has to be negative.
-        if (deltadist < 0)
+            // Whoops, there's no stair in the travel cache for the current
+            // position, and we're not on the player's current level (i.e.,
+            // there certainly *should* be a stair here). Since we can't
+            // proceed in any reasonable way, give up on this branch.
             continue;
+        }
 
-        int dist2stair = distance + deltadist;
-        if (si.distance == -1 || si.distance > dist2stair)
+        vector<stair_info> &stairs = li.get_stairs();
+        for (int i = 0, size = stairs.size(); i < size; ++i)
         {
+            stair_info &si = stairs[i];
+
+            if (stairs_destination_is_excluded(si))
+                continue;
+
+            // Skip placeholders and excluded stairs.
+            if (!si.can_travel() || is_excluded(si.position, li.get_excludes()))
+                continue;
+
+            int deltadist = li.distance_between(this_stair, i);
+
+            if (this_stair == -1)
+            {
+                deltadist = travel_point_distance[si.position.x][si.position.y];
+                if (!deltadist && you.pos() != si.position)
+                    deltadist = -1;
+            }
+            // deltadist == 0 is legal (if this_stair is -1), since the player
+            // may be standing on the stairs. If two stairs are disconnected,
+            // deltadist has to be negative.
+            if (deltadist < 0)
+                continue;
+
+            int dist2stair = step.distance + deltadist;
+            if (si.distance != -1 && si.distance <= dist2stair)
+                continue;
             si.distance = dist2stair;
 
             // Account for the cost of taking the stairs
             dist2stair += 500; // XXX: this seems large?
 
             // Already too expensive? Short-circuit.
-            if (local_distance != -1 && dist2stair >= local_distance)
+            if (best_distance != -1 && dist2stair >= best_distance)
                 continue;
 
             const level_pos &dest = si.destination;
+            const coord_def first_stair =
+                step.first_stair.x == -1 ? si.position : step.first_stair;
 
             // Never use escape hatches as the last leg of the trip, since
             // that will leave the player unable to retrace their path.
@@ -3082,12 +3513,7 @@ static int _find_transtravel_stair(const level_id &cur,
             if (target.pos.x == -1
                 && dest.id == target.id)
             {
-                if (local_distance == -1 || local_distance > dist2stair)
-                {
-                    local_distance = dist2stair;
-                    if (cur == player_level && you.pos() == stair)
-                        best_stair = si.position;
-                }
+                found_route(dist2stair, first_stair);
                 continue;
             }
 
@@ -3106,17 +3532,17 @@ static int _find_transtravel_stair(const level_id &cur,
             if (!dest.is_valid())
                 continue;
 
-            // Don't try hell branches if we are not already in one or targeting
-            // one. When you actually enter the vestibule, the branch entry
-            // point is adjusted to be the portal you entered through, but
-            // autotravel needs to simulate this somehow, or it can find (fake)
-            // paths through hell that are shortcuts in depths, because the
-            // vestibule side of the portals do map to particular portals
-            // scattered throughout depths, even if those mappings won't be
-            // used while exiting from the vestibule.
+            // Don't try hell branches if we are not already in one or
+            // targeting one. When you actually enter the vestibule, the
+            // branch entry point is adjusted to be the portal you entered
+            // through, but autotravel needs to simulate this somehow, or it
+            // can find (fake) paths through hell that are shortcuts in
+            // depths, because the vestibule side of the portals do map to
+            // particular portals scattered throughout depths, even if those
+            // mappings won't be used while exiting from the vestibule.
             if (is_hell_branch(dest.id.branch)
                             && !(is_hell_branch(target.id.branch)
-                                 || is_hell_branch(cur.branch)))
+                                 || is_hell_branch(here.branch)))
             {
                 continue;
             }
@@ -3126,34 +3552,21 @@ static int _find_transtravel_stair(const level_id &cur,
             LevelInfo &lo = travel_cache.get_level_info(dest.id);
             if (stair_info *so = lo.get_stair(dest.pos))
             {
-                if (so->distance == -1 || so->distance > dist2stair)
-                    so->distance = dist2stair;
-                else
+                if (so->distance != -1 && so->distance <= dist2stair)
                     continue;   // We've already been here.
+                so->distance = dist2stair;
             }
 #ifdef DEBUG_TRAVEL
-            string indent(search_depth, '.');
-            dprf("%strying stairs at %d,%d, dest is %d depth %d, pos %d,%d",
-                indent.c_str(), si.position.x, si.position.y, dest.id.branch,
+            dprf("trying stairs at %d,%d, dest is %d depth %d, pos %d,%d",
+                si.position.x, si.position.y, dest.id.branch,
                 dest.id.depth, dest.pos.x, dest.pos.y);
 #endif
 
             // Okay, take these stairs and keep going.
-            const int newdist =
-                _find_transtravel_stair(dest.id, target,
-                                        dist2stair, dest.pos, closest_level,
-                                        best_level_distance, best_stair,
-                                        search_depth + 1);
-            if (newdist != -1
-                && (local_distance == -1 || local_distance > newdist))
-            {
-                local_distance = newdist;
-                if (cur == player_level && you.pos() == stair)
-                    best_stair = si.position;
-            }
+            todo.push({dist2stair, order++, dest, first_stair});
         }
     }
-    return local_distance;
+    return best_distance;
 }
 
 static bool _loadlev_populate_stair_distances(const level_pos &target)
@@ -3221,12 +3634,11 @@ static bool _find_transtravel_square(const level_pos &target, bool verbose)
 
     if (maybe_traversable)
     {
-        _find_transtravel_stair(current, target,
-                                0, cur_stair, closest_level,
-                                best_level_distance, best_stair);
+        find_transtravel_stair(current, target, cur_stair, closest_level,
+                               best_level_distance, best_stair);
         dprf("found stair at %d,%d", best_stair.x, best_stair.y);
     }
-    // even without _find_transtravel_stair called, the values are initialized
+    // even without find_transtravel_stair called, the values are initialized
     // enough for the rest of this to go forward.
 
     if (best_stair.x != -1 && best_stair.y != -1)
@@ -3605,30 +4017,135 @@ void LevelInfo::set_distance_between_stairs(int a, int b, int dist)
     stair_distances[b * stairs.size() + a] = dist;
 }
 
+// The squares of the current level as the floods of
+// fill_travel_point_distance() see them, worked out once so that the
+// distances from many stairs can be found without repeating the checks.
+struct stair_flood_grid
+{
+    bool safe[GXM][GYM];
+    uint8_t cost[GXM][GYM];
+    // Where each transporter that may be taken leads to.
+    map<coord_def, coord_def> transporters;
+
+    stair_flood_grid();
+};
+
+stair_flood_grid::stair_flood_grid() : transporters()
+{
+    memset(safe, 0, sizeof(safe));
+    memset(cost, 0, sizeof(cost));
+    for (rectangle_iterator ri(1); ri; ++ri)
+    {
+        const coord_def c = *ri;
+        safe[c.x][c.y] = is_travelsafe_square(c, false, false, true);
+        cost[c.x][c.y] = _feature_traverse_cost(env.map_knowledge(c).feat());
+
+        if (env.grid(c) != DNGN_TRANSPORTER)
+            continue;
+        LevelInfo &li = travel_cache.get_level_info(level_id::current());
+        const transporter_info *ti = li.get_transporter(c);
+        // As in path_flood(), excluded transporters aren't taken.
+        if (ti && in_bounds(ti->destination)
+            && !(is_excluded(c)
+                 && env.map_knowledge(c).feat() == DNGN_TRANSPORTER
+                 && !adjacent(c, ti->destination)))
+        {
+            transporters[c] = ti->destination;
+        }
+    }
+}
+
+// Find the travel distances from src to each of targets, giving 0 for
+// those that can't be reached as travel_point_distance does. Stops once
+// they have all been reached.
+static vector<int> _stair_flood(const stair_flood_grid &grid,
+                                const coord_def &src,
+                                const vector<coord_def> &targets)
+{
+    static int dist[GXM][GYM];
+    for (int x = 0; x < GXM; ++x)
+        for (int y = 0; y < GYM; ++y)
+            dist[x][y] = INFINITE_DISTANCE;
+
+    static bool wanted[GXM][GYM];
+    memset(wanted, 0, sizeof(wanted));
+    int remaining = 0;
+    for (const coord_def &t : targets)
+        if (!wanted[t.x][t.y] && grid.safe[t.x][t.y])
+        {
+            wanted[t.x][t.y] = true;
+            ++remaining;
+        }
+
+    // Dijkstra's algorithm, with a queue bucketed by distance since the
+    // costs are small.
+    vector<vector<coord_def>> queue(1, vector<coord_def>(1, src));
+    dist[src.x][src.y] = 0;
+    for (int d = 0; d < (int)queue.size() && remaining; ++d)
+    {
+        for (unsigned int i = 0; i < queue[d].size(); ++i)
+        {
+            const coord_def c = queue[d][i];
+            if (dist[c.x][c.y] != d)
+                continue;
+            if (wanted[c.x][c.y] && !--remaining)
+                break;
+
+            const int nd = d + grid.cost[c.x][c.y];
+            auto relax = [&](const coord_def &n)
+            {
+                if (in_bounds(n) && n != src && grid.safe[n.x][n.y]
+                    && nd < dist[n.x][n.y])
+                {
+                    dist[n.x][n.y] = nd;
+                    if ((int)queue.size() <= nd)
+                        queue.resize(nd + 1);
+                    queue[nd].push_back(n);
+                }
+            };
+            for (int dir = 0; dir < 8; ++dir)
+                relax(c + Compass[dir]);
+            if (const coord_def *dest = map_find(grid.transporters, c))
+                relax(*dest);
+        }
+    }
+
+    vector<int> result;
+    for (const coord_def &t : targets)
+        result.push_back(dist[t.x][t.y] == INFINITE_DISTANCE ? 0
+                                                           : dist[t.x][t.y]);
+    return result;
+}
+
 void LevelInfo::update_stair_distances()
 {
     const int nstairs = stairs.size();
+    if (!nstairs)
+        return;
+
+    // The distances are the same as fill_travel_point_distance() would
+    // find from each stair, but the squares are only checked once and each
+    // search stops when it has reached the stairs it is needed for.
+    const stair_flood_grid grid;
+
     // Now we update distances for all the stairs, relative to all other
     // stairs.
     for (int s = 0; s < nstairs - 1; ++s)
     {
         set_distance_between_stairs(s, s, 0);
 
-        // For each stair, we need to ask travel to populate the distance
-        // array.
-        fill_travel_point_distance(stairs[s].position);
-
         // Assume movement distance between stairs is commutative,
         // i.e. going from a->b is the same distance as b->a.
+        vector<coord_def> others;
         for (int other = s + 1; other < nstairs; ++other)
-        {
-            const coord_def op = stairs[other].position;
-            const int dist = travel_point_distance[op.x][op.y];
-            set_distance_between_stairs(s, other, dist);
-        }
+            others.push_back(stairs[other].position);
+
+        const vector<int> dists = _stair_flood(grid, stairs[s].position,
+                                               others);
+        for (int other = s + 1; other < nstairs; ++other)
+            set_distance_between_stairs(s, other, dists[other - s - 1]);
     }
-    if (nstairs)
-        set_distance_between_stairs(nstairs - 1, nstairs - 1, 0);
+    set_distance_between_stairs(nstairs - 1, nstairs - 1, 0);
 }
 
 void LevelInfo::update_transporter(const coord_def& transpos,
@@ -3919,9 +4436,13 @@ int LevelInfo::distance_between(const stair_info *s1, const stair_info *s2)
     if (s1 == s2)
         return 0;
 
-    int i1 = get_stair_index(s1->position),
-        i2 = get_stair_index(s2->position);
-    if (i1 == -1 || i2 == -1)
+    return distance_between(get_stair_index(s1->position),
+                            get_stair_index(s2->position));
+}
+
+int LevelInfo::distance_between(int i1, int i2) const
+{
+    if (i1 == -1 || i2 == -1 || i1 == i2)
         return 0;
 
     return stair_distances[ i1 * stairs.size() + i2 ];
@@ -4437,6 +4958,7 @@ void TravelCache::set_level_excludes()
 
 void TravelCache::update_excludes()
 {
+    travel_knowledge_changed();
     get_level_info(level_id::current()).update_excludes();
 }
 
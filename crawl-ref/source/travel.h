@@ -4,12 +4,14 @@
 **/
 #pragma once
 
+#include <bitset>
 #include <cstdio>
 #include <map>
 #include <string>
 #include <vector>
 
 #include "command-type.h"
+#include "cloud-type.h"
 #include "daction-type.h"
 #include "exclude.h"
 #include "travel-defs.h"
@@ -77,6 +79,7 @@ bool is_unknown_transporter(const coord_def &p);
 
 void fill_travel_point_distance(const coord_def& youpos,
                      vector<coord_def>* coords = nullptr);
+void travel_knowledge_changed();
 
 bool is_stair_exclusion(const coord_def &p);
 
@@ -98,6 +101,9 @@ level_id find_up_level(level_id curr, bool up_branch = false);
 level_id find_down_level(level_id curr);
 
 void start_translevel_travel(const level_pos &pos);
+int find_transtravel_stair(const level_id &cur, const level_pos &target,
+                           const coord_def &start, level_id &closest_level,
+                           int &best_level_distance, coord_def &best_stair);
 
 void start_travel(const coord_def& p);
 
@@ -366,6 +372,8 @@ struct LevelInfo
     // Returns the travel distance between two stairs. If either stair is nullptr,
     // or does not exist in our list of stairs, returns 0.
     int distance_between(const stair_info *s1, const stair_info *s2) const;
+    // The same, by index into get_stairs(); -1 stands for no stair.
+    int distance_between(int i1, int i2) const;
 
     void update_excludes();
     void update();              // Update LevelInfo to be correct for the
@@ -625,6 +633,95 @@ protected:
     bool try_fallback;
 };
 
+// Travel takes step after step towards the same destination, and between
+// steps little of the map in between changes. Rather than flood out from
+// the destination for every step as travel_pathfind does, this keeps the
+// distances from the destination and repairs them around any squares that
+// have changed.
+//
+// Map knowledge changes in the player's view, so on each step only the
+// squares in view now or at the last step are rechecked. Everything is
+// rechecked when the terrain the player can cross changes, and after
+// travel_knowledge_changed().
+//
+// The distances are those of travel_pathfind: only travel-safe squares can
+// be entered, and leaving a square costs _feature_traverse_cost(). Where
+// several moves are equally short, orthogonal ones are preferred.
+class travel_dist_cache
+{
+public:
+    explicit travel_dist_cache(bool fallback);
+
+    // The square next to youpos to move to towards dest, or the origin if
+    // there is no safe move.
+    coord_def next_move(const coord_def &dest, const coord_def &youpos);
+
+    // The travel distance from youpos to dest, or INFINITE_DISTANCE. Sets
+    // move to the square next to youpos on the way.
+    int distance(const coord_def &dest, const coord_def &youpos,
+                 coord_def &move);
+
+    // Recheck every square on the next step.
+    void recheck_all();
+
+private:
+    // What the player can cross, which decides every square's safety and
+    // cost along with the map.
+    struct terrain_rules
+    {
+        terrain_rules();
+        explicit terrain_rules(bool fallback);
+        bool operator==(const terrain_rules &other) const;
+
+        bitset<NUM_FEATURES> traversable;
+        bitset<NUM_CLOUD_TYPES * 2> safe_clouds;
+        bool likes_water;
+        bool slime_immune;
+        bool sigil_immune;
+    };
+
+    void reset(const coord_def &dest);
+    bool check(const coord_def &c);
+    void successors(const coord_def &c, vector<coord_def> &out) const;
+    void predecessors(const coord_def &c, vector<coord_def> &out) const;
+    int best_predecessor(const coord_def &c) const;
+    void push(const coord_def &c, int d);
+    void expand(const coord_def &c);
+    bool settle_next();
+    void validate();
+    void repair(const vector<coord_def> &changed);
+
+    static vector<pair<coord_def, coord_def>> transporter_links();
+
+private:
+    // Whether temporary obstructions are treated as traversable.
+    bool try_fallback;
+
+    level_id level;
+    coord_def start;
+
+    // Landing sites, and the transporters that lead to them.
+    vector<pair<coord_def, coord_def>> links;
+
+    // Squares no further than this from start have their final distance,
+    // and their neighbours have been checked.
+    int settled;
+
+    int dist[GXM][GYM];
+    int8_t safe[GXM][GYM];   // -1 for squares not yet checked.
+    uint8_t cost[GXM][GYM];
+    vector<coord_def> checked;
+
+    // Checked squares that were in view at the last step.
+    vector<coord_def> in_view;
+    terrain_rules rules;
+    bool recheck_everything;
+
+    // Squares waiting to be settled, by distance. Entries whose distance
+    // has since changed are skipped.
+    vector<vector<coord_def>> queue;
+};
+
 extern TravelCache travel_cache;
 
 void do_interlevel_travel();
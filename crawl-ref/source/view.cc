@@ -813,6 +813,9 @@ bool magic_mapping(int map_radius, int proportion, bool suppress_msg,
         }
     }
 
+    // This can reach well beyond what travel rechecks on each step.
+    travel_knowledge_changed();
+
     if (!suppress_msg)
     {
         if (did_map)